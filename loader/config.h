@@ -3,9 +3,54 @@
 
 #define DEBUG
 
+// log the game's raw format arguments instead of text, decode with tools/logdecode.c
+// #define BINARY_LOG
+
+// bind PLT imports on first call instead of at boot
+// #define LAZY_BIND
+
+// split relocation and symbol resolution over the three user cores, off
+// until it shows a gain on the Vita, compare with tools/sobench.c
+// #define SO_WORKERS
+
+// sample the game thread and write folded stacks to DATA_PATH
+// #define PROFILER
+
+// count calls and time spent in every import, written to DATA_PATH
+// #define IMPORT_STATS
+
+// record boot phases and frame events, SELECT + L + R writes a chrome trace
+// #define TRACE
+
+// performance overlay, SELECT + START toggles it. the cpu load is sampled by
+// a lowest priority probe per core that spins 1 ms out of every 5, so it
+// costs up to 20% of each idle core and short bursts can be missed
+// #define HUD
+
+// frame time percentiles written to DATA_PATH every 30 s
+// #define FRAME_STATS
+
+// record input, clocks and rand to DATA_PATH/replay.bin, or play it back if it exists
+// #define INPUT_REPLAY
+
+// time the game functions listed in detours.txt, editable while running
+// #define DETOURS
+
+// live mmap views and mapped bytes per file written to DATA_PATH/mappings.txt
+// #define MAPPING_STATS
+
+// mutex wait times and call sites written to DATA_PATH/locks.txt at exit
+// and on SELECT + L + R
+// #define LOCK_STATS
+
+// pin the main, audio and game threads to cores per DATA_PATH/threads.cfg,
+// cpu time per thread written to DATA_PATH/thread_stats.txt
+// #define THREAD_POLICY
+
 #define LOAD_ADDRESS 0x98000000
 
 #define DATA_PATH "ux0:data/homm3hd"
 #define SO_PATH DATA_PATH "/" "libhomm3.so"
+#define SO_CACHE_PATH DATA_PATH "/" "libhomm3.cache"
 
 #endif
@@ -0,0 +1,168 @@
+/* detours.c -- timing wrappers around game functions, toggled at runtime
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/io/stat.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "imports.h"
+#include "detours.h"
+
+// DETOURS_PATH lists one mangled symbol per line, a leading '-' keeps the
+// detour built but disabled and '#' starts a comment. the list is reread
+// when it changes, so functions can be switched on and off while playing
+typedef struct {
+  char name[128];
+  so_detour detour;
+  import_record rec;
+} detour_entry;
+
+static detour_entry detours[DETOURS_MAX];
+static int num_detours = 0;
+
+static so_module *detours_mod;
+static SceDateTime detours_mtime;
+static int detours_dumping = 0;
+
+static detour_entry *detours_get(const char *name) {
+  for (int i = 0; i < num_detours; i++) {
+    if (strcmp(detours[i].name, name) == 0)
+      return &detours[i];
+  }
+
+  if (num_detours == DETOURS_MAX)
+    return NULL;
+
+  // failures are kept too so they aren't retried on every reload
+  detour_entry *d = &detours[num_detours++];
+  strncpy(d->name, name, sizeof(d->name) - 1);
+  d->rec.name = d->name;
+
+  uintptr_t addr = so_symbol(detours_mod, name);
+  if (!addr) {
+    debugPrintf("detours: %s not found\n", name);
+    return d;
+  }
+
+  uintptr_t thunk = imports_wrap(&d->rec);
+  if (!thunk || so_detour_create(&d->detour, addr, thunk) < 0) {
+    debugPrintf("detours: can't detour %s\n", name);
+    return d;
+  }
+
+  d->rec.target = d->detour.trampoline;
+  return d;
+}
+
+static void detours_load(void) {
+  int enable[DETOURS_MAX];
+  memset(enable, 0, sizeof(enable));
+
+  FILE *f = fopen(DETOURS_PATH, "r");
+  if (f) {
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+      char *name = line;
+      while (isspace((unsigned char)*name))
+        name++;
+      char *end = name + strcspn(name, "# \t\r\n");
+      *end = '\0';
+
+      int on = 1;
+      if (*name == '-') {
+        on = 0;
+        name++;
+      }
+      if (*name == '\0')
+        continue;
+
+      detour_entry *d = detours_get(name);
+      if (d)
+        enable[d - detours] = on;
+    }
+    fclose(f);
+  }
+
+  for (int i = 0; i < num_detours; i++) {
+    if (detours[i].detour.enabled != enable[i])
+      debugPrintf("detours: %s %s\n", detours[i].name, enable[i] ? "enabled" : "disabled");
+    so_detour_enable(&detours[i].detour, enable[i]);
+  }
+}
+
+void detours_dump_stats(void) {
+  if (__sync_lock_test_and_set(&detours_dumping, 1) != 0)
+    return;
+
+  SceUID fd = sceIoOpen(DETOURS_STATS_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd >= 0) {
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%-48s %3s %12s %14s %10s %10s\n", "function", "on", "calls", "total us", "avg us", "untimed");
+    sceIoWrite(fd, line, len);
+
+    for (int i = 0; i < num_detours; i++) {
+      detour_entry *d = &detours[i];
+      if (!d->detour.trampoline)
+        continue;
+      uint32_t calls = d->rec.calls;
+      SceUInt64 total = d->rec.total;
+      len = snprintf(line, sizeof(line), "%-48s %3d %12u %14llu %10llu %10u\n", d->name, d->detour.enabled,
+                     calls, total, calls ? total / calls : 0, d->rec.untimed);
+      if (len >= sizeof(line))
+        len = sizeof(line) - 1;
+      sceIoWrite(fd, line, len);
+    }
+    sceIoClose(fd);
+  }
+
+  __sync_lock_release(&detours_dumping);
+}
+
+static int detours_changed(void) {
+  SceIoStat stat;
+  if (sceIoGetstat(DETOURS_PATH, &stat) < 0)
+    memset(&stat.st_mtime, 0, sizeof(SceDateTime));
+
+  if (memcmp(&stat.st_mtime, &detours_mtime, sizeof(SceDateTime)) == 0)
+    return 0;
+
+  detours_mtime = stat.st_mtime;
+  return 1;
+}
+
+static int detours_thread(SceSize args, void *argp) {
+  while (1) {
+    sceKernelDelayThread(DETOURS_POLL_INTERVAL);
+    if (detours_changed())
+      detours_load();
+    detours_dump_stats();
+  }
+
+  return sceKernelExitDeleteThread(0);
+}
+
+// builds and enables the listed detours, call before the game runs
+int detours_start(so_module *mod) {
+  detours_mod = mod;
+  detours_changed();
+  detours_load();
+
+  SceUID thid = sceKernelCreateThread("detours", detours_thread, 0x10000100 + 10, 0x4000, 0, 0, NULL);
+  if (thid < 0)
+    return thid;
+
+  sceKernelStartThread(thid, 0, NULL);
+  atexit(detours_dump_stats);
+
+  return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef __DETOURS_H__
+#define __DETOURS_H__
+
+#include "so_util.h"
+
+#define DETOURS_PATH DATA_PATH "/" "detours.txt"
+#define DETOURS_STATS_PATH DATA_PATH "/" "detours_stats.txt"
+
+#define DETOURS_MAX 64
+#define DETOURS_POLL_INTERVAL 2000000 // us between checks of the list
+
+int detours_start(so_module *mod);
+void detours_dump_stats(void);
+
+#endif
@@ -0,0 +1,159 @@
+/* frame_stats.c -- frame time histograms and percentiles
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "frame_stats.h"
+
+#ifdef FRAME_STATS
+
+// the game has no screen id we can read, so frames are split by whether
+// they opened files: loading and streaming hitches land apart from the rest
+enum {
+  FRAME_SCREEN_GAME,
+  FRAME_SCREEN_LOADING,
+  FRAME_NUM_SCREENS,
+};
+
+static const char *frame_screen_names[FRAME_NUM_SCREENS] = { "game", "loading" };
+
+typedef struct {
+  uint32_t buckets[FRAME_HIST_BUCKETS];
+  uint32_t frames;
+  uint32_t hitches;
+  uint32_t max_us;
+  uint64_t total_us;
+} frame_histogram;
+
+static frame_histogram frame_hists[FRAME_NUM_SCREENS];
+
+static uint64_t frame_last = 0;
+static int frame_registered = 0;
+static int frame_writing = 0;
+static volatile uint32_t frame_io = 0;
+
+// log-linear buckets: exact below 2^SUB_BITS, then 2^SUB_BITS per power of two
+static int frame_hist_index(uint32_t us) {
+  if (us < (1 << FRAME_HIST_SUB_BITS))
+    return us;
+
+  int msb = 31 - __builtin_clz(us);
+  if (msb >= FRAME_HIST_MAX_BITS)
+    return FRAME_HIST_BUCKETS - 1;
+
+  int shift = msb - FRAME_HIST_SUB_BITS;
+  return ((shift + 1) << FRAME_HIST_SUB_BITS) + (us >> shift) - (1 << FRAME_HIST_SUB_BITS);
+}
+
+// upper edge of a bucket, so percentiles never read low
+static uint32_t frame_hist_value(int index) {
+  if (index < (1 << FRAME_HIST_SUB_BITS))
+    return index;
+
+  int shift = (index >> FRAME_HIST_SUB_BITS) - 1;
+  uint32_t sub = index & ((1 << FRAME_HIST_SUB_BITS) - 1);
+  return ((sub + (1 << FRAME_HIST_SUB_BITS)) << shift) + (1 << shift) - 1;
+}
+
+static uint32_t frame_hist_percentile(const frame_histogram *h, int percent) {
+  uint32_t rank = ((uint64_t)h->frames * percent + 99) / 100;
+  uint32_t seen = 0;
+
+  for (int i = 0; i < FRAME_HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank && h->buckets[i]) {
+      uint32_t value = frame_hist_value(i);
+      return value < h->max_us ? value : h->max_us;
+    }
+  }
+
+  return h->max_us;
+}
+
+void frame_stats_io(void) {
+  frame_io = 1;
+}
+
+void frame_stats_write(void) {
+  char buf[1024];
+  int len = 0;
+
+  if (__sync_lock_test_and_set(&frame_writing, 1) != 0)
+    return;
+
+  len += snprintf(buf + len, sizeof(buf) - len, "%-8s %8s %8s %8s %8s %8s %8s %8s\n",
+                  "screen", "frames", "avg ms", "p50 ms", "p95 ms", "p99 ms", "max ms", "hitches");
+
+  for (int i = 0; i < FRAME_NUM_SCREENS; i++) {
+    frame_histogram *h = &frame_hists[i];
+    if (h->frames == 0)
+      continue;
+
+    uint32_t avg = h->total_us / h->frames;
+    uint32_t p50 = frame_hist_percentile(h, 50);
+    uint32_t p95 = frame_hist_percentile(h, 95);
+    uint32_t p99 = frame_hist_percentile(h, 99);
+
+    len += snprintf(buf + len, sizeof(buf) - len, "%-8s %8u %8.2f %8.2f %8.2f %8.2f %8.2f %8u\n",
+                    frame_screen_names[i], h->frames, avg / 1000.0f, p50 / 1000.0f, p95 / 1000.0f,
+                    p99 / 1000.0f, h->max_us / 1000.0f, h->hitches);
+    if (len >= sizeof(buf))
+      len = sizeof(buf) - 1;
+  }
+
+  SceUID fd = sceIoOpen(FRAME_STATS_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd >= 0) {
+    sceIoWrite(fd, buf, len);
+    sceIoClose(fd);
+  }
+
+  __sync_lock_release(&frame_writing);
+}
+
+// the report is written from its own thread so the card never stalls a frame
+static int frame_stats_thread(SceSize args, void *argp) {
+  while (1) {
+    sceKernelDelayThread(FRAME_STATS_INTERVAL);
+    frame_stats_write();
+  }
+
+  return sceKernelExitDeleteThread(0);
+}
+
+// called once per present with the time it returned
+void frame_stats_frame(uint64_t now) {
+  int screen = frame_io ? FRAME_SCREEN_LOADING : FRAME_SCREEN_GAME;
+  frame_io = 0;
+
+  if (!frame_registered) {
+    SceUID thid = sceKernelCreateThread("frame_stats", frame_stats_thread, 0x10000100 + 20, 0x4000, 0, 0, NULL);
+    if (thid >= 0)
+      sceKernelStartThread(thid, 0, NULL);
+    atexit(frame_stats_write);
+    frame_registered = 1;
+  } else {
+    uint32_t us = now - frame_last;
+    frame_histogram *h = &frame_hists[screen];
+    h->buckets[frame_hist_index(us)]++;
+    h->frames++;
+    h->total_us += us;
+    if (us > h->max_us)
+      h->max_us = us;
+    if (us > FRAME_HITCH_US)
+      h->hitches++;
+  }
+
+  frame_last = now;
+}
+
+#endif
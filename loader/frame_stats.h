@@ -0,0 +1,29 @@
+#ifndef __FRAME_STATS_H__
+#define __FRAME_STATS_H__
+
+#include <stdint.h>
+#include "config.h"
+
+#define FRAME_STATS_PATH DATA_PATH "/" "frame_stats.txt"
+
+#define FRAME_STATS_INTERVAL 30000000 // us between writes of the report
+#define FRAME_HITCH_US 50000          // frames longer than this count as hitches
+#define FRAME_HIST_SUB_BITS 4         // 16 buckets per power of two, ~6% error
+#define FRAME_HIST_MAX_BITS 23        // frames up to ~8 s
+#define FRAME_HIST_BUCKETS ((FRAME_HIST_MAX_BITS - FRAME_HIST_SUB_BITS + 1) << FRAME_HIST_SUB_BITS)
+
+#ifdef FRAME_STATS
+
+void frame_stats_frame(uint64_t now);
+void frame_stats_io(void);
+void frame_stats_write(void);
+
+#define FRAME_STATS_IO() frame_stats_io()
+
+#else
+
+#define FRAME_STATS_IO()
+
+#endif
+
+#endif
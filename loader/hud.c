@@ -0,0 +1,219 @@
+/* hud.c -- on-screen performance overlay
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/ctrl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <vitaGL.h>
+
+#include "hud.h"
+
+#ifdef HUD
+
+#define HUD_TOGGLE (SCE_CTRL_SELECT | SCE_CTRL_START)
+#define HUD_GRAPH_HEIGHT 60 // px, 2 px per ms
+#define HUD_IDLE_PRIORITY 191
+#define HUD_IDLE_SLICE 1000 // us the idle probe spins per cycle
+#define HUD_IDLE_SLEEP 4000 // us it blocks between slices
+#define HUD_IDLE_GAP 50     // us, longer gaps between clock reads are preemption
+
+extern int _newlib_heap_size_user;
+
+hud_stats hud_state;
+
+static volatile int hud_enabled = 0, hud_idle_gen = 0;
+static uint32_t hud_old_buttons = 0;
+static uint64_t hud_idle_us[HUD_NUM_CORES];
+
+static SDL_Rect hud_panel;
+static SDL_Rect hud_text_rects[HUD_MAX_RECTS];
+static int hud_num_text_rects = 0;
+static int hud_text_bottom = HUD_Y;
+
+// 3x5 glyphs, one octal digit per row with the leftmost dot in the high bit
+static const char hud_font_chars[] = "0123456789ABCDEFGHILMPRSTUVWX%./:-";
+static const uint16_t hud_font[] = {
+  075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717,
+  025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227, 044447,
+  057755, 065644, 065655, 034216, 072222, 055557, 055552, 055775, 055255, 051245,
+  000002, 011244, 002020, 000700,
+};
+
+static uint16_t hud_glyph(char c) {
+  const char *p = strchr(hud_font_chars, c);
+  return (c && p) ? hud_font[p - hud_font_chars] : 0;
+}
+
+// turns the text into filled rects once per update instead of every frame,
+// with each run of dots in a glyph row merged into one rect
+static void hud_layout_text(const char *text) {
+  int x = HUD_X, y = HUD_Y, right = HUD_X;
+  int n = 0;
+
+  for (; *text; text++) {
+    if (*text == '\n') {
+      x = HUD_X;
+      y += 7 * HUD_SCALE;
+      continue;
+    }
+
+    uint16_t glyph = hud_glyph(*text);
+    for (int row = 0; row < 5 && glyph; row++) {
+      int bits = (glyph >> (12 - row * 3)) & 7;
+      for (int col = 0; col < 3; col++) {
+        if (!(bits & (4 >> col)))
+          continue;
+        int len = 1;
+        while (col + len < 3 && (bits & (4 >> (col + len))))
+          len++;
+        if (n < HUD_MAX_RECTS) {
+          SDL_Rect *r = &hud_text_rects[n++];
+          r->x = x + col * HUD_SCALE;
+          r->y = y + row * HUD_SCALE;
+          r->w = len * HUD_SCALE;
+          r->h = HUD_SCALE;
+        }
+        col += len - 1;
+      }
+    }
+
+    x += 4 * HUD_SCALE;
+    if (x > right)
+      right = x;
+  }
+
+  hud_num_text_rects = n;
+  hud_text_bottom = y + 6 * HUD_SCALE;
+
+  int graph_right = HUD_X + HUD_GRAPH_FRAMES * 2;
+  hud_panel.x = HUD_X - 4;
+  hud_panel.y = HUD_Y - 4;
+  hud_panel.w = (right > graph_right ? right : graph_right) - hud_panel.x + 4;
+  hud_panel.h = hud_text_bottom + 4 + HUD_GRAPH_HEIGHT - hud_panel.y + 4;
+}
+
+// spins at the lowest priority, so its run time is the core's idle time
+// spinning at the lowest priority the whole time would keep every core at
+// 100% and cost battery, so the probe spins a short slice and blocks. the
+// time it gets during the slice is a sample of the core's idle time over the
+// cycle, a wake up later than asked counts as busy
+static int hud_idle_thread(SceSize args, void *argp) {
+  int core = ((int *)argp)[0], gen = ((int *)argp)[1];
+
+  while (hud_enabled && hud_idle_gen == gen) {
+    SceUInt64 start = sceKernelGetProcessTimeWide(), last = start;
+    SceUInt64 got = 0;
+    while (last - start < HUD_IDLE_SLICE) {
+      SceUInt64 now = sceKernelGetProcessTimeWide();
+      if (now - last < HUD_IDLE_GAP)
+        got += now - last;
+      last = now;
+    }
+
+    sceKernelDelayThread(HUD_IDLE_SLEEP);
+    __sync_fetch_and_add(&hud_idle_us[core], got + got * HUD_IDLE_SLEEP / (last - start));
+  }
+
+  return sceKernelExitDeleteThread(0);
+}
+
+static void hud_enable(int enable) {
+  hud_enabled = enable;
+
+  if (enable) {
+    // probes still blocked from an earlier toggle see the new generation and exit
+    int gen = __sync_add_and_fetch(&hud_idle_gen, 1);
+    for (int i = 0; i < HUD_NUM_CORES; i++) {
+      int argp[2] = { i, gen };
+      SceUID thid = sceKernelCreateThread("hud_idle", hud_idle_thread, HUD_IDLE_PRIORITY, 0x1000, 0, SCE_KERNEL_CPU_MASK_USER_0 << i, NULL);
+      if (thid >= 0)
+        sceKernelStartThread(thid, sizeof(argp), argp);
+    }
+    hud_state.last_update = 0;
+  }
+}
+
+void hud_input(uint32_t buttons) {
+  if ((buttons & HUD_TOGGLE) == HUD_TOGGLE && (hud_old_buttons & HUD_TOGGLE) != HUD_TOGGLE)
+    hud_enable(!hud_enabled);
+  hud_old_buttons = buttons;
+}
+
+static void hud_update(SceUInt64 now) {
+  uint64_t idle_us[HUD_NUM_CORES];
+  for (int i = 0; i < HUD_NUM_CORES; i++)
+    idle_us[i] = __sync_fetch_and_add(&hud_idle_us[i], 0);
+
+  struct mallinfo mi = mallinfo();
+
+  hud_stats_update(&hud_state, now, idle_us, mi.uordblks, _newlib_heap_size_user, vglMemFree(VGL_MEM_ALL));
+
+  char text[256];
+  hud_stats_format(&hud_state, text, sizeof(text));
+  hud_layout_text(text);
+}
+
+void hud_draw(SDL_Renderer *renderer) {
+  if (!hud_enabled)
+    return;
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+
+  if (hud_stats_update_due(&hud_state, start))
+    hud_update(start);
+
+  SDL_Rect ok[HUD_GRAPH_FRAMES], slow[HUD_GRAPH_FRAMES];
+  int num_ok = 0, num_slow = 0;
+  int base = hud_text_bottom + 4 + HUD_GRAPH_HEIGHT;
+
+  for (int i = 0; i < HUD_GRAPH_FRAMES; i++) {
+    uint32_t us = hud_state.frame_us[(hud_state.frame_pos + i) % HUD_GRAPH_FRAMES];
+    int h = us / 500;
+    if (h > HUD_GRAPH_HEIGHT)
+      h = HUD_GRAPH_HEIGHT;
+    SDL_Rect *r = us > 33334 ? &slow[num_slow++] : &ok[num_ok++];
+    r->x = HUD_X + i * 2;
+    r->y = base - h;
+    r->w = 2;
+    r->h = h;
+  }
+
+  SDL_Rect target = { HUD_X, base - 16667 / 500, HUD_GRAPH_FRAMES * 2, 1 };
+
+  Uint8 r, g, b, a;
+  SDL_BlendMode mode;
+  SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+  SDL_GetRenderDrawBlendMode(renderer, &mode);
+
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+  SDL_RenderFillRect(renderer, &hud_panel);
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+  SDL_RenderFillRects(renderer, hud_text_rects, hud_num_text_rects);
+  SDL_SetRenderDrawColor(renderer, 64, 224, 64, 255);
+  SDL_RenderFillRects(renderer, ok, num_ok);
+  SDL_SetRenderDrawColor(renderer, 240, 64, 64, 255);
+  SDL_RenderFillRects(renderer, slow, num_slow);
+  SDL_SetRenderDrawColor(renderer, 240, 240, 64, 255);
+  SDL_RenderFillRect(renderer, &target);
+
+  SDL_SetRenderDrawColor(renderer, r, g, b, a);
+  SDL_SetRenderDrawBlendMode(renderer, mode);
+
+  hud_state.hud_us = sceKernelGetProcessTimeWide() - start;
+}
+
+void hud_frame(void) {
+  hud_stats_frame(&hud_state, sceKernelGetProcessTimeWide());
+}
+
+#endif
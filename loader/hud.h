@@ -0,0 +1,29 @@
+#ifndef __HUD_H__
+#define __HUD_H__
+
+#include <SDL2/SDL.h>
+#include "config.h"
+#include "hud_stats.h"
+
+#define HUD_SCALE 2      // pixels per font dot
+#define HUD_X 8
+#define HUD_Y 8
+#define HUD_MAX_RECTS 2048
+
+#ifdef HUD
+
+extern hud_stats hud_state;
+
+void hud_input(uint32_t buttons);
+void hud_draw(SDL_Renderer *renderer);
+void hud_frame(void);
+
+#define HUD_COUNT(counter) __sync_fetch_and_add(&hud_state.counter, 1)
+
+#else
+
+#define HUD_COUNT(counter)
+
+#endif
+
+#endif
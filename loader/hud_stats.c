@@ -0,0 +1,72 @@
+/* hud_stats.c -- numbers behind the performance overlay
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hud_stats.h"
+
+// closes the frame that ends at now
+void hud_stats_frame(hud_stats *s, uint64_t now) {
+  if (s->last_frame) {
+    uint32_t us = now - s->last_frame;
+    s->frame_us[s->frame_pos] = us;
+    s->frame_pos = (s->frame_pos + 1) % HUD_GRAPH_FRAMES;
+    if (us > s->window_max_us)
+      s->window_max_us = us;
+    s->update_frames++;
+  }
+  s->last_frame = now;
+
+  s->frame_draws = __sync_lock_test_and_set(&s->draws, 0);
+  s->frame_textures = __sync_lock_test_and_set(&s->textures, 0);
+}
+
+int hud_stats_update_due(hud_stats *s, uint64_t now) {
+  return now - s->last_update >= HUD_UPDATE_INTERVAL;
+}
+
+// idle_us holds the cumulative idle time the probe on each core estimated
+void hud_stats_update(hud_stats *s, uint64_t now, const uint64_t *idle_us,
+                      size_t heap_used, size_t heap_total, size_t gpu_free) {
+  uint64_t elapsed = now - s->last_update;
+
+  if (s->last_update && elapsed) {
+    s->fps_x10 = s->update_frames * 10000000ull / elapsed;
+
+    for (int i = 0; i < HUD_NUM_CORES; i++) {
+      uint64_t idle = idle_us[i] - s->idle_us[i];
+      int load = 100 - (int)(idle * 100 / elapsed);
+      s->cpu_load[i] = load < 0 ? 0 : (load > 100 ? 100 : load);
+    }
+  }
+
+  memcpy(s->idle_us, idle_us, sizeof(s->idle_us));
+  s->heap_used = heap_used;
+  s->heap_total = heap_total;
+  s->gpu_free = gpu_free;
+
+  s->max_frame_us = s->window_max_us;
+  s->window_max_us = 0;
+  s->last_update = now;
+  s->update_frames = 0;
+}
+
+// the text is upper case, the overlay font has no lower case
+int hud_stats_format(const hud_stats *s, char *buf, size_t size) {
+  return snprintf(buf, size,
+                  "FPS %u.%u MAX %u.%uMS HUD %u.%02uMS\n"
+                  "CPU %d%% %d%% %d%%\n"
+                  "HEAP %u/%uMB VGL FREE %uMB\n"
+                  "DRAW %u TEX %u",
+                  s->fps_x10 / 10, s->fps_x10 % 10,
+                  s->max_frame_us / 1000, (s->max_frame_us / 100) % 10,
+                  s->hud_us / 1000, (s->hud_us / 10) % 100,
+                  s->cpu_load[0], s->cpu_load[1], s->cpu_load[2],
+                  (unsigned)(s->heap_used >> 20), (unsigned)(s->heap_total >> 20),
+                  (unsigned)(s->gpu_free >> 20),
+                  s->frame_draws, s->frame_textures);
+}
@@ -0,0 +1,47 @@
+#ifndef __HUD_STATS_H__
+#define __HUD_STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// plain C with no platform calls, so it also builds on a host with a null
+// renderer feeding it timestamps
+
+#define HUD_GRAPH_FRAMES 128
+#define HUD_NUM_CORES 3
+#define HUD_UPDATE_INTERVAL 250000 // us between refreshes of the text
+
+typedef struct {
+  // per frame, bumped by the import wrappers from any thread
+  volatile uint32_t draws;
+  volatile uint32_t textures;
+
+  // results of the last complete frame
+  uint32_t frame_draws;
+  uint32_t frame_textures;
+
+  uint64_t last_frame;
+  uint32_t frame_us[HUD_GRAPH_FRAMES];
+  int frame_pos;
+
+  // refreshed every HUD_UPDATE_INTERVAL
+  uint64_t last_update;
+  uint32_t update_frames;
+  uint32_t window_max_us;
+  uint32_t fps_x10;
+  uint32_t max_frame_us;
+  uint32_t hud_us;
+  int cpu_load[HUD_NUM_CORES];
+  size_t heap_used, heap_total;
+  size_t gpu_free;
+
+  uint64_t idle_us[HUD_NUM_CORES];
+} hud_stats;
+
+void hud_stats_frame(hud_stats *s, uint64_t now);
+int hud_stats_update_due(hud_stats *s, uint64_t now);
+void hud_stats_update(hud_stats *s, uint64_t now, const uint64_t *idle_us,
+                      size_t heap_used, size_t heap_total, size_t gpu_free);
+int hud_stats_format(const hud_stats *s, char *buf, size_t size);
+
+#endif
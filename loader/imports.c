@@ -0,0 +1,317 @@
+/* imports.c -- call thunks around the imports of a loaded module
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/threadmgr.h>
+#include <kubridge.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "dialog.h"
+#include "imports.h"
+
+static import_thread import_threads[IMPORT_MAX_THREADS];
+
+static import_record *import_records = NULL;
+static int num_import_records = 0;
+
+static uintptr_t import_wrap_base = 0;
+static int num_import_wraps = 0;
+
+#ifdef IMPORT_STATS
+static int import_stats_busy = 0;
+#endif
+
+// every PLT slot of an import points at one of these
+static const uint32_t import_thunk[] = {
+  0xe59fc000, // LDR IP, [PC]
+  0xe59ff000, // LDR PC, [PC]
+  0x00000000, // import_record *
+  0x00000000, // import_entry
+};
+
+// pushes the caller's return address on a per-thread shadow stack and
+// enters the import with the LR import_enter picks, normally the exit path,
+// so stack arguments are passed through untouched
+static const uint32_t import_entry[] = {
+  0xe92d500f, // PUSH {R0-R3, IP, LR}
+  0xe1a0000c, // MOV R0, IP
+  0xe1a0100e, // MOV R1, LR
+  0xe59f2038, // LDR R2, [PC, #0x38]
+  0xe59f3030, // LDR R3, [PC, #0x30]
+  0xe12fff33, // BLX R3
+  0xe1a0c000, // MOV IP, R0
+  0xe58d1014, // STR R1, [SP, #0x14]
+  0xe8bd000f, // POP {R0-R3}
+  0xe28dd004, // ADD SP, SP, #4
+  0xe49de004, // POP {LR}
+  0xe12fff1c, // BX IP
+  // exit
+  0xe92d0003, // PUSH {R0, R1}
+  0xe59f3014, // LDR R3, [PC, #0x14]
+  0xe12fff33, // BLX R3
+  0xe1a0c000, // MOV IP, R0
+  0xe8bd0003, // POP {R0, R1}
+  0xe12fff1c, // BX IP
+  0x00000000, // import_enter
+  0x00000000, // exit
+  0x00000000, // import_exit
+};
+
+#define IMPORT_EXIT_OFFSET (12 * sizeof(uint32_t))
+
+import_thread *imports_find_thread(SceUID thid) {
+  uint32_t h = (uint32_t)thid * 0x9e3779b1;
+  for (int i = 0; i < IMPORT_MAX_THREADS; i++) {
+    import_thread *t = &import_threads[(h + i) % IMPORT_MAX_THREADS];
+    if (t->thid == thid)
+      return t;
+    if (t->thid == 0)
+      return NULL;
+  }
+  return NULL;
+}
+
+static import_thread *import_get_thread(void) {
+  SceUID thid = sceKernelGetThreadId();
+  uint32_t h = (uint32_t)thid * 0x9e3779b1;
+
+  for (int i = 0; i < IMPORT_MAX_THREADS; i++) {
+    import_thread *t = &import_threads[(h + i) % IMPORT_MAX_THREADS];
+    if (t->thid == thid)
+      return t;
+    if (t->thid == 0 && __sync_bool_compare_and_swap(&t->thid, 0, thid))
+      return t;
+  }
+
+  // the table is full, take over the slot of a thread that has exited
+  for (int i = 0; i < IMPORT_MAX_THREADS; i++) {
+    import_thread *t = &import_threads[(h + i) % IMPORT_MAX_THREADS];
+    SceKernelThreadInfo info;
+    info.size = sizeof(info);
+    SceUID old = t->thid;
+    if (sceKernelGetThreadInfo(old, &info) < 0 && __sync_bool_compare_and_swap(&t->thid, old, thid)) {
+      t->depth = 0;
+      t->last_lr = 0;
+      return t;
+    }
+  }
+
+  fatal_error("Error too many threads calling imports.");
+}
+
+// returns the target in R0 and the LR to enter it with in R1
+static uint64_t import_enter(import_record *rec, uintptr_t lr, uintptr_t exit) {
+  import_thread *t = import_get_thread();
+
+  // deep recursion through a detour runs past the shadow stack, those calls
+  // return straight to the caller and are only counted
+  if (t->depth == IMPORT_STACK_DEPTH) {
+    if (rec->timed)
+      __sync_fetch_and_add(&rec->untimed, 1);
+    return (uint64_t)lr << 32 | rec->target;
+  }
+
+  t->frames[t->depth].lr = lr;
+  t->frames[t->depth].rec = rec;
+  if (rec->timed)
+    t->frames[t->depth].start = sceKernelGetProcessTimeWide();
+  t->depth++;
+
+  return (uint64_t)exit << 32 | rec->target;
+}
+
+static uintptr_t import_exit(void) {
+  import_thread *t = import_get_thread();
+
+  t->depth--;
+  t->last_lr = t->frames[t->depth].lr;
+
+  import_frame *frame = &t->frames[t->depth];
+  if (frame->rec->timed) {
+    SceUInt64 now = sceKernelGetProcessTimeWide();
+    __sync_fetch_and_add(&frame->rec->calls, 1);
+    __sync_fetch_and_add(&frame->rec->total, now - frame->start);
+  }
+
+  return t->last_lr;
+}
+
+#ifdef IMPORT_STATS
+// the table is written from its own thread so the game threads never wait on the card
+static int import_stats_thread(SceSize args, void *argp) {
+  while (1) {
+    sceKernelDelayThread(IMPORT_STATS_INTERVAL);
+    imports_dump_stats();
+  }
+
+  return sceKernelExitDeleteThread(0);
+}
+
+static int import_cmp(const void *a, const void *b) {
+  const import_record *ra = *(const import_record **)a;
+  const import_record *rb = *(const import_record **)b;
+  if (ra->total != rb->total)
+    return ra->total < rb->total ? 1 : -1;
+  return ra->calls < rb->calls ? 1 : (ra->calls > rb->calls ? -1 : 0);
+}
+#endif
+
+void imports_dump_stats(void) {
+#ifdef IMPORT_STATS
+  if (__sync_lock_test_and_set(&import_stats_busy, 1) != 0)
+    return;
+
+  import_record **sorted = malloc(num_import_records * sizeof(import_record *));
+  if (!sorted)
+    goto out;
+
+  int num_sorted = 0;
+  for (int i = 0; i < num_import_records; i++) {
+    if (import_records[i].calls || import_records[i].untimed)
+      sorted[num_sorted++] = &import_records[i];
+  }
+  qsort(sorted, num_sorted, sizeof(import_record *), import_cmp);
+
+  SceUID fd = sceIoOpen(IMPORT_STATS_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd >= 0) {
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%-40s %12s %14s %10s %10s\n", "import", "calls", "total us", "avg us", "untimed");
+    sceIoWrite(fd, line, len);
+
+    for (int i = 0; i < num_sorted; i++) {
+      import_record *rec = sorted[i];
+      uint32_t calls = rec->calls;
+      SceUInt64 total = rec->total;
+      len = snprintf(line, sizeof(line), "%-40s %12u %14llu %10llu %10u\n", rec->name, calls, total,
+                     calls ? total / calls : 0, rec->untimed);
+      if (len >= sizeof(line))
+        len = sizeof(line) - 1;
+      sceIoWrite(fd, line, len);
+    }
+    sceIoClose(fd);
+  }
+
+  free(sorted);
+out:
+  __sync_lock_release(&import_stats_busy);
+#endif
+}
+
+// allocates an RX block for the entry code followed by num_thunks thunks,
+// code receives the entry code as it must be copied to the block
+static SceUID import_alloc_code(const char *name, int num_thunks, uint32_t *code, uintptr_t *code_base) {
+  size_t code_size = sizeof(import_entry) + num_thunks * sizeof(import_thunk);
+  SceUID blockid = kuKernelAllocMemBlock(name, SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, ALIGN_MEM(code_size, 0x1000), NULL);
+  if (blockid < 0)
+    return blockid;
+
+  sceKernelGetMemBlockBase(blockid, (void **)code_base);
+
+  memcpy(code, import_entry, sizeof(import_entry));
+  code[18] = (uintptr_t)&import_enter;
+  code[19] = *code_base + IMPORT_EXIT_OFFSET;
+  code[20] = (uintptr_t)&import_exit;
+  return blockid;
+}
+
+static void import_fill_thunk(uint32_t *thunk, import_record *rec, uintptr_t code_base) {
+  memcpy(thunk, import_thunk, sizeof(import_thunk));
+  thunk[2] = (uintptr_t)rec;
+  thunk[3] = code_base;
+}
+
+// returns a thunk that times rec and then enters rec->target, for hooks
+// that don't go through a PLT slot
+uintptr_t imports_wrap(import_record *rec) {
+  if (!import_wrap_base) {
+    uint32_t code[sizeof(import_entry) / sizeof(uint32_t)];
+    if (import_alloc_code("import_wrap_block", IMPORT_MAX_WRAPS, code, &import_wrap_base) < 0) {
+      import_wrap_base = 0;
+      return 0;
+    }
+    kuKernelCpuUnrestrictedMemcpy((void *)import_wrap_base, code, sizeof(code));
+    kuKernelFlushCaches((void *)import_wrap_base, sizeof(code));
+  }
+
+  if (num_import_wraps == IMPORT_MAX_WRAPS)
+    return 0;
+
+  uint32_t thunk[sizeof(import_thunk) / sizeof(uint32_t)];
+  uintptr_t addr = import_wrap_base + sizeof(import_entry) + num_import_wraps * sizeof(import_thunk);
+  rec->timed = 1;
+  import_fill_thunk(thunk, rec, import_wrap_base);
+  kuKernelCpuUnrestrictedMemcpy((void *)addr, thunk, sizeof(thunk));
+  kuKernelFlushCaches((void *)addr, sizeof(thunk));
+  num_import_wraps++;
+
+  return addr;
+}
+
+int imports_instrument(so_module *mod) {
+  int num_slots = 0;
+  for (int i = 0; i < mod->num_relplt; i++) {
+    if (ELF32_R_TYPE(mod->relplt[i].r_info) == R_ARM_JUMP_SLOT &&
+        mod->dynsym[ELF32_R_SYM(mod->relplt[i].r_info)].st_shndx == SHN_UNDEF)
+      num_slots++;
+  }
+
+  import_records = calloc(num_slots, sizeof(import_record));
+  size_t code_size = sizeof(import_entry) + num_slots * sizeof(import_thunk);
+  uint32_t *code = malloc(code_size);
+  if (!import_records || !code)
+    goto err;
+
+  uintptr_t code_base;
+  if (import_alloc_code("import_block", num_slots, code, &code_base) < 0)
+    goto err;
+
+  // only call slots are wrapped, data imports like __sF are left alone
+  for (int i = 0; i < mod->num_relplt; i++) {
+    Elf32_Rel *rel = &mod->relplt[i];
+    Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+    if (ELF32_R_TYPE(rel->r_info) != R_ARM_JUMP_SLOT || sym->st_shndx != SHN_UNDEF)
+      continue;
+
+    uintptr_t *slot = (uintptr_t *)(mod->text_base + rel->r_offset);
+    import_record *rec = &import_records[num_import_records];
+    rec->name = mod->dynstr + sym->st_name;
+    rec->target = *slot;
+#ifdef IMPORT_STATS
+    rec->timed = 1;
+#endif
+
+    uint32_t *thunk = &code[(sizeof(import_entry) + num_import_records * sizeof(import_thunk)) / sizeof(uint32_t)];
+    import_fill_thunk(thunk, rec, code_base);
+
+    *slot = code_base + (uintptr_t)thunk - (uintptr_t)code;
+    num_import_records++;
+  }
+
+  kuKernelCpuUnrestrictedMemcpy((void *)code_base, code, code_size);
+  kuKernelFlushCaches((void *)code_base, code_size);
+  free(code);
+
+#ifdef IMPORT_STATS
+  SceUID thid = sceKernelCreateThread("import_stats", import_stats_thread, 0x10000100 + 20, 0x4000, 0, 0, NULL);
+  if (thid >= 0)
+    sceKernelStartThread(thid, 0, NULL);
+  atexit(imports_dump_stats);
+#endif
+
+  return 0;
+
+err:
+  free(code);
+  free(import_records);
+  import_records = NULL;
+  return -1;
+}
@@ -0,0 +1,40 @@
+#ifndef __IMPORTS_H__
+#define __IMPORTS_H__
+
+#include "so_util.h"
+
+#define IMPORT_STACK_DEPTH 64
+#define IMPORT_MAX_THREADS 128
+#define IMPORT_MAX_WRAPS 128 // thunks outside of PLT slots, see imports_wrap
+
+#define IMPORT_STATS_PATH DATA_PATH "/" "imports.txt"
+#define IMPORT_STATS_INTERVAL 10000000 // us between writes of the table
+
+typedef struct {
+  const char *name;
+  uintptr_t target;
+  uint32_t calls;
+  SceUInt64 total; // us, including nested imports
+  uint32_t untimed; // calls past IMPORT_STACK_DEPTH, not in calls or total
+  int timed;
+} import_record;
+
+typedef struct {
+  uintptr_t lr;
+  import_record *rec;
+  SceUInt64 start;
+} import_frame;
+
+typedef struct {
+  volatile SceUID thid;
+  volatile int depth;
+  volatile uintptr_t last_lr;
+  import_frame frames[IMPORT_STACK_DEPTH];
+} import_thread;
+
+int imports_instrument(so_module *mod);
+uintptr_t imports_wrap(import_record *rec);
+import_thread *imports_find_thread(SceUID thid);
+void imports_dump_stats(void);
+
+#endif
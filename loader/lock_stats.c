@@ -0,0 +1,173 @@
+/* lock_stats.c -- wait times and call sites of the game's mutexes
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "imports.h"
+#include "lock_stats.h"
+
+#ifdef LOCK_STATS
+
+// entries are only updated right after their lock was taken, so the lock
+// itself serializes everything but claiming the slot
+typedef struct {
+  const void *volatile lock;
+  const char *kind;
+  uintptr_t site;      // first caller
+  uintptr_t wait_site; // caller of the longest wait
+  uint32_t acquisitions;
+  uint32_t contended;
+  SceUInt64 total_wait;
+  SceUInt64 max_wait;
+} lock_stats_entry;
+
+static lock_stats_entry lock_stats[LOCK_STATS_MAX];
+static uint32_t lock_stats_dropped = 0;
+static int lock_stats_writing = 0;
+
+static so_module *lock_stats_mod = NULL;
+
+void lock_stats_set_module(so_module *mod) {
+  lock_stats_mod = mod;
+  atexit(lock_stats_write);
+}
+
+// behind the import thunks the return address is their exit path, the
+// game's call site is then on the shadow stack
+static uintptr_t lock_stats_caller(uintptr_t caller) {
+  so_module *mod = lock_stats_mod;
+  if (!mod || (caller >= mod->text_base && caller < mod->text_base + mod->text_size))
+    return caller;
+
+#if defined(PROFILER) || defined(IMPORT_STATS)
+  import_thread *t = imports_find_thread(sceKernelGetThreadId());
+  if (t && t->depth > 0)
+    return t->frames[t->depth - 1].lr;
+#endif
+
+  return caller;
+}
+
+static lock_stats_entry *lock_stats_get(const void *lock) {
+  uint32_t h = ((uintptr_t)lock >> 2) * 0x9e3779b1;
+
+  for (int i = 0; i < LOCK_STATS_MAX; i++) {
+    lock_stats_entry *e = &lock_stats[(h + i) % LOCK_STATS_MAX];
+    if (e->lock == lock)
+      return e;
+    if (e->lock == NULL && __sync_bool_compare_and_swap(&e->lock, NULL, lock))
+      return e;
+  }
+
+  return NULL;
+}
+
+// call with the lock held
+void lock_stats_record(const void *lock, const char *kind, uintptr_t caller, SceUInt64 wait, int contended) {
+  lock_stats_entry *e = lock_stats_get(lock);
+  if (!e) {
+    __sync_fetch_and_add(&lock_stats_dropped, 1);
+    return;
+  }
+
+  if (e->acquisitions++ == 0) {
+    e->kind = kind;
+    e->site = lock_stats_caller(caller);
+  }
+
+  if (contended) {
+    e->contended++;
+    e->total_wait += wait;
+    if (wait > e->max_wait) {
+      e->max_wait = wait;
+      e->wait_site = lock_stats_caller(caller);
+    }
+  }
+}
+
+// a try first tells contended acquisitions apart without timing the rest
+int lock_stats_lock(const void *lock, SceKernelLwMutexWork *work, uintptr_t caller) {
+  if (sceKernelTryLockLwMutex(work, 1) >= 0) {
+    lock_stats_record(lock, "pthread", caller, 0, 0);
+    return 0;
+  }
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  int ret = sceKernelLockLwMutex(work, 1, NULL);
+  if (ret < 0)
+    return ret;
+
+  lock_stats_record(lock, "pthread", caller, sceKernelGetProcessTimeWide() - start, 1);
+  return 0;
+}
+
+static int lock_stats_cmp(const void *a, const void *b) {
+  const lock_stats_entry *ea = *(const lock_stats_entry **)a;
+  const lock_stats_entry *eb = *(const lock_stats_entry **)b;
+  if (ea->total_wait != eb->total_wait)
+    return ea->total_wait < eb->total_wait ? 1 : -1;
+  return ea->contended < eb->contended ? 1 : (ea->contended > eb->contended ? -1 : 0);
+}
+
+static const char *lock_stats_site(uintptr_t addr, char *buf, int size) {
+  uintptr_t sym_addr = 0;
+  const char *sym = lock_stats_mod && addr ? so_addr_to_symbol(lock_stats_mod, addr, &sym_addr) : NULL;
+  if (sym)
+    snprintf(buf, size, "%s+0x%x", sym, addr - sym_addr);
+  else
+    snprintf(buf, size, "0x%08x", addr);
+  return buf;
+}
+
+void lock_stats_write(void) {
+  static lock_stats_entry *sorted[LOCK_STATS_MAX];
+  char line[512], site[160], wait_site[160];
+  int num_sorted = 0, len;
+
+  if (__sync_lock_test_and_set(&lock_stats_writing, 1) != 0)
+    return;
+
+  for (int i = 0; i < LOCK_STATS_MAX; i++) {
+    if (lock_stats[i].lock && lock_stats[i].acquisitions)
+      sorted[num_sorted++] = &lock_stats[i];
+  }
+  qsort(sorted, num_sorted, sizeof(lock_stats_entry *), lock_stats_cmp);
+
+  SceUID fd = sceIoOpen(LOCK_STATS_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd >= 0) {
+    len = snprintf(line, sizeof(line), "%-8s %-10s %10s %10s %6s %12s %10s  %s / %s\n", "kind", "lock", "locks",
+                   "contended", "%", "wait us", "max us", "first site", "longest wait site");
+    sceIoWrite(fd, line, len);
+
+    for (int i = 0; i < num_sorted; i++) {
+      lock_stats_entry *e = sorted[i];
+      len = snprintf(line, sizeof(line), "%-8s 0x%08x %10u %10u %6.2f %12llu %10llu  %s / %s\n", e->kind,
+                     (uintptr_t)e->lock, e->acquisitions, e->contended, e->contended * 100.0f / e->acquisitions,
+                     e->total_wait, e->max_wait, lock_stats_site(e->site, site, sizeof(site)),
+                     e->contended ? lock_stats_site(e->wait_site, wait_site, sizeof(wait_site)) : "-");
+      if (len >= sizeof(line))
+        len = sizeof(line) - 1;
+      sceIoWrite(fd, line, len);
+    }
+
+    if (lock_stats_dropped) {
+      len = snprintf(line, sizeof(line), "%u acquisitions of untracked locks\n", lock_stats_dropped);
+      sceIoWrite(fd, line, len);
+    }
+    sceIoClose(fd);
+  }
+
+  __sync_lock_release(&lock_stats_writing);
+}
+
+#endif
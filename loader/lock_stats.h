@@ -0,0 +1,20 @@
+#ifndef __LOCK_STATS_H__
+#define __LOCK_STATS_H__
+
+#include <psp2/kernel/threadmgr.h>
+#include "config.h"
+#include "so_util.h"
+
+#define LOCK_STATS_PATH DATA_PATH "/" "locks.txt"
+#define LOCK_STATS_MAX 1024 // locks tracked, later ones are only counted as dropped
+
+#ifdef LOCK_STATS
+
+void lock_stats_set_module(so_module *mod);
+void lock_stats_record(const void *lock, const char *kind, uintptr_t caller, SceUInt64 wait, int contended);
+int lock_stats_lock(const void *lock, SceKernelLwMutexWork *work, uintptr_t caller);
+void lock_stats_write(void);
+
+#endif
+
+#endif
@@ -0,0 +1,475 @@
+/* logger.c -- asynchronous log writer
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+
+#define LOG_ALIGN(x) (((x) + 3) & ~3)
+
+// a record is a header followed by the text, padded to a word
+typedef struct {
+  uint32_t seq;
+  uint32_t len;
+} log_header;
+
+// single producer (the owning thread), single consumer (whoever drains)
+typedef struct {
+  volatile SceUID thid;
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  uint8_t *ring;
+} log_ring;
+
+static log_ring log_rings[LOG_MAX_THREADS];
+
+static uint32_t log_seq = 0;
+static uint32_t log_dropped = 0;
+static uint32_t log_reported = 0;
+
+static SceUID log_fd = -1;
+static SceUID log_sema = -1;
+static SceUID log_thid = -1;
+static volatile int log_running = 0;
+static int log_draining = 0;
+
+static char log_batch[LOG_BATCH_SIZE];
+static int log_batch_len = 0;
+
+static uintptr_t log_module_base = 0;
+static size_t log_module_size = 0;
+
+typedef struct {
+  uint32_t hash;
+  int min_prio;
+} log_filter;
+
+static log_filter log_filters[LOG_MAX_FILTERS];
+static int log_num_filters = 0;
+static int log_default_prio = 0;
+
+// tag offset into the module << 4 | minimum priority, packed into one word
+// so readers never see half an update
+static volatile uint32_t log_tag_cache[LOG_TAG_CACHE];
+
+static log_ring *log_get_ring(void) {
+  SceUID thid = sceKernelGetThreadId();
+  uint32_t h = (uint32_t)thid * 0x9e3779b1;
+
+  for (int i = 0; i < LOG_MAX_THREADS; i++) {
+    log_ring *r = &log_rings[(h + i) % LOG_MAX_THREADS];
+    if (r->thid == thid)
+      return r->ring ? r : NULL;
+    if (r->thid == 0 && __sync_bool_compare_and_swap(&r->thid, 0, thid)) {
+      if (!r->ring)
+        r->ring = malloc(LOG_RING_SIZE);
+      return r->ring ? r : NULL;
+    }
+  }
+
+  // take over the drained ring of a thread that has exited
+  for (int i = 0; i < LOG_MAX_THREADS; i++) {
+    log_ring *r = &log_rings[(h + i) % LOG_MAX_THREADS];
+    SceKernelThreadInfo info;
+    info.size = sizeof(info);
+    SceUID old = r->thid;
+    if (r->ring && r->head == r->tail && sceKernelGetThreadInfo(old, &info) < 0 &&
+        __sync_bool_compare_and_swap(&r->thid, old, thid))
+      return r;
+  }
+
+  return NULL;
+}
+
+static void log_ring_put(log_ring *r, uint32_t pos, const void *src, uint32_t len) {
+  uint32_t off = pos & (LOG_RING_SIZE - 1);
+  uint32_t first = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+  memcpy(r->ring + off, src, first);
+  memcpy(r->ring, (const uint8_t *)src + first, len - first);
+}
+
+static void log_ring_get(log_ring *r, uint32_t pos, void *dst, uint32_t len) {
+  uint32_t off = pos & (LOG_RING_SIZE - 1);
+  uint32_t first = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+  memcpy(dst, r->ring + off, first);
+  memcpy((uint8_t *)dst + first, r->ring, len - first);
+}
+
+static void log_batch_flush(void) {
+  if (log_batch_len == 0)
+    return;
+
+  if (log_fd < 0)
+    log_fd = sceIoOpen(LOG_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_APPEND, 0777);
+  if (log_fd >= 0)
+    sceIoWrite(log_fd, log_batch, log_batch_len);
+
+  log_batch_len = 0;
+}
+
+static void log_batch_add(log_ring *r, uint32_t pos, uint32_t len) {
+#ifdef BINARY_LOG
+  // records are framed by a u16 length in the file
+  if (log_batch_len + len + 2 > LOG_BATCH_SIZE)
+    log_batch_flush();
+  log_batch[log_batch_len++] = len & 0xff;
+  log_batch[log_batch_len++] = len >> 8;
+#else
+  if (log_batch_len + len > LOG_BATCH_SIZE)
+    log_batch_flush();
+#endif
+  log_ring_get(r, pos, log_batch + log_batch_len, len);
+  log_batch_len += len;
+}
+
+static void log_drain(void) {
+  while (__sync_lock_test_and_set(&log_draining, 1) != 0)
+    sceKernelDelayThread(1000);
+
+  // merge the rings by sequence number so lines keep their global order
+  for (;;) {
+    log_ring *best = NULL;
+    log_header best_hdr;
+
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+      log_ring *r = &log_rings[i];
+      if (!r->ring || r->head == r->tail)
+        continue;
+
+      __sync_synchronize();
+      log_header hdr;
+      log_ring_get(r, r->tail, &hdr, sizeof(hdr));
+      if (!best || (int32_t)(hdr.seq - best_hdr.seq) < 0) {
+        best = r;
+        best_hdr = hdr;
+      }
+    }
+
+    if (!best)
+      break;
+
+    log_batch_add(best, best->tail + sizeof(log_header), best_hdr.len);
+
+    __sync_synchronize();
+    best->tail += LOG_ALIGN(sizeof(log_header) + best_hdr.len);
+  }
+
+  uint32_t dropped = log_dropped;
+  if (dropped != log_reported) {
+    char line[64];
+    int len = 0;
+#ifdef BINARY_LOG
+    line[len++] = 0;
+    line[len++] = 0;
+    line[len++] = LOG_BIN_TEXT;
+#endif
+    len += snprintf(line + len, sizeof(line) - len, "[logger] %u messages dropped\n", dropped - log_reported);
+#ifdef BINARY_LOG
+    line[0] = (len - 2) & 0xff;
+#endif
+    if (log_batch_len + len > LOG_BATCH_SIZE)
+      log_batch_flush();
+    memcpy(log_batch + log_batch_len, line, len);
+    log_batch_len += len;
+    log_reported = dropped;
+  }
+
+  log_batch_flush();
+
+  __sync_lock_release(&log_draining);
+}
+
+void logger_write(const char *text, int len) {
+  log_ring *r = log_get_ring();
+  if (!r) {
+    __sync_fetch_and_add(&log_dropped, 1);
+    return;
+  }
+
+  uint32_t size = LOG_ALIGN(sizeof(log_header) + len);
+
+  for (int retries = 0; LOG_RING_SIZE - (r->head - r->tail) < size; retries++) {
+    if (size > LOG_RING_SIZE || retries == LOG_MAX_RETRIES) {
+      __sync_fetch_and_add(&log_dropped, 1);
+      return;
+    }
+
+    // with no writer yet the caller drains its own backlog
+    if (log_running) {
+      sceKernelSignalSema(log_sema, 1);
+      sceKernelDelayThread(1000);
+    } else {
+      log_drain();
+    }
+  }
+
+  log_header hdr;
+  hdr.seq = __sync_fetch_and_add(&log_seq, 1);
+  hdr.len = len;
+
+  log_ring_put(r, r->head, &hdr, sizeof(hdr));
+  log_ring_put(r, r->head + sizeof(hdr), text, len);
+
+  __sync_synchronize();
+  r->head += size;
+
+  if (log_running && r->head - r->tail > LOG_RING_SIZE / 2)
+    sceKernelSignalSema(log_sema, 1);
+}
+
+void logger_vprintf(const char *fmt, va_list list) {
+  char string[LOG_LINE_SIZE];
+  int pos = 0;
+
+#ifdef BINARY_LOG
+  string[pos++] = LOG_BIN_TEXT;
+#endif
+
+  int len = vsnprintf(string + pos, sizeof(string) - pos, fmt, list);
+  if (len < 0)
+    return;
+  if (len >= sizeof(string) - pos)
+    len = sizeof(string) - pos - 1;
+
+  logger_write(string, pos + len);
+}
+
+void logger_set_module(uintptr_t base, size_t size) {
+  log_module_base = base;
+  log_module_size = size;
+
+#ifdef BINARY_LOG
+  // tells the decoder where the format strings are mapped in this run
+  uint8_t session[9] = { LOG_BIN_SESSION };
+  memcpy(&session[1], &(uint32_t){ base }, 4);
+  memcpy(&session[5], &(uint32_t){ size }, 4);
+  logger_write((const char *)session, sizeof(session));
+#endif
+}
+
+static uint32_t log_tag_hash(const char *tag) {
+  uint32_t h = 2166136261u;
+  for (; *tag; tag++)
+    h = (h ^ (uint8_t)*tag) * 16777619u;
+  return h ? h : 1;
+}
+
+static int log_parse_prio(const char *s) {
+  static const char letters[] = "??VDIWEFS";
+  if (*s >= '0' && *s <= '9')
+    return atoi(s);
+  const char *p = strchr(letters + 2, *s);
+  return p ? p - letters : -1;
+}
+
+// one "tag:priority" per line, priorities are android's (V D I W E F S or
+// 2-8), "*" sets the default and S silences a tag
+int logger_load_filters(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    char *sep = strrchr(line, ':');
+    if (line[0] == '#' || !sep)
+      continue;
+    *sep = '\0';
+
+    int prio = log_parse_prio(sep + 1);
+    if (prio < 0)
+      continue;
+
+    if (strcmp(line, "*") == 0) {
+      log_default_prio = prio;
+      continue;
+    }
+
+    uint32_t h = log_tag_hash(line);
+    for (int i = 0; i < LOG_MAX_FILTERS / 2; i++) {
+      log_filter *filter = &log_filters[(h + i) & (LOG_MAX_FILTERS - 1)];
+      if (filter->hash == 0 || filter->hash == h) {
+        if (filter->hash == 0)
+          log_num_filters++;
+        filter->hash = h;
+        filter->min_prio = prio;
+        break;
+      }
+    }
+  }
+
+  fclose(f);
+  return log_num_filters;
+}
+
+int logger_enabled(int prio, const char *tag) {
+  if (log_num_filters == 0 || !tag)
+    return prio >= log_default_prio;
+
+  // tags are nearly always literals in the module, so the pointer decides
+  uintptr_t offset = (uintptr_t)tag - log_module_base;
+  int cacheable = (uintptr_t)tag >= log_module_base && offset < log_module_size && offset < (1 << 28);
+  uint32_t slot = (offset >> 2) & (LOG_TAG_CACHE - 1);
+  if (cacheable) {
+    uint32_t entry = log_tag_cache[slot];
+    if (entry && (entry >> 4) == offset)
+      return prio >= (entry & 0xf);
+  }
+
+  int min_prio = log_default_prio;
+  uint32_t h = log_tag_hash(tag);
+  for (int i = 0; i < LOG_MAX_FILTERS / 2; i++) {
+    log_filter *filter = &log_filters[(h + i) & (LOG_MAX_FILTERS - 1)];
+    if (filter->hash == 0)
+      break;
+    if (filter->hash == h) {
+      min_prio = filter->min_prio;
+      break;
+    }
+  }
+
+  if (cacheable && offset)
+    log_tag_cache[slot] = (offset << 4) | (min_prio & 0xf);
+
+  return prio >= min_prio;
+}
+
+static int log_put(uint8_t *buf, int pos, const void *src, int len) {
+  if (pos < 0 || pos + len > LOG_LINE_SIZE)
+    return -1;
+  memcpy(buf + pos, src, len);
+  return pos + len;
+}
+
+// strings from the module's text are stored by address, everything else
+// is copied since it may be gone by the time the log is read
+static int log_put_string(uint8_t *buf, int pos, const char *s) {
+  if (!s)
+    s = "(null)";
+
+  uintptr_t addr = (uintptr_t)s;
+  if (addr >= log_module_base && addr < log_module_base + log_module_size) {
+    pos = log_put(buf, pos, &(uint8_t){ LOG_BIN_STR_MODULE }, 1);
+    return log_put(buf, pos, &(uint32_t){ addr }, 4);
+  }
+
+  int len = strnlen(s, LOG_LINE_SIZE);
+  pos = log_put(buf, pos, &(uint8_t){ LOG_BIN_STR_INLINE }, 1);
+  pos = log_put(buf, pos, &(uint16_t){ len }, 2);
+  return log_put(buf, pos, s, len);
+}
+
+// stores the format and its raw arguments, only walking the conversions
+// to know what to pull from the va_list
+void logger_vlog_binary(int prio, const char *tag, const char *fmt, va_list list) {
+  uint8_t buf[LOG_LINE_SIZE];
+  int pos = 0;
+
+  buf[pos++] = LOG_BIN_ANDROID;
+  buf[pos++] = prio;
+  pos = log_put_string(buf, pos, tag);
+  pos = log_put_string(buf, pos, fmt);
+  if (pos < 0)
+    return;
+
+  // a record cut short is decoded up to the last whole argument
+  int last = pos;
+
+  for (const char *p = fmt; *p && pos >= 0; p++) {
+    if (*p != '%')
+      continue;
+    p++;
+    last = pos;
+
+    while (*p && strchr("-+ #0'", *p))
+      p++;
+    // width and precision
+    for (int i = 0; i < 2; i++) {
+      if (*p == '*') {
+        pos = log_put(buf, pos, &(int32_t){ va_arg(list, int) }, 4);
+        p++;
+      } else {
+        while (*p >= '0' && *p <= '9')
+          p++;
+      }
+      if (i == 1 || *p != '.')
+        break;
+      p++;
+    }
+
+    int wide = 0;
+    while (*p && strchr("hlLqjzt", *p)) {
+      if (*p == 'q' || *p == 'j' || *p == 'L' || (*p == 'l' && p[1] == 'l'))
+        wide = 1;
+      p += (*p == 'l' && p[1] == 'l') ? 2 : 1;
+    }
+
+    switch (*p) {
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        if (wide)
+          pos = log_put(buf, pos, &(int64_t){ va_arg(list, long long) }, 8);
+        else
+          pos = log_put(buf, pos, &(int32_t){ va_arg(list, int) }, 4);
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        pos = log_put(buf, pos, &(double){ va_arg(list, double) }, 8);
+        break;
+      case 's':
+        pos = log_put_string(buf, pos, va_arg(list, const char *));
+        break;
+      case 'p':
+        pos = log_put(buf, pos, &(uint32_t){ (uintptr_t)va_arg(list, void *) }, 4);
+        break;
+      case 'n':
+        va_arg(list, void *);
+        break;
+      case '\0':
+        p--;
+        break;
+      default:
+        break;
+    }
+  }
+
+  logger_write((const char *)buf, pos >= 0 ? pos : last);
+}
+
+void logger_flush(void) {
+  log_drain();
+}
+
+static int logger_thread(SceSize args, void *argp) {
+  while (log_running) {
+    SceUInt timeout = LOG_FLUSH_INTERVAL;
+    sceKernelWaitSema(log_sema, 1, &timeout);
+    log_drain();
+  }
+
+  return sceKernelExitDeleteThread(0);
+}
+
+int logger_start(void) {
+  log_sema = sceKernelCreateSema("logger_sema", 0, 0, 1, NULL);
+  if (log_sema < 0)
+    return log_sema;
+
+  log_running = 1;
+  log_thid = sceKernelCreateThread("logger", logger_thread, 0x10000100 + 10, 0x4000, 0, 0, NULL);
+  if (log_thid < 0) {
+    log_running = 0;
+    return log_thid;
+  }
+
+  sceKernelStartThread(log_thid, 0, NULL);
+  atexit(logger_flush);
+
+  return 0;
+}
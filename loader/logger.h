@@ -0,0 +1,43 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+#ifdef BINARY_LOG
+#define LOG_PATH "ux0:data/homm3_log.bin"
+#else
+#define LOG_PATH "ux0:data/homm3_log.txt"
+#endif
+
+// binary log records, see tools/logdecode.c
+#define LOG_BIN_TEXT 0     // preformatted text
+#define LOG_BIN_ANDROID 1  // prio, tag, format and raw arguments
+#define LOG_BIN_SESSION 2  // module base and size, starts every run
+
+#define LOG_BIN_STR_MODULE 0  // u32 address inside the module text
+#define LOG_BIN_STR_INLINE 1  // u16 length followed by the bytes
+
+#define LOG_FILTER_PATH DATA_PATH "/" "log_filter.txt"
+
+#define LOG_MAX_THREADS 64
+#define LOG_RING_SIZE (16 * 1024)   // per thread, power of two
+#define LOG_LINE_SIZE 1024          // longer messages are truncated
+#define LOG_BATCH_SIZE (64 * 1024)  // bytes per write to the log file
+#define LOG_FLUSH_INTERVAL 100000   // us the writer sleeps when nothing wakes it
+#define LOG_MAX_RETRIES 10          // waits for room before a message is dropped
+#define LOG_MAX_FILTERS 256         // tags in the filter table, power of two
+#define LOG_TAG_CACHE 256           // tag pointers remembered, power of two
+
+int logger_start(void);
+void logger_flush(void);
+void logger_write(const char *text, int len);
+void logger_vprintf(const char *fmt, va_list list);
+void logger_set_module(uintptr_t base, size_t size);
+void logger_vlog_binary(int prio, const char *tag, const char *fmt, va_list list);
+int logger_load_filters(const char *path);
+int logger_enabled(int prio, const char *tag);
+
+#endif
@@ -8,6 +8,8 @@
  */
 
 #include <psp2/kernel/clib.h>
+#include <psp2/ctrl.h>
+#include <psp2/kernel/threadmgr.h>
 #include <psp2/power.h>
 #include <psp2/io/fcntl.h>
 #include <psp2/io/stat.h> 
@@ -36,6 +38,18 @@
 #include "config.h"
 #include "dialog.h"
 #include "so_util.h"
+#include "imports.h"
+#include "profiler.h"
+#include "trace.h"
+#include "logger.h"
+#include "hud.h"
+#include "frame_stats.h"
+#include "replay.h"
+#include "detours.h"
+#include "mapping.h"
+#include "sync.h"
+#include "lock_stats.h"
+#include "threads.h"
 
 #define printf sceClibPrintf
 
@@ -59,43 +73,47 @@ void *__wrap_memset(void *s, int c, size_t n) {
 int debugPrintf(char *text, ...) {
 #ifdef DEBUG
   va_list list;
-  static char string[0x8000];
 
   va_start(list, text);
-  vsprintf(string, text, list);
+  logger_vprintf(text, list);
   va_end(list);
-
-  SceUID fd = sceIoOpen("ux0:data/homm3_log.txt", SCE_O_WRONLY | SCE_O_CREAT | SCE_O_APPEND, 0777);
-  if (fd >= 0) {
-    sceIoWrite(fd, string, strlen(string));
-    sceIoClose(fd);
-  }
 #endif
   return 0;
 }
 
-int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+int __android_log_vprint(int prio, const char *tag, const char *fmt, va_list list) {
 #ifdef DEBUG
-  va_list list;
-  static char string[0x8000];
+  if (!logger_enabled(prio, tag))
+    return 0;
+#endif
 
-  va_start(list, fmt);
-  vsprintf(string, fmt, list);
-  va_end(list);
+#if defined(DEBUG) && defined(BINARY_LOG)
+  logger_vlog_binary(prio, tag, fmt, list);
+#elif defined(DEBUG)
+  char string[LOG_LINE_SIZE];
+
+  int len = snprintf(string, sizeof(string) - 1, "[LOG] %s: ", tag);
+  if (len < 0 || len >= sizeof(string) - 1)
+    return 0;
+
+  int msg_len = vsnprintf(string + len, sizeof(string) - 1 - len, fmt, list);
+  if (msg_len < 0)
+    return 0;
+  len += msg_len < sizeof(string) - 1 - len ? msg_len : sizeof(string) - 2 - len;
+  string[len++] = '\n';
 
-  printf("[LOG] %s: %s\n", tag, string);
+  logger_write(string, len);
 #endif
   return 0;
 }
 
-int __android_log_vprint(int prio, const char *tag, const char *fmt, va_list list) {
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
 #ifdef DEBUG
-  static char string[0x8000];
+  va_list list;
 
-  vsprintf(string, fmt, list);
+  va_start(list, fmt);
+  __android_log_vprint(prio, tag, fmt, list);
   va_end(list);
-
-  printf("[LOGV] %s: %s\n", tag, string);
 #endif
   return 0;
 }
@@ -200,177 +218,89 @@ const short *_toupper_tab_ = _C_toupper_;
 
 void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
 {
-	(void)prot;
-	(void)flags;
-	if (addr != NULL) {
-		if ((addr = malloc(len))) {
-			lseek(fd, offset, SEEK_SET);
-			read(fd, addr, len);
-		}
-
-		if (!addr) {
-                	return NULL;
-        	}
-
-		return addr;
-	}
-	else {
-		void *data = malloc(len);
-		if (data != NULL) {
-                        lseek(fd, offset, SEEK_SET);
-                        read(fd, data, len);
-		}
-
-		if (!data) {
-			return NULL;
-		}
-
-		return data;
-	}
+	(void)addr;
+	return mapping_map(len, prot, flags, fd, offset, (uintptr_t)__builtin_return_address(0));
 }
 
 int munmap(void *map, size_t length)
 {
-	(void)length;
-	if (map!=NULL)
-		free(map);
+	if (map == NULL)
+		return 0;
 
-	return 0;
+	return mapping_unmap(map, length);
 }
 
 int pthread_mutex_init_fake(pthread_mutex_t **uid, const pthread_mutexattr_t *mutexattr) {
-	pthread_mutex_t *m = calloc(1, sizeof(pthread_mutex_t));
-	if (!m)
-		return -1;
-
-	const int recursive = (mutexattr && *(const int *)mutexattr == 1);
-	*m = recursive ? PTHREAD_RECURSIVE_MUTEX_INITIALIZER : PTHREAD_MUTEX_INITIALIZER;
-
-	int ret = pthread_mutex_init(m, mutexattr);
-	if (ret < 0) {
-		free(m);
-		return -1;
-	}
-
-	*uid = m;
+	int type = SYNC_MUTEX_NORMAL;
+	if (mutexattr && *(const int *)mutexattr == 1)
+		type = SYNC_MUTEX_RECURSIVE;
+	else if (mutexattr && *(const int *)mutexattr == 2)
+		type = SYNC_MUTEX_ERRORCHECK;
 
-	return 0;
+	return sync_mutex_init((uintptr_t *)uid, type);
 }
 
 int pthread_mutex_destroy_fake(pthread_mutex_t **uid) {
-	if (uid && *uid && (uintptr_t)*uid > 0x8000) {
-		pthread_mutex_destroy(*uid);
-		free(*uid);
-		*uid = NULL;
-	}
-	return 0;
+	return sync_mutex_destroy((uintptr_t *)uid);
 }
 
 int pthread_mutex_lock_fake(pthread_mutex_t **uid) {
-	int ret = 0;
-	if (!*uid) {
-		ret = pthread_mutex_init_fake(uid, NULL);
-	} else if ((uintptr_t)*uid == 0x4000) {
-		pthread_mutexattr_t attr;
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-		ret = pthread_mutex_init_fake(uid, &attr);
-		pthread_mutexattr_destroy(&attr);
-	} else if ((uintptr_t)*uid == 0x8000) {
-		pthread_mutexattr_t attr;
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
-		ret = pthread_mutex_init_fake(uid, &attr);
-		pthread_mutexattr_destroy(&attr);
-	}
-	if (ret < 0)
-		return ret;
-	return pthread_mutex_lock(*uid);
+	sync_mutex *m = sync_mutex_get((uintptr_t *)uid);
+	if (!m)
+		return SYNC_ENOMEM;
+#ifdef LOCK_STATS
+	return lock_stats_lock(uid, &m->work, (uintptr_t)__builtin_return_address(0)) < 0 ? SYNC_EDEADLK : 0;
+#else
+	return sceKernelLockLwMutex(&m->work, 1, NULL) < 0 ? SYNC_EDEADLK : 0;
+#endif
 }
 
 int pthread_mutex_unlock_fake(pthread_mutex_t **uid) {
-	int ret = 0;
-	if (!*uid) {
-		ret = pthread_mutex_init_fake(uid, NULL);
-	} else if ((uintptr_t)*uid == 0x4000) {
-		pthread_mutexattr_t attr;
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-		ret = pthread_mutex_init_fake(uid, &attr);
-		pthread_mutexattr_destroy(&attr);
-	} else if ((uintptr_t)*uid == 0x8000) {
-		pthread_mutexattr_t attr;
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
-		ret = pthread_mutex_init_fake(uid, &attr);
-		pthread_mutexattr_destroy(&attr);
-	}
-	if (ret < 0)
-		return ret;
-	return pthread_mutex_unlock(*uid);
+	sync_mutex *m = sync_mutex_get((uintptr_t *)uid);
+	if (!m)
+		return SYNC_ENOMEM;
+	return sceKernelUnlockLwMutex(&m->work, 1) < 0 ? SYNC_EPERM : 0;
 }
 
 int pthread_cond_init_fake(pthread_cond_t **cnd, const int *condattr) {
-	pthread_cond_t *c = calloc(1, sizeof(pthread_cond_t));
-	if (!c)
-		return -1;
-
-	*c = PTHREAD_COND_INITIALIZER;
-
-	int ret = pthread_cond_init(c, NULL);
-	if (ret < 0) {
-		free(c);
-		return -1;
-	}
-
-	*cnd = c;
-
-	return 0;
+	*cnd = NULL;
+	return sync_cond_create((uintptr_t *)cnd) ? 0 : SYNC_ENOMEM;
 }
 
 int pthread_cond_broadcast_fake(pthread_cond_t **cnd) {
-	if (!*cnd) {
-		if (pthread_cond_init_fake(cnd, NULL) < 0)
-			return -1;
-	}
-	return pthread_cond_broadcast(*cnd);
+	sync_cond *c = sync_cond_get((uintptr_t *)cnd);
+	return c ? sync_cond_signal(c, 1) : SYNC_ENOMEM;
 }
 
 int pthread_cond_signal_fake(pthread_cond_t **cnd) {
-	if (!*cnd) {
-		if (pthread_cond_init_fake(cnd, NULL) < 0)
-			return -1;
-	}
-	return pthread_cond_signal(*cnd);
+	sync_cond *c = sync_cond_get((uintptr_t *)cnd);
+	return c ? sync_cond_signal(c, 0) : SYNC_ENOMEM;
 }
 
 int pthread_cond_destroy_fake(pthread_cond_t **cnd) {
-	if (cnd && *cnd) {
-		pthread_cond_destroy(*cnd);
-		free(*cnd);
-		*cnd = NULL;
-	}
-	return 0;
+	return sync_cond_destroy((uintptr_t *)cnd);
 }
 
 int pthread_cond_wait_fake(pthread_cond_t **cnd, pthread_mutex_t **mtx) {
-	if (!*cnd) {
-		if (pthread_cond_init_fake(cnd, NULL) < 0)
-			return -1;
-	}
-	return pthread_cond_wait(*cnd, *mtx);
+	sync_cond *c = sync_cond_get((uintptr_t *)cnd);
+	sync_mutex *m = sync_mutex_get((uintptr_t *)mtx);
+	if (!c || !m)
+		return SYNC_ENOMEM;
+	return sync_cond_wait(c, m, NULL);
 }
 
 int pthread_cond_timedwait_fake(pthread_cond_t **cnd, pthread_mutex_t **mtx, const struct timespec *t) {
-	if (!*cnd) {
-		if (pthread_cond_init_fake(cnd, NULL) < 0)
-			return -1;
-	}
-	return pthread_cond_timedwait(*cnd, *mtx, t);
+	sync_cond *c = sync_cond_get((uintptr_t *)cnd);
+	sync_mutex *m = sync_mutex_get((uintptr_t *)mtx);
+	if (!c || !m)
+		return SYNC_ENOMEM;
+	return sync_cond_wait(c, m, t);
 }
 
-int pthread_create_fake(pthread_t *thread, const void *unused, void *entry, void *arg) {
-	return pthread_create(thread, NULL, entry, arg);
+int pthread_create_fake(pthread_t *thread, const void *attr, void *entry, void *arg) {
+	// bionic's pthread_attr_t keeps the stack size at offset 8
+	size_t stack_size = attr ? ((const uint32_t *)attr)[2] : 0;
+	return threads_create(thread, stack_size, entry, arg);
 }
 
 int pthread_once_fake(volatile int *once_control, void (*init_routine)(void)) {
@@ -420,6 +350,380 @@ int SDL_Init_fake(Uint32 flags)
   return SDL_Init(flags);
 }
 
+#if defined(TRACE) || defined(HUD) || defined(FRAME_STATS) || defined(LOCK_STATS)
+// imports that are timed or counted go through these
+#define WRAPPED(func) func##_wrap
+
+void SDL_RenderPresent_wrap(SDL_Renderer *renderer)
+{
+  SceCtrlData pad;
+
+  sceCtrlPeekBufferPositive(0, &pad, 1);
+
+#ifdef HUD
+  hud_input(pad.buttons);
+  hud_draw(renderer);
+#endif
+
+  {
+    TRACE_SCOPE("SDL_RenderPresent");
+    SDL_RenderPresent(renderer);
+  }
+
+#ifdef HUD
+  hud_frame();
+#endif
+
+#ifdef FRAME_STATS
+  frame_stats_frame(sceKernelGetProcessTimeWide());
+#endif
+
+#if defined(TRACE) || defined(LOCK_STATS)
+  // SELECT + L + R writes out the trace and the lock report
+  static uint32_t old_buttons = 0;
+  uint32_t combo = SCE_CTRL_SELECT | SCE_CTRL_LTRIGGER | SCE_CTRL_RTRIGGER;
+  if ((pad.buttons & combo) == combo && (old_buttons & combo) != combo) {
+#ifdef TRACE
+    trace_flush();
+#endif
+#ifdef LOCK_STATS
+    lock_stats_write();
+#endif
+  }
+  old_buttons = pad.buttons;
+#endif
+}
+
+int SDL_RenderCopy_wrap(SDL_Renderer *renderer, SDL_Texture *texture, const SDL_Rect *srcrect, const SDL_Rect *dstrect)
+{
+  HUD_COUNT(draws);
+  return SDL_RenderCopy(renderer, texture, srcrect, dstrect);
+}
+
+int SDL_RenderFillRect_wrap(SDL_Renderer *renderer, const SDL_Rect *rect)
+{
+  HUD_COUNT(draws);
+  return SDL_RenderFillRect(renderer, rect);
+}
+
+void glDrawArrays_wrap(GLenum mode, GLint first, GLsizei count)
+{
+  HUD_COUNT(draws);
+  glDrawArrays(mode, first, count);
+}
+
+SDL_Texture *SDL_CreateTexture_wrap(SDL_Renderer *renderer, Uint32 format, int access, int w, int h)
+{
+  HUD_COUNT(textures);
+  return SDL_CreateTexture(renderer, format, access, w, h);
+}
+
+SDL_Texture *SDL_CreateTextureFromSurface_wrap(SDL_Renderer *renderer, SDL_Surface *surface)
+{
+  HUD_COUNT(textures);
+  return SDL_CreateTextureFromSurface(renderer, surface);
+}
+
+int SDL_UpdateTexture_wrap(SDL_Texture *texture, const SDL_Rect *rect, const void *pixels, int pitch)
+{
+  TRACE_SCOPE("SDL_UpdateTexture");
+  HUD_COUNT(textures);
+  return SDL_UpdateTexture(texture, rect, pixels, pitch);
+}
+
+void glTexImage2D_wrap(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data)
+{
+  TRACE_SCOPE("glTexImage2D");
+  HUD_COUNT(textures);
+  glTexImage2D(target, level, internalformat, width, height, border, format, type, data);
+}
+
+void glCompressedTexImage2D_wrap(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data)
+{
+  TRACE_SCOPE("glCompressedTexImage2D");
+  HUD_COUNT(textures);
+  glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
+}
+FILE *fopen_wrap(const char *filename, const char *mode)
+{
+  TRACE_SCOPE_ARG("fopen", filename);
+  FRAME_STATS_IO();
+  return fopen(filename, mode);
+}
+
+int open_wrap(const char *pathname, int flags, int mode)
+{
+  TRACE_SCOPE_ARG("open", pathname);
+  FRAME_STATS_IO();
+  return open(pathname, flags, mode);
+}
+
+SDL_RWops *SDL_RWFromFile_wrap(const char *file, const char *mode)
+{
+  TRACE_SCOPE_ARG("SDL_RWFromFile", file);
+  FRAME_STATS_IO();
+  return SDL_RWFromFile(file, mode);
+}
+#else
+#define WRAPPED(func) func
+#endif
+
+#ifdef TRACE
+// imports that only show up on the trace timeline
+#define TRACED(func) func##_trace
+
+static void (* mix_func)(void *udata, Uint8 *stream, int len);
+
+static void mix_func_trace(void *udata, Uint8 *stream, int len)
+{
+  TRACE_SCOPE("audio callback");
+  mix_func(udata, stream, len);
+}
+
+void Mix_HookMusic_trace(void (* func)(void *udata, Uint8 *stream, int len), void *arg)
+{
+  mix_func = func;
+  Mix_HookMusic(func ? mix_func_trace : NULL, arg);
+}
+#else
+#define TRACED(func) func
+#endif
+
+#ifdef LOCK_STATS
+// SDL mutexes are timed like the pthread ones
+#define LOCKED(func) func##_stats
+
+int SDL_LockMutex_stats(SDL_mutex *mutex)
+{
+  uintptr_t caller = (uintptr_t)__builtin_return_address(0);
+  if (SDL_TryLockMutex(mutex) == 0) {
+    lock_stats_record(mutex, "SDL", caller, 0, 0);
+    return 0;
+  }
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  int ret = SDL_LockMutex(mutex);
+  if (ret == 0)
+    lock_stats_record(mutex, "SDL", caller, sceKernelGetProcessTimeWide() - start, 1);
+  return ret;
+}
+#else
+#define LOCKED(func) func
+#endif
+
+#ifdef THREAD_POLICY
+// SDL_mixer creates its audio thread itself, it places itself on the first mix
+#define PLACED(func) func##_placed
+
+static volatile int audio_placed;
+
+static void audio_place(void *udata, Uint8 *stream, int len)
+{
+  if (!audio_placed) {
+    audio_placed = 1;
+    threads_place_self("audio");
+  }
+}
+
+int Mix_OpenAudio_placed(int frequency, Uint16 format, int channels, int chunksize)
+{
+  int ret = Mix_OpenAudio(frequency, format, channels, chunksize);
+  if (ret == 0) {
+    audio_placed = 0;
+    Mix_SetPostMix(audio_place, NULL);
+  }
+  return ret;
+}
+#else
+#define PLACED(func) func
+#endif
+
+#ifdef INPUT_REPLAY
+// inputs, clocks and random numbers the game thread sees go through these
+#define REPLAYED(func) func##_replay
+
+static replay_stream replay;
+static SceUID replay_thid;
+static int replay_playing = 0;
+static Uint32 replay_last_flush = 0;
+
+static void replay_check_end(void)
+{
+  if (replay_playing && replay.mode != REPLAY_PLAY) {
+    replay_playing = 0;
+    debugPrintf("replay: %s after %u calls\n", replay.desync ? "desynced" : "finished", replay.calls);
+#ifdef FRAME_STATS
+    frame_stats_write();
+#endif
+  }
+}
+
+// other threads would interleave differently every run, only the game
+// thread is recorded
+static uint32_t replay_call(int kind, uint32_t live)
+{
+  if (replay.mode == REPLAY_OFF || sceKernelGetThreadId() != replay_thid)
+    return live;
+
+  uint32_t value = replay_value(&replay, kind, live);
+  replay_check_end();
+  return value;
+}
+
+Uint32 SDL_GetTicks_replay(void)
+{
+  Uint32 ticks = SDL_GetTicks();
+
+  // keep a recording usable if the game is killed
+  if (replay.mode == REPLAY_RECORD && ticks - replay_last_flush >= 1000 && sceKernelGetThreadId() == replay_thid) {
+    fflush(replay.f);
+    replay_last_flush = ticks;
+  }
+
+  return replay_call(REPLAY_TICKS, ticks);
+}
+
+time_t time_replay(time_t *t)
+{
+  time_t now = replay_call(REPLAY_TIME, time(NULL));
+  if (t)
+    *t = now;
+  return now;
+}
+
+long lrand48_replay(void)
+{
+  return (int32_t)replay_call(REPLAY_RAND, lrand48());
+}
+
+Uint32 SDL_GetMouseState_replay(int *x, int *y)
+{
+  int mx, my;
+  Uint32 buttons = SDL_GetMouseState(&mx, &my);
+
+  mx = replay_call(REPLAY_MOUSE_X, mx);
+  my = replay_call(REPLAY_MOUSE_Y, my);
+  buttons = replay_call(REPLAY_MOUSE_BUTTONS, buttons);
+
+  if (x)
+    *x = mx;
+  if (y)
+    *y = my;
+  return buttons;
+}
+
+SDL_Keymod SDL_GetModState_replay(void)
+{
+  return replay_call(REPLAY_MOD_STATE, SDL_GetModState());
+}
+
+// user events carry pointers from the session that pushed them, they are
+// left out of the recording and stay live on playback
+static void replay_record_events(SDL_Event *events, int count, int numevents, Uint32 minType, Uint32 maxType)
+{
+  if (!events) {
+    int kept = 0;
+    if (count > 0 && minType < SDL_USEREVENT)
+      kept = SDL_PeepEvents(NULL, numevents, SDL_PEEKEVENT, minType, maxType < SDL_USEREVENT ? maxType : SDL_USEREVENT - 1);
+    replay_events(&replay, NULL, kept > 0 ? kept : 0, 0);
+    return;
+  }
+
+  int kept = 0;
+  for (int i = 0; i < count; i++) {
+    if (events[i].type < SDL_USEREVENT)
+      kept++;
+  }
+
+  if (kept == count || kept == 0) {
+    replay_events(&replay, events, kept, numevents);
+    return;
+  }
+
+  SDL_Event *copy = malloc(kept * sizeof(SDL_Event));
+  if (!copy) {
+    replay_events(&replay, events, 0, numevents);
+    return;
+  }
+
+  kept = 0;
+  for (int i = 0; i < count; i++) {
+    if (events[i].type < SDL_USEREVENT)
+      copy[kept++] = events[i];
+  }
+  replay_events(&replay, copy, kept, numevents);
+  free(copy);
+}
+
+int SDL_PeepEvents_replay(SDL_Event *events, int numevents, SDL_eventaction action, Uint32 minType, Uint32 maxType)
+{
+  if (replay.mode == REPLAY_OFF || sceKernelGetThreadId() != replay_thid)
+    return SDL_PeepEvents(events, numevents, action, minType, maxType);
+
+  if (replay.mode == REPLAY_PLAY) {
+    // events the game pushes itself are already in the recording, except
+    // its user events
+    if (action == SDL_ADDEVENT) {
+      for (int i = 0; i < numevents; i++) {
+        if (events[i].type >= SDL_USEREVENT)
+          SDL_PeepEvents(&events[i], 1, SDL_ADDEVENT, 0, 0);
+      }
+      return numevents;
+    }
+
+    // live input is thrown away so it can't pile up behind the replay
+    if (action == SDL_GETEVENT) {
+      SDL_Event scratch[16];
+      while (SDL_PeepEvents(scratch, 16, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_USEREVENT - 1) > 0)
+        ;
+    }
+
+    int count = replay_events(&replay, events, 0, numevents);
+    replay_check_end();
+    if (replay.mode == REPLAY_PLAY) {
+      // live user events fill what the recorded ones leave
+      if (maxType >= SDL_USEREVENT && count < numevents) {
+        int user = SDL_PeepEvents(events ? events + count : NULL, numevents - count, action,
+                                  minType > SDL_USEREVENT ? minType : SDL_USEREVENT, maxType);
+        if (user > 0)
+          count += user;
+      }
+      return count;
+    }
+  }
+
+  int count = SDL_PeepEvents(events, numevents, action, minType, maxType);
+  if (replay.mode == REPLAY_RECORD && action != SDL_ADDEVENT)
+    replay_record_events(events, count, numevents, minType, maxType);
+  return count;
+}
+
+static void replay_stop(void)
+{
+  replay_close(&replay);
+}
+
+// plays REPLAY_PATH back if it exists, otherwise records a new one
+void replay_start(void)
+{
+  SceIoStat stat;
+  int mode = sceIoGetstat(REPLAY_PATH, &stat) >= 0 ? REPLAY_PLAY : REPLAY_RECORD;
+
+  if (replay_open(&replay, REPLAY_PATH, mode, sizeof(SDL_Event)) < 0) {
+    debugPrintf("replay: could not open %s\n", REPLAY_PATH);
+    return;
+  }
+
+  replay_thid = sceKernelGetThreadId();
+  replay_playing = mode == REPLAY_PLAY;
+  atexit(replay_stop);
+
+  debugPrintf("replay: %s %s\n", mode == REPLAY_PLAY ? "playing" : "recording", REPLAY_PATH);
+}
+#else
+#define REPLAYED(func) func
+#endif
+
 long sysconf_fake(int name)
 {
   switch(name)
@@ -443,6 +747,19 @@ int getLanguage_fake()
   return 0;
 }
 
+// mapping.c shares read-only mappings by file name
+int open_hook(const char *pathname, int flags, int mode) {
+  int fd = WRAPPED(open)(pathname, flags, mode);
+  if (fd >= 0)
+    mapping_set_path(fd, pathname);
+  return fd;
+}
+
+int close_hook(int fd) {
+  mapping_set_path(fd, NULL);
+  return close(fd);
+}
+
 int stat_hook(const char *pathname, void *statbuf) {
   struct stat st;
   int res = stat(pathname, &st);
@@ -459,6 +776,8 @@ void dotemu_hideCursor_fake(bool param_1)
 
 void patch_game(void)
 {
+  so_hook_begin();
+
   hook_addr(so_symbol(&homm3_mod, "_ZN18AndroidEventLogger12logLastEventEv"), (uintptr_t)&ret0);
   hook_addr(so_symbol(&homm3_mod, "_ZN20AndroidSystemManager11getLanguageEv"), (uintptr_t)&getLanguage_fake);
   hook_addr(so_symbol(&homm3_mod, "_ZN20AndroidSystemManager14isCrappyDeviceEv"), (uintptr_t)&ret1);
@@ -475,6 +794,8 @@ void patch_game(void)
   //hook_addr(so_symbol(&homm3_mod, "_Z17ShowBorderedMoviei"), (uintptr_t)&ret1);
   //hook_addr(so_symbol(&homm3_mod, "_Z9VideoPlayiiiiib"), (uintptr_t)&ret1);
   hook_addr(so_symbol(&homm3_mod, "_Z9VideoOpeniiiiiibbb"), (uintptr_t)&ret1);
+
+  so_hook_commit();
 }
 
 static so_default_dynlib default_dynlib[] = {
@@ -496,7 +817,7 @@ static so_default_dynlib default_dynlib[] = {
   { "atan2", (uintptr_t)&atan2 },
   { "atoi", (uintptr_t)&atoi },
   { "ceil", (uintptr_t)&ceil },
-  { "close", (uintptr_t)&close },
+  { "close", (uintptr_t)&close_hook },
   { "compress2", (uintptr_t)&compress2 },
   { "cosf", (uintptr_t)&cosf },
   { "crc32", (uintptr_t)&crc32 },
@@ -509,7 +830,7 @@ static so_default_dynlib default_dynlib[] = {
   { "fflush", (uintptr_t)&fflush },
   { "fgetpos", (uintptr_t)&fgetpos },
   { "fmod", (uintptr_t)&fmod },
-  { "fopen", (uintptr_t)&fopen },
+  { "fopen", (uintptr_t)&WRAPPED(fopen) },
   { "fprintf", (uintptr_t)&fprintf },
   { "fread", (uintptr_t)&fread },
   { "free", (uintptr_t)&free },
@@ -528,7 +849,7 @@ static so_default_dynlib default_dynlib[] = {
   { "glClear", (uintptr_t)&glClear },
   { "glClearDepthf", (uintptr_t)&glClearDepthf },
   { "glCompileShader", (uintptr_t)&glCompileShader },
-  { "glCompressedTexImage2D", (uintptr_t)&glCompressedTexImage2D },
+  { "glCompressedTexImage2D", (uintptr_t)&WRAPPED(glCompressedTexImage2D) },
   { "glCreateProgram", (uintptr_t)&glCreateProgram },
   { "glCreateShader", (uintptr_t)&glCreateShader },
   { "glDeleteRenderbuffers", (uintptr_t)&ret0 },
@@ -538,7 +859,7 @@ static so_default_dynlib default_dynlib[] = {
   { "glDepthRangef", (uintptr_t)&glDepthRangef },
   { "glDisable", (uintptr_t)&glDisable },
   { "glDisableVertexAttribArray", (uintptr_t)&glDisableVertexAttribArray },
-  { "glDrawArrays", (uintptr_t)&glDrawArrays },
+  { "glDrawArrays", (uintptr_t)&WRAPPED(glDrawArrays) },
   { "glEnable", (uintptr_t)&glEnable },
   { "glEnableVertexAttribArray", (uintptr_t)&glEnableVertexAttribArray },
   { "glFramebufferRenderbuffer", (uintptr_t)&ret0 },
@@ -560,7 +881,7 @@ static so_default_dynlib default_dynlib[] = {
   { "glRenderbufferStorage", (uintptr_t)&ret0 },
   { "glScissor", (uintptr_t)&glScissor },
   { "glShaderSource", (uintptr_t)&glShaderSource },
-  { "glTexImage2D", (uintptr_t)&glTexImage2D },
+  { "glTexImage2D", (uintptr_t)&WRAPPED(glTexImage2D) },
   { "glTexParameterf", (uintptr_t)&glTexParameterf },
   { "glTexParameteri", (uintptr_t)&glTexParameteri },
   { "glUniform1f", (uintptr_t)&glUniform1f },
@@ -593,7 +914,7 @@ static so_default_dynlib default_dynlib[] = {
   { "iswxdigit", (uintptr_t)&iswxdigit },
   { "isxdigit", (uintptr_t)&isxdigit },
   { "localtime", (uintptr_t)&localtime },
-  { "lrand48", (uintptr_t)&lrand48 },
+  { "lrand48", (uintptr_t)&REPLAYED(lrand48) },
   { "lseek", (uintptr_t)&lseek },
   { "malloc", (uintptr_t)&malloc },
   { "memcmp", (uintptr_t)&memcmp },
@@ -612,10 +933,10 @@ static so_default_dynlib default_dynlib[] = {
   { "Mix_GroupOldest", (uintptr_t)&Mix_GroupOldest },
   { "Mix_HaltChannel", (uintptr_t)&Mix_HaltChannel },
   { "Mix_HaltMusic", (uintptr_t)&Mix_HaltMusic },
-  { "Mix_HookMusic", (uintptr_t)&Mix_HookMusic },
+  { "Mix_HookMusic", (uintptr_t)&TRACED(Mix_HookMusic) },
   { "Mix_LoadMUS", (uintptr_t)&Mix_LoadMUS },
   { "Mix_LoadWAV_RW", (uintptr_t)&Mix_LoadWAV_RW },
-  { "Mix_OpenAudio", (uintptr_t)&Mix_OpenAudio },
+  { "Mix_OpenAudio", (uintptr_t)&PLACED(Mix_OpenAudio) },
   { "Mix_Pause", (uintptr_t)&Mix_Pause },
   { "Mix_PausedMusic", (uintptr_t)&Mix_PausedMusic },
   { "Mix_PauseMusic", (uintptr_t)&Mix_PauseMusic },
@@ -643,7 +964,7 @@ static so_default_dynlib default_dynlib[] = {
   { "ogg_sync_init", (uintptr_t)&ogg_sync_init },
   { "ogg_sync_pageout", (uintptr_t)&ogg_sync_pageout },
   { "ogg_sync_wrote", (uintptr_t)&ogg_sync_wrote },
-  { "open", (uintptr_t)&open },
+  { "open", (uintptr_t)&open_hook },
   { "perror", (uintptr_t)&perror },
   { "pthread_cond_broadcast", (uintptr_t)&pthread_cond_broadcast_fake },
   { "pthread_cond_wait", (uintptr_t)&pthread_cond_wait_fake },
@@ -676,9 +997,9 @@ static so_default_dynlib default_dynlib[] = {
   { "SDL_CreateMutex", (uintptr_t)&SDL_CreateMutex },
   { "SDL_CreateRenderer", (uintptr_t)&SDL_CreateRenderer },
   { "SDL_CreateRGBSurface", (uintptr_t)&SDL_CreateRGBSurface },
-  { "SDL_CreateTexture", (uintptr_t)&SDL_CreateTexture },
-  { "SDL_CreateTextureFromSurface", (uintptr_t)&SDL_CreateTextureFromSurface },
-  { "SDL_CreateThread", (uintptr_t)&SDL_CreateThread },
+  { "SDL_CreateTexture", (uintptr_t)&WRAPPED(SDL_CreateTexture) },
+  { "SDL_CreateTextureFromSurface", (uintptr_t)&WRAPPED(SDL_CreateTextureFromSurface) },
+  { "SDL_CreateThread", (uintptr_t)&threads_create_sdl },
   { "SDL_CreateWindow", (uintptr_t)&SDL_CreateWindow },
   { "SDL_Delay", (uintptr_t)&SDL_Delay },
   { "SDL_DestroyMutex", (uintptr_t)&SDL_DestroyMutex },
@@ -689,12 +1010,12 @@ static so_default_dynlib default_dynlib[] = {
   { "SDL_FreeSurface", (uintptr_t)&SDL_FreeSurface },
   { "SDL_GetCurrentDisplayMode", (uintptr_t)&SDL_GetCurrentDisplayMode },
   { "SDL_GetError", (uintptr_t)&SDL_GetError },
-  { "SDL_GetModState", (uintptr_t)&SDL_GetModState },
-  { "SDL_GetMouseState", (uintptr_t)&SDL_GetMouseState },
+  { "SDL_GetModState", (uintptr_t)&REPLAYED(SDL_GetModState) },
+  { "SDL_GetMouseState", (uintptr_t)&REPLAYED(SDL_GetMouseState) },
   { "SDL_GetRendererInfo", (uintptr_t)&SDL_GetRendererInfo },
   { "SDL_GetTextureBlendMode", (uintptr_t)&SDL_GetTextureBlendMode },
   { "SDL_GetTextureColorMod", (uintptr_t)&SDL_GetTextureColorMod },
-  { "SDL_GetTicks", (uintptr_t)&SDL_GetTicks },
+  { "SDL_GetTicks", (uintptr_t)&REPLAYED(SDL_GetTicks) },
   { "SDL_GL_BindTexture", (uintptr_t)&SDL_GL_BindTexture },
   { "SDL_GL_GetCurrentContext", (uintptr_t)&SDL_GL_GetCurrentContext },
   { "SDL_GL_MakeCurrent", (uintptr_t)&SDL_GL_MakeCurrent },
@@ -702,23 +1023,23 @@ static so_default_dynlib default_dynlib[] = {
   { "SDL_Init", (uintptr_t)&SDL_Init_fake },
   { "SDL_InitSubSystem", (uintptr_t)&SDL_InitSubSystem },
   { "SDL_IntersectRect", (uintptr_t)&SDL_IntersectRect },
-  { "SDL_LockMutex", (uintptr_t)&SDL_LockMutex },
+  { "SDL_LockMutex", (uintptr_t)&LOCKED(SDL_LockMutex) },
   { "SDL_LockSurface", (uintptr_t)&SDL_LockSurface },
   { "SDL_Log", (uintptr_t)&SDL_Log },
   { "SDL_LogError", (uintptr_t)&SDL_LogError },
   { "SDL_LogSetPriority", (uintptr_t)&SDL_LogSetPriority },
   { "SDL_MapRGB", (uintptr_t)&SDL_MapRGB },
   { "SDL_MinimizeWindow", (uintptr_t)&SDL_MinimizeWindow },
-  { "SDL_PeepEvents", (uintptr_t)&SDL_PeepEvents },
+  { "SDL_PeepEvents", (uintptr_t)&REPLAYED(SDL_PeepEvents) },
   { "SDL_PumpEvents", (uintptr_t)&SDL_PumpEvents },
   { "SDL_QueryTexture", (uintptr_t)&SDL_QueryTexture },
   { "SDL_Quit", (uintptr_t)&SDL_Quit },
   { "SDL_RemoveTimer", (uintptr_t)&SDL_RemoveTimer },
   { "SDL_RenderClear", (uintptr_t)&SDL_RenderClear },
-  { "SDL_RenderCopy", (uintptr_t)&SDL_RenderCopy },
-  { "SDL_RenderFillRect", (uintptr_t)&SDL_RenderFillRect },
-  { "SDL_RenderPresent", (uintptr_t)&SDL_RenderPresent },
-  { "SDL_RWFromFile", (uintptr_t)&SDL_RWFromFile },
+  { "SDL_RenderCopy", (uintptr_t)&WRAPPED(SDL_RenderCopy) },
+  { "SDL_RenderFillRect", (uintptr_t)&WRAPPED(SDL_RenderFillRect) },
+  { "SDL_RenderPresent", (uintptr_t)&WRAPPED(SDL_RenderPresent) },
+  { "SDL_RWFromFile", (uintptr_t)&WRAPPED(SDL_RWFromFile) },
   { "SDL_RWFromMem", (uintptr_t)&SDL_RWFromMem },
   { "SDL_SetColorKey", (uintptr_t)&SDL_SetColorKey },
   { "SDL_SetEventFilter", (uintptr_t)&SDL_SetEventFilter },
@@ -736,7 +1057,7 @@ static so_default_dynlib default_dynlib[] = {
   { "SDL_strdup_REAL", (uintptr_t)&SDL_strdup },
   { "SDL_UnlockMutex", (uintptr_t)&SDL_UnlockMutex },
   { "SDL_UnlockSurface", (uintptr_t)&SDL_UnlockSurface },
-  { "SDL_UpdateTexture", (uintptr_t)&SDL_UpdateTexture },
+  { "SDL_UpdateTexture", (uintptr_t)&WRAPPED(SDL_UpdateTexture) },
   { "SDL_UpperBlit", (uintptr_t)&SDL_UpperBlit },
   { "SDL_WaitThread", (uintptr_t)&SDL_WaitThread },
   { "setlocale", (uintptr_t)&setlocale },
@@ -774,7 +1095,7 @@ static so_default_dynlib default_dynlib[] = {
   { "th_info_clear", (uintptr_t)&th_info_clear },
   { "th_info_init", (uintptr_t)&th_info_init },
   { "th_setup_free", (uintptr_t)&th_setup_free },
-  { "time", (uintptr_t)&time },
+  { "time", (uintptr_t)&REPLAYED(time) },
   { "tolower", (uintptr_t)&tolower },
   { "toupper", (uintptr_t)&toupper },
   { "towlower", (uintptr_t)&towlower },
@@ -807,6 +1128,12 @@ static so_default_dynlib default_dynlib[] = {
   { "write", (uintptr_t)&write },
 };
 
+#ifdef LAZY_BIND
+static void lazy_bind_report(void) {
+  so_lazy_report(&homm3_mod, DATA_PATH "/lazy_bind.txt");
+}
+#endif
+
 int check_kubridge(void) {
   int search_unk[2];
   return _vshKernelSearchModuleByName("kubridge", search_unk);
@@ -821,21 +1148,85 @@ int main(int argc, char *argv[]) {
   scePowerSetGpuClockFrequency(222);
   scePowerSetGpuXbarClockFrequency(166);
 
+#ifdef DEBUG
+  logger_load_filters(LOG_FILTER_PATH);
+  logger_start();
+#endif
+
   if (check_kubridge() < 0)
     fatal_error("Error kubridge.skprx is not installed.");
 
+#ifdef TRACE
+  atexit(trace_flush);
+#endif
+
+#ifdef LAZY_BIND
+  TRACE_PHASE("so_load");
   if (so_load(&homm3_mod, SO_PATH, LOAD_ADDRESS) < 0)
     fatal_error("Error could not load %s.", SO_PATH);
 
+  TRACE_PHASE("so_relocate");
   so_relocate(&homm3_mod);
-  so_resolve(&homm3_mod, default_dynlib, sizeof(default_dynlib), 0);
+  TRACE_PHASE("so_resolve");
+  so_resolve_lazy(&homm3_mod, default_dynlib, sizeof(default_dynlib), 0);
+
+  atexit(lazy_bind_report);
+#else
+  TRACE_PHASE("so_cache_load");
+  if (so_cache_load(&homm3_mod, SO_CACHE_PATH, SO_PATH, LOAD_ADDRESS, default_dynlib, sizeof(default_dynlib)) < 0) {
+    TRACE_PHASE("so_load");
+    if (so_load(&homm3_mod, SO_PATH, LOAD_ADDRESS) < 0)
+      fatal_error("Error could not load %s.", SO_PATH);
+
+    TRACE_PHASE("so_relocate");
+    so_relocate(&homm3_mod);
+    TRACE_PHASE("so_resolve");
+    so_resolve(&homm3_mod, default_dynlib, sizeof(default_dynlib), 0);
+
+    // must be saved before any hooks or constructors touch the image
+    TRACE_PHASE("so_cache_save");
+    so_cache_save(&homm3_mod, SO_CACHE_PATH, SO_PATH, LOAD_ADDRESS, default_dynlib, sizeof(default_dynlib));
+  }
+#endif
+
+#ifdef DEBUG
+  logger_set_module(homm3_mod.text_base, homm3_mod.text_size);
+#endif
+  mapping_set_module(&homm3_mod);
+#ifdef LOCK_STATS
+  lock_stats_set_module(&homm3_mod);
+#endif
 
+#if defined(PROFILER) || defined(IMPORT_STATS)
+  if (imports_instrument(&homm3_mod) < 0)
+    fatal_error("Error could not instrument imports.");
+#endif
+
+  TRACE_PHASE("patch_game");
   patch_game();
 
+  TRACE_PHASE("so_flush_caches");
   so_flush_caches(&homm3_mod);
+#ifdef DETOURS
+  TRACE_PHASE("detours_start");
+  detours_start(&homm3_mod);
+#endif
+#ifdef THREAD_POLICY
+  // before the constructors, they may already create threads
+  threads_start(&homm3_mod);
+  threads_place_self("main");
+#endif
+  TRACE_PHASE("so_initialize");
   so_initialize(&homm3_mod);
+  TRACE_PHASE(NULL);
 
   int (* SDL_main)(void) = (void *)so_symbol(&homm3_mod, "SDL_main");
+#ifdef PROFILER
+  profiler_start(&homm3_mod, sceKernelGetThreadId());
+#endif
+#ifdef INPUT_REPLAY
+  replay_start();
+#endif
   SDL_main();
 
   return 0;
@@ -0,0 +1,486 @@
+/* mapping.c -- file mappings for the mmap and munmap imports
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "so_util.h"
+#include "imports.h"
+#include "mapping.h"
+
+// there is no page fault hook to fill pages as they are touched, so a
+// mapping is read in full when it is created. large ones get their own
+// memblock instead of pinning the newlib heap, and read-only mappings of a
+// range that is already mapped share that copy
+typedef struct mapping {
+  struct mapping *next;
+  char *path; // NULL for anonymous mappings and files opened elsewhere
+  off_t offset;
+  size_t len;
+  uintptr_t base;
+  SceUID blockid; // < 0 when the copy lives on the heap
+  int refs;
+  int shared;
+  uint32_t bytes_read;
+  SceUInt64 read_time;
+} mapping;
+
+// what the game was handed, one per mmap. munmap may trim or split a view;
+// the copy behind it is freed with its last view
+typedef struct {
+  uintptr_t addr;
+  size_t len;
+  mapping *copy;
+  uintptr_t caller;
+} mapping_view;
+
+static mapping *mappings = NULL;
+static SceUID mapping_lock = -1;
+
+// sorted by addr
+static mapping_view *mapping_views = NULL;
+static int num_mapping_views = 0, max_mapping_views = 0;
+
+static so_module *mapping_mod = NULL;
+#ifdef MAPPING_STATS
+static SceUInt64 mapping_dump_time = 0;
+static int mapping_dumping = 0;
+#endif
+
+// paths by fd from the open import, shared copies are matched by name
+static char *mapping_paths[MAPPING_MAX_FDS];
+
+static void mapping_lock_init(void) {
+  if (mapping_lock >= 0)
+    return;
+
+  SceUID sema = sceKernelCreateSema("mapping_lock", 0, 1, 1, NULL);
+  if (!__sync_bool_compare_and_swap(&mapping_lock, -1, sema))
+    sceKernelDeleteSema(sema);
+}
+
+void mapping_set_path(int fd, const char *path) {
+  if (fd < 0 || fd >= MAPPING_MAX_FDS)
+    return;
+
+  char *copy = path ? strdup(path) : NULL;
+
+  mapping_lock_init();
+  sceKernelWaitSema(mapping_lock, 1, NULL);
+  char *old = mapping_paths[fd];
+  mapping_paths[fd] = copy;
+  sceKernelSignalSema(mapping_lock, 1);
+
+  free(old);
+}
+
+static mapping *mapping_find_shared(const char *path, off_t offset, size_t len) {
+  for (mapping *m = mappings; m; m = m->next) {
+    if (m->shared && strcmp(m->path, path) == 0 && offset >= m->offset && offset + len <= m->offset + m->len)
+      return m;
+  }
+  return NULL;
+}
+
+static int mapping_alloc(mapping *m) {
+  size_t size = ALIGN_MEM(m->len, 0x1000);
+
+  m->blockid = -1;
+  if (size >= MAPPING_BLOCK_MIN) {
+    m->blockid = sceKernelAllocMemBlock("mmap", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, size, NULL);
+    if (m->blockid >= 0) {
+      sceKernelGetMemBlockBase(m->blockid, (void **)&m->base);
+      return 0;
+    }
+  }
+
+  m->base = (uintptr_t)malloc(m->len);
+  return m->base ? 0 : -1;
+}
+
+static void mapping_free(mapping *m) {
+  if (m->blockid >= 0)
+    sceKernelFreeMemBlock(m->blockid);
+  else
+    free((void *)m->base);
+  free(m->path);
+  free(m);
+}
+
+// reads in chunks and leaves the file position where the caller had it
+static void mapping_fill(mapping *m, int fd) {
+  uint8_t *dst = (uint8_t *)m->base;
+  size_t done = 0;
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  off_t pos = lseek(fd, 0, SEEK_CUR);
+  if (lseek(fd, m->offset, SEEK_SET) >= 0) {
+    while (done < m->len) {
+      size_t chunk = m->len - done < MAPPING_CHUNK ? m->len - done : MAPPING_CHUNK;
+      int n = read(fd, dst + done, chunk);
+      if (n <= 0)
+        break;
+      done += n;
+    }
+  }
+  lseek(fd, pos, SEEK_SET);
+  m->read_time = sceKernelGetProcessTimeWide() - start;
+  m->bytes_read = done;
+
+  // like a real mapping, whatever lies past the end of the file reads as 0
+  if (done < m->len)
+    memset(dst + done, 0, m->len - done);
+}
+
+void mapping_set_module(so_module *mod) {
+  mapping_mod = mod;
+}
+
+// behind the import thunks the return address is their exit path, the
+// game's call site is then on the shadow stack
+static uintptr_t mapping_caller(uintptr_t caller) {
+  so_module *mod = mapping_mod;
+  if (!mod || (caller >= mod->text_base && caller < mod->text_base + mod->text_size))
+    return caller;
+
+#if defined(PROFILER) || defined(IMPORT_STATS)
+  import_thread *t = imports_find_thread(sceKernelGetThreadId());
+  if (t && t->depth > 0)
+    return t->frames[t->depth - 1].lr;
+#endif
+
+  return caller;
+}
+
+static int mapping_view_index(uintptr_t addr) {
+  int lo = 0, hi = num_mapping_views;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (mapping_views[mid].addr < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int mapping_add_view(uintptr_t addr, size_t len, mapping *copy, uintptr_t caller) {
+  if (num_mapping_views == max_mapping_views) {
+    int max_views = max_mapping_views ? max_mapping_views * 2 : 64;
+    mapping_view *views = realloc(mapping_views, max_views * sizeof(mapping_view));
+    if (!views)
+      return -1;
+    mapping_views = views;
+    max_mapping_views = max_views;
+  }
+
+  int i = mapping_view_index(addr);
+  memmove(&mapping_views[i + 1], &mapping_views[i], (num_mapping_views - i) * sizeof(mapping_view));
+  mapping_views[i].addr = addr;
+  mapping_views[i].len = len;
+  mapping_views[i].copy = copy;
+  mapping_views[i].caller = caller;
+  num_mapping_views++;
+  return 0;
+}
+
+// shared copies can put several views over the same bytes: an exact start
+// wins, otherwise the smallest view holding addr
+static int mapping_find_view(uintptr_t addr) {
+  int i = mapping_view_index(addr);
+  if (i < num_mapping_views && mapping_views[i].addr == addr)
+    return i;
+
+  int best = -1;
+  for (i = i - 1; i >= 0; i--) {
+    mapping_view *v = &mapping_views[i];
+    if (addr < v->addr + v->len && (best < 0 || v->len < mapping_views[best].len))
+      best = i;
+  }
+  return best;
+}
+
+#ifdef MAPPING_STATS
+typedef struct {
+  const char *path;
+  int views;
+  int copies;
+  uint64_t live;
+  uint64_t heap;
+  uint64_t block;
+} mapping_file_stats;
+
+void mapping_dump(void) {
+  static mapping_file_stats files[MAPPING_DUMP_FILES];
+  char line[256];
+  int num_files = 0, len;
+
+  if (__sync_lock_test_and_set(&mapping_dumping, 1) != 0)
+    return;
+
+  SceUID fd = sceIoOpen(MAPPING_STATS_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd < 0)
+    goto out;
+
+  memset(files, 0, sizeof(files));
+  mapping_file_stats total = { "total" };
+
+  mapping_lock_init();
+  sceKernelWaitSema(mapping_lock, 1, NULL);
+
+  for (mapping *m = mappings; m; m = m->next) {
+    const char *path = m->path ? m->path : "anonymous";
+    int i;
+    for (i = 0; i < num_files; i++) {
+      if (strcmp(files[i].path, path) == 0)
+        break;
+    }
+    if (i == num_files) {
+      // the last row collects whatever doesn't fit
+      if (num_files == MAPPING_DUMP_FILES) {
+        i = MAPPING_DUMP_FILES - 1;
+        files[i].path = "other";
+      } else {
+        files[num_files++].path = path;
+      }
+    }
+
+    files[i].copies++;
+    if (m->blockid >= 0)
+      files[i].block += ALIGN_MEM(m->len, 0x1000);
+    else
+      files[i].heap += m->len;
+
+    for (int j = 0; j < num_mapping_views; j++) {
+      if (mapping_views[j].copy == m) {
+        files[i].views++;
+        files[i].live += mapping_views[j].len;
+      }
+    }
+  }
+
+  len = snprintf(line, sizeof(line), "%-48s %6s %6s %10s %10s %10s\n", "file", "views", "copies", "live KiB", "heap KiB", "block KiB");
+  sceIoWrite(fd, line, len);
+
+  for (int i = 0; i <= num_files; i++) {
+    mapping_file_stats *f = i < num_files ? &files[i] : &total;
+    if (i < num_files) {
+      total.views += f->views;
+      total.copies += f->copies;
+      total.live += f->live;
+      total.heap += f->heap;
+      total.block += f->block;
+    }
+    len = snprintf(line, sizeof(line), "%-48s %6d %6d %10llu %10llu %10llu\n", f->path, f->views, f->copies,
+                   f->live / 1024, f->heap / 1024, f->block / 1024);
+    if (len >= sizeof(line))
+      len = sizeof(line) - 1;
+    sceIoWrite(fd, line, len);
+  }
+
+  len = snprintf(line, sizeof(line), "\n%-10s %10s %10s %-40s %s\n", "address", "length", "offset", "file", "caller");
+  sceIoWrite(fd, line, len);
+
+  for (int i = 0; i < num_mapping_views; i++) {
+    mapping_view *v = &mapping_views[i];
+    uintptr_t sym_addr = 0;
+    const char *sym = mapping_mod && v->caller ? so_addr_to_symbol(mapping_mod, v->caller, &sym_addr) : NULL;
+    uint64_t offset = v->copy->offset + (v->addr - v->copy->base);
+    len = snprintf(line, sizeof(line), "0x%08x 0x%08x 0x%08llx %-40s %s+0x%x\n", v->addr, v->len, offset,
+                   v->copy->path ? v->copy->path : "anonymous", sym ? sym : "?", sym ? v->caller - sym_addr : v->caller);
+    if (len >= sizeof(line))
+      len = sizeof(line) - 1;
+    sceIoWrite(fd, line, len);
+  }
+
+  sceKernelSignalSema(mapping_lock, 1);
+  sceIoClose(fd);
+
+out:
+  __sync_lock_release(&mapping_dumping);
+}
+
+// rewritten whenever mappings change, at most once per interval
+static void mapping_changed(void) {
+  SceUInt64 now = sceKernelGetProcessTimeWide();
+  if (mapping_dump_time == 0)
+    atexit(mapping_dump);
+  if (mapping_dump_time == 0 || now - mapping_dump_time >= MAPPING_DUMP_INTERVAL) {
+    mapping_dump_time = now;
+    mapping_dump();
+  }
+}
+#else
+#define mapping_changed()
+#endif
+
+void *mapping_map(size_t len, int prot, int flags, int fd, off_t offset, uintptr_t caller) {
+  int anonymous = (flags & MAPPING_MAP_ANONYMOUS) || fd < 0;
+  char *path = NULL;
+
+  if (len == 0)
+    return NULL;
+
+  caller = mapping_caller(caller);
+  mapping_lock_init();
+
+  sceKernelWaitSema(mapping_lock, 1, NULL);
+  if (!anonymous && fd < MAPPING_MAX_FDS && mapping_paths[fd]) {
+    if (!(prot & MAPPING_PROT_WRITE)) {
+      mapping *m = mapping_find_shared(mapping_paths[fd], offset, len);
+      if (m) {
+        uintptr_t addr = m->base + (offset - m->offset);
+        int ret = mapping_add_view(addr, len, m, caller);
+        if (ret == 0)
+          m->refs++;
+        sceKernelSignalSema(mapping_lock, 1);
+        if (ret < 0)
+          return NULL;
+        debugPrintf("mmap %s +0x%llx (0x%x): shared, %d refs\n", m->path, (uint64_t)offset, len, m->refs);
+        mapping_changed();
+        return (void *)addr;
+      }
+    }
+    path = strdup(mapping_paths[fd]);
+  }
+  sceKernelSignalSema(mapping_lock, 1);
+
+  mapping *m = calloc(1, sizeof(mapping));
+  if (!m) {
+    free(path);
+    return NULL;
+  }
+
+  m->path = path;
+  m->offset = offset;
+  m->len = len;
+  m->refs = 1;
+  m->shared = path && !(prot & MAPPING_PROT_WRITE);
+
+  if (mapping_alloc(m) < 0) {
+    free(m->path);
+    free(m);
+    return NULL;
+  }
+
+  if (anonymous)
+    memset((void *)m->base, 0, len);
+  else
+    mapping_fill(m, fd);
+
+  debugPrintf("mmap %s +0x%llx (0x%x): %s, read 0x%x bytes in %llu us\n", path ? path : "anonymous",
+              (uint64_t)offset, len, m->blockid >= 0 ? "memblock" : "heap", m->bytes_read, m->read_time);
+
+  sceKernelWaitSema(mapping_lock, 1, NULL);
+  int ret = mapping_add_view(m->base, len, m, caller);
+  if (ret == 0) {
+    m->next = mappings;
+    mappings = m;
+  }
+  sceKernelSignalSema(mapping_lock, 1);
+
+  if (ret < 0) {
+    mapping_free(m);
+    return NULL;
+  }
+
+  mapping_changed();
+  return (void *)m->base;
+}
+
+// unmaps [addr, addr + len) from the views it covers, trimming or splitting
+// the ones it only partly covers. a len of 0 drops the whole view at addr
+int mapping_unmap(void *addr, size_t len) {
+  uintptr_t start = (uintptr_t)addr;
+  uintptr_t end = start + len;
+  mapping *freed = NULL;
+  int found = 0, ret = 0;
+
+  mapping_lock_init();
+
+  sceKernelWaitSema(mapping_lock, 1, NULL);
+  while (1) {
+    int i = mapping_find_view(start);
+    if (i < 0 && found) {
+      // skip a gap to the next view inside the range
+      i = mapping_view_index(start);
+      if (i < num_mapping_views && mapping_views[i].addr < end)
+        start = mapping_views[i].addr;
+      else
+        i = -1;
+    }
+    if (i < 0)
+      break;
+
+    mapping_view *v = &mapping_views[i];
+    uintptr_t v_end = v->addr + v->len;
+    uintptr_t cut_end = (len == 0 || end > v_end) ? v_end : end;
+    found = 1;
+
+    if (start == v->addr && cut_end == v_end) {
+      mapping *m = v->copy;
+      memmove(v, v + 1, (num_mapping_views - i - 1) * sizeof(mapping_view));
+      num_mapping_views--;
+      if (--m->refs == 0) {
+        for (mapping **prev = &mappings; *prev; prev = &(*prev)->next) {
+          if (*prev == m) {
+            *prev = m->next;
+            break;
+          }
+        }
+        // off the list now, next chains the copies to free after the lock
+        m->next = freed;
+        freed = m;
+      }
+    } else if (start == v->addr) {
+      // the view moves up, keep the array sorted
+      mapping_view tail = *v;
+      tail.addr = cut_end;
+      tail.len = v_end - cut_end;
+      memmove(v, v + 1, (num_mapping_views - i - 1) * sizeof(mapping_view));
+      num_mapping_views--;
+      mapping_add_view(tail.addr, tail.len, tail.copy, tail.caller);
+    } else if (cut_end == v_end) {
+      v->len = start - v->addr;
+    } else {
+      // a hole in the middle leaves two views on the same copy
+      if (mapping_add_view(cut_end, v_end - cut_end, v->copy, v->caller) < 0) {
+        ret = -1;
+        break;
+      }
+      v = &mapping_views[i];
+      v->copy->refs++;
+      v->len = start - v->addr;
+    }
+
+    if (len == 0 || cut_end >= end)
+      break;
+    start = cut_end;
+  }
+  sceKernelSignalSema(mapping_lock, 1);
+
+  while (freed) {
+    mapping *next = freed->next;
+    mapping_free(freed);
+    freed = next;
+  }
+
+  if (!found) {
+    debugPrintf("munmap %p: not mapped\n", addr);
+    return -1;
+  }
+
+  mapping_changed();
+  return ret;
+}
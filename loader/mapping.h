@@ -0,0 +1,27 @@
+#ifndef __MAPPING_H__
+#define __MAPPING_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "config.h"
+#include "so_util.h"
+
+// bionic values, the game passes these through mmap
+#define MAPPING_PROT_WRITE 0x2
+#define MAPPING_MAP_ANONYMOUS 0x20
+
+#define MAPPING_MAX_FDS 256
+#define MAPPING_BLOCK_MIN 0x10000 // smaller mappings stay on the heap
+#define MAPPING_CHUNK 0x40000     // bytes per read when filling a mapping
+
+#define MAPPING_STATS_PATH DATA_PATH "/" "mappings.txt"
+#define MAPPING_DUMP_INTERVAL 5000000 // us, at most one rewrite of the report per interval
+#define MAPPING_DUMP_FILES 64
+
+void mapping_set_module(so_module *mod);
+void mapping_set_path(int fd, const char *path);
+void *mapping_map(size_t len, int prot, int flags, int fd, off_t offset, uintptr_t caller);
+int mapping_unmap(void *addr, size_t len);
+void mapping_dump(void);
+
+#endif
@@ -0,0 +1,185 @@
+/* profiler.c -- sampling profiler for the game thread
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "imports.h"
+#include "profiler.h"
+
+// the kernel won't hand out another thread's registers, so samples are taken
+// from the shadow stacks kept by the import thunks: a thread that isn't inside
+// an import is attributed to the game function it last returned to
+typedef struct {
+  const char *func;
+  import_record *rec;
+  int wait;
+  uint32_t count;
+} profiler_bucket;
+
+static profiler_bucket profiler_buckets[PROFILER_MAX_BUCKETS];
+static int num_profiler_buckets = 0;
+static uint32_t profiler_dropped = 0;
+
+static so_module *profiler_mod;
+static SceUID profiler_target;
+static SceUID profiler_thid = -1;
+static volatile int profiler_running = 0;
+static int profiler_dumping = 0;
+
+static uint32_t profiler_interval = PROFILER_INTERVAL;
+static uint32_t profiler_samples[3]; // game, import, waiting
+
+static void profiler_add(const char *func, import_record *rec, int wait) {
+  uint32_t h = ((uintptr_t)func ^ ((uintptr_t)rec * 31) ^ wait) * 0x9e3779b1;
+
+  for (int i = 0; i < PROFILER_MAX_BUCKETS; i++) {
+    profiler_bucket *b = &profiler_buckets[(h + i) % PROFILER_MAX_BUCKETS];
+    if (b->count == 0) {
+      if (num_profiler_buckets == PROFILER_MAX_BUCKETS / 2)
+        break;
+      b->func = func;
+      b->rec = rec;
+      b->wait = wait;
+      num_profiler_buckets++;
+    }
+    if (b->func == func && b->rec == rec && b->wait == wait) {
+      b->count++;
+      return;
+    }
+  }
+
+  profiler_dropped++;
+}
+
+static void profiler_sample(void) {
+  SceKernelThreadInfo info;
+  info.size = sizeof(info);
+  if (sceKernelGetThreadInfo(profiler_target, &info) < 0)
+    return;
+
+  int wait = (info.status & SCE_THREAD_WAITING) != 0;
+
+  import_thread *t = imports_find_thread(profiler_target);
+  import_record *rec = NULL;
+  uintptr_t lr = 0;
+
+  if (t) {
+    int depth = t->depth;
+    if (depth > 0 && depth <= IMPORT_STACK_DEPTH) {
+      rec = t->frames[depth - 1].rec;
+      lr = t->frames[depth - 1].lr;
+    } else {
+      lr = t->last_lr;
+    }
+  }
+
+  const char *func = lr ? so_addr_to_symbol(profiler_mod, lr, NULL) : NULL;
+  profiler_add(func, rec, wait);
+
+  profiler_samples[wait ? 2 : (rec ? 1 : 0)]++;
+}
+
+void profiler_dump(void) {
+  if (__sync_lock_test_and_set(&profiler_dumping, 1) != 0)
+    return;
+
+  SceUID fd = sceIoOpen(PROFILER_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd >= 0) {
+    char line[512];
+    for (int i = 0; i < PROFILER_MAX_BUCKETS; i++) {
+      profiler_bucket *b = &profiler_buckets[i];
+      if (b->count == 0)
+        continue;
+
+      int len = snprintf(line, sizeof(line), "homm3;%s%s%s%s %u\n",
+                         b->func ? b->func : "[unknown]",
+                         b->rec ? ";" : "", b->rec ? b->rec->name : "",
+                         b->wait ? ";[wait]" : "", b->count);
+      if (len >= sizeof(line))
+        len = sizeof(line) - 1;
+      sceIoWrite(fd, line, len);
+    }
+    sceIoClose(fd);
+  }
+
+  __sync_lock_release(&profiler_dumping);
+}
+
+static int profiler_thread(SceSize args, void *argp) {
+  SceUInt64 window_start = sceKernelGetProcessTimeWide();
+  SceUInt64 window_busy = 0;
+  uint32_t window_samples = 0;
+
+  while (profiler_running) {
+    sceKernelDelayThread(profiler_interval);
+
+    SceUInt64 start = sceKernelGetProcessTimeWide();
+    profiler_sample();
+    SceUInt64 now = sceKernelGetProcessTimeWide();
+    window_busy += now - start;
+    window_samples++;
+
+    SceUInt64 elapsed = now - window_start;
+
+    // back off while the sampler costs more than its budget, and creep back
+    // to the requested rate once it's well under
+    if (window_busy * 100 > elapsed * PROFILER_MAX_OVERHEAD) {
+      if (profiler_interval < PROFILER_MAX_INTERVAL)
+        profiler_interval *= 2;
+    } else if (window_busy * 200 < elapsed * PROFILER_MAX_OVERHEAD) {
+      if (profiler_interval > PROFILER_INTERVAL)
+        profiler_interval /= 2;
+    }
+
+    if (elapsed >= PROFILER_DUMP_INTERVAL) {
+      profiler_dump();
+      window_busy += sceKernelGetProcessTimeWide() - now;
+
+      debugPrintf("profiler: %u samples, game %u, imports %u, waiting %u, dropped %u\n",
+                  window_samples, profiler_samples[0], profiler_samples[1], profiler_samples[2], profiler_dropped);
+      debugPrintf("profiler: interval %u us, overhead %llu us in %llu us\n",
+                  profiler_interval, window_busy, sceKernelGetProcessTimeWide() - window_start);
+
+      window_start = sceKernelGetProcessTimeWide();
+      window_busy = 0;
+      window_samples = 0;
+    }
+  }
+
+  return sceKernelExitDeleteThread(0);
+}
+
+static void profiler_stop(void) {
+  profiler_running = 0;
+  profiler_dump();
+}
+
+int profiler_start(so_module *mod, SceUID thid) {
+  profiler_mod = mod;
+  profiler_target = thid;
+
+  // build the symbol index up front rather than inside the first sample
+  so_addr_to_symbol(mod, mod->text_base, NULL);
+
+  profiler_running = 1;
+  profiler_thid = sceKernelCreateThread("profiler", profiler_thread, 0x10000100 - 10, 0x4000, 0, 0, NULL);
+  if (profiler_thid < 0) {
+    profiler_running = 0;
+    return profiler_thid;
+  }
+
+  sceKernelStartThread(profiler_thid, 0, NULL);
+  atexit(profiler_stop);
+
+  return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "so_util.h"
+
+#define PROFILER_PATH DATA_PATH "/" "profile.folded"
+
+#define PROFILER_INTERVAL 1000           // us between samples
+#define PROFILER_MAX_INTERVAL 50000      // us, upper bound when backing off
+#define PROFILER_MAX_OVERHEAD 1          // percent of a core the sampler may use
+#define PROFILER_DUMP_INTERVAL 10000000  // us between writes of the folded stacks
+#define PROFILER_MAX_BUCKETS 4096
+
+int profiler_start(so_module *mod, SceUID thid);
+void profiler_dump(void);
+
+#endif
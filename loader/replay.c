@@ -0,0 +1,159 @@
+/* replay.c -- input record and replay streams
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t event_size;
+} replay_header;
+
+static void replay_put_varint(FILE *f, uint32_t v) {
+  while (v >= 0x80) {
+    fputc((v & 0x7f) | 0x80, f);
+    v >>= 7;
+  }
+  fputc(v, f);
+}
+
+static int replay_get_varint(FILE *f, uint32_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    int c = fgetc(f);
+    if (c == EOF)
+      return -1;
+    *v |= (uint32_t)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return 0;
+  }
+  return -1;
+}
+
+int replay_open(replay_stream *s, const char *path, int mode, uint32_t event_size) {
+  replay_header hdr;
+
+  memset(s, 0, sizeof(replay_stream));
+  s->event_size = event_size;
+
+  if (mode == REPLAY_RECORD) {
+    s->f = fopen(path, "wb");
+    if (!s->f)
+      return -1;
+    hdr.magic = REPLAY_MAGIC;
+    hdr.version = REPLAY_VERSION;
+    hdr.event_size = event_size;
+    fwrite(&hdr, sizeof(hdr), 1, s->f);
+  } else if (mode == REPLAY_PLAY) {
+    s->f = fopen(path, "rb");
+    if (!s->f)
+      return -1;
+    if (fread(&hdr, sizeof(hdr), 1, s->f) != 1 || hdr.magic != REPLAY_MAGIC ||
+        hdr.version != REPLAY_VERSION || hdr.event_size != event_size) {
+      fclose(s->f);
+      s->f = NULL;
+      return -1;
+    }
+  } else {
+    return -1;
+  }
+
+  s->mode = mode;
+  return 0;
+}
+
+void replay_close(replay_stream *s) {
+  if (s->f)
+    fclose(s->f);
+  s->f = NULL;
+  s->mode = REPLAY_OFF;
+}
+
+// the end of the recording or a call it doesn't match drops back to live input
+static void replay_stop(replay_stream *s, int desync) {
+  s->desync = desync;
+  replay_close(s);
+}
+
+static int replay_expect(replay_stream *s, int kind) {
+  int c = fgetc(s->f);
+  if (c == kind)
+    return 0;
+
+  replay_stop(s, c != EOF);
+  return -1;
+}
+
+// returns live while recording or off, the recorded value while playing
+uint32_t replay_value(replay_stream *s, int kind, uint32_t live) {
+  if (s->mode == REPLAY_RECORD) {
+    uint32_t delta = live - s->last[kind];
+    fputc(kind, s->f);
+    replay_put_varint(s->f, (delta << 1) ^ -(delta >> 31));
+    s->last[kind] = live;
+    s->calls++;
+    return live;
+  }
+
+  if (s->mode == REPLAY_PLAY) {
+    uint32_t zigzag;
+    if (replay_expect(s, kind) < 0)
+      return live;
+    if (replay_get_varint(s->f, &zigzag) < 0) {
+      replay_stop(s, 0);
+      return live;
+    }
+    s->last[kind] += (zigzag >> 1) ^ -(zigzag & 1);
+    s->calls++;
+    return s->last[kind];
+  }
+
+  return live;
+}
+
+// events holds count live events while recording, while playing it is
+// filled with up to max recorded ones; returns how many it holds. a NULL
+// events only records the count, like SDL_PeepEvents does
+int replay_events(replay_stream *s, void *events, int count, int max) {
+  if (s->mode == REPLAY_RECORD) {
+    fputc(REPLAY_EVENTS, s->f);
+    replay_put_varint(s->f, count > 0 ? count : 0);
+    if (events && count > 0)
+      fwrite(events, s->event_size, count, s->f);
+    s->calls++;
+    return count;
+  }
+
+  if (s->mode == REPLAY_PLAY) {
+    uint32_t recorded;
+    if (replay_expect(s, REPLAY_EVENTS) < 0)
+      return 0;
+    if (replay_get_varint(s->f, &recorded) < 0) {
+      replay_stop(s, 0);
+      return 0;
+    }
+    s->calls++;
+
+    if (!events)
+      return recorded;
+
+    int n = recorded < max ? recorded : max;
+    if (n > 0 && fread(events, s->event_size, n, s->f) != n) {
+      replay_stop(s, 0);
+      return 0;
+    }
+    if (recorded > n)
+      fseek(s->f, (recorded - n) * s->event_size, SEEK_CUR);
+
+    return n;
+  }
+
+  return count;
+}
@@ -0,0 +1,50 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "config.h"
+
+// plain stdio and no platform calls, so the format and the engine also
+// build on a host
+
+#define REPLAY_PATH DATA_PATH "/" "replay.bin"
+
+#define REPLAY_MAGIC 0x50523348 // "H3RP"
+#define REPLAY_VERSION 1
+
+enum {
+  REPLAY_OFF,
+  REPLAY_RECORD,
+  REPLAY_PLAY,
+};
+
+// one per intercepted call, values are zigzag varints relative to the
+// previous value of the same kind
+enum {
+  REPLAY_TICKS,
+  REPLAY_TIME,
+  REPLAY_RAND,
+  REPLAY_MOUSE_X,
+  REPLAY_MOUSE_Y,
+  REPLAY_MOUSE_BUTTONS,
+  REPLAY_MOD_STATE,
+  REPLAY_EVENTS, // count, then count raw events
+  REPLAY_NUM_KINDS,
+};
+
+typedef struct {
+  FILE *f;
+  int mode;
+  uint32_t event_size;
+  uint32_t last[REPLAY_NUM_KINDS];
+  uint32_t calls;
+  int desync;
+} replay_stream;
+
+int replay_open(replay_stream *s, const char *path, int mode, uint32_t event_size);
+void replay_close(replay_stream *s);
+uint32_t replay_value(replay_stream *s, int kind, uint32_t live);
+int replay_events(replay_stream *s, void *events, int count, int max);
+
+#endif
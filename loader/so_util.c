@@ -6,43 +6,209 @@
  * of the MIT license.  See the LICENSE file for details.
  */
 
+#ifndef SO_HOST
 #include <psp2/io/dirent.h>
 #include <psp2/io/fcntl.h>
+#include <psp2/io/stat.h>
 #include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
 #include <kubridge.h>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef SO_HOST
 #include "main.h"
 #include "dialog.h"
+#endif
 #include "so_util.h"
 
 static so_module *head = NULL, *tail = NULL;
 
-void hook_thumb(uintptr_t addr, uintptr_t dst) {
-  if (addr == 0)
+#define SO_PAGE_SHIFT 12
+
+// track written text pages so so_flush_caches only cleans what changed
+static void so_mark_dirty(so_module *mod, uintptr_t addr, size_t size) {
+  if (!mod->text_dirty || size == 0 || addr >= mod->text_base + mod->text_block_size || addr + size <= mod->text_base)
     return;
-  addr &= ~1;
-  if (addr & 2) {
-    uint16_t nop = 0xbf00;
-    kuKernelCpuUnrestrictedMemcpy((void *)addr, &nop, sizeof(nop));
-    addr += 2;
+
+  uintptr_t start = addr < mod->text_base ? 0 : addr - mod->text_base;
+  uintptr_t end = addr + size - mod->text_base;
+  if (end > mod->text_block_size)
+    end = mod->text_block_size;
+
+  for (uint32_t page = start >> SO_PAGE_SHIFT; page <= (end - 1) >> SO_PAGE_SHIFT; page++)
+    __sync_fetch_and_or(&mod->text_dirty[page / 32], 1 << (page % 32));
+}
+
+static void so_mark_dirty_addr(uintptr_t addr, size_t size) {
+  for (so_module *curr = head; curr; curr = curr->next) {
+    if (addr >= curr->text_base && addr < curr->text_base + curr->text_block_size) {
+      so_mark_dirty(curr, addr, size);
+      break;
+    }
+  }
+}
+
+static int so_init_dirty(so_module *mod) {
+  int num_pages = (mod->text_block_size + (1 << SO_PAGE_SHIFT) - 1) >> SO_PAGE_SHIFT;
+  mod->text_dirty = calloc((num_pages + 31) / 32, sizeof(uint32_t));
+  if (!mod->text_dirty)
+    return -1;
+  // a freshly loaded image hasn't been cleaned yet
+  so_mark_dirty(mod, mod->text_base, mod->text_block_size);
+  return 0;
+}
+
+#define SO_HOOK_MERGE_GAP 32
+
+typedef struct {
+  uintptr_t addr;
+  uint32_t size;
+  uint8_t data[12];
+  uint32_t seq;
+} so_hook_patch;
+
+static so_hook_patch *hook_patches = NULL;
+static int num_hook_patches = 0, max_hook_patches = 0, hook_transaction = 0;
+
+// queue the patch while a transaction is open, otherwise write it right away
+static void so_hook_write(uintptr_t addr, const void *data, uint32_t size) {
+  if (hook_transaction) {
+    if (num_hook_patches == max_hook_patches) {
+      int max_patches = max_hook_patches ? max_hook_patches * 2 : 64;
+      so_hook_patch *patches = realloc(hook_patches, max_patches * sizeof(so_hook_patch));
+      if (patches) {
+        hook_patches = patches;
+        max_hook_patches = max_patches;
+      }
+    }
+
+    if (num_hook_patches < max_hook_patches) {
+      so_hook_patch *patch = &hook_patches[num_hook_patches++];
+      patch->addr = addr;
+      patch->size = size;
+      patch->seq = num_hook_patches - 1;
+      memcpy(patch->data, data, size);
+      return;
+    }
+  }
+
+  kuKernelCpuUnrestrictedMemcpy((void *)addr, data, size);
+  so_mark_dirty_addr(addr, size);
+}
+
+void so_hook_begin(void) {
+  num_hook_patches = 0;
+  hook_transaction = 1;
+}
+
+static int so_compare_patch(const void *a, const void *b) {
+  const so_hook_patch *x = a, *y = b;
+  if (x->addr != y->addr)
+    return x->addr < y->addr ? -1 : 1;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int so_compare_patch_seq(const void *a, const void *b) {
+  const so_hook_patch *x = a, *y = b;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+void so_hook_commit(void) {
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  int num_spans = 0;
+
+  hook_transaction = 0;
+
+  // sorted by address so nearby patches can be merged into a single write
+  qsort(hook_patches, num_hook_patches, sizeof(so_hook_patch), so_compare_patch);
+
+  for (int i = 0; i < num_hook_patches;) {
+    uintptr_t span_start = hook_patches[i].addr;
+    uintptr_t span_end = span_start + hook_patches[i].size;
+    int end = i + 1;
+    while (end < num_hook_patches && hook_patches[end].addr <= span_end + SO_HOOK_MERGE_GAP) {
+      if (hook_patches[end].addr + hook_patches[end].size > span_end)
+        span_end = hook_patches[end].addr + hook_patches[end].size;
+      end++;
+    }
+
+    // the span is found in address order, applied in queue order so later
+    // patches win on overlap
+    if (end - i > 1)
+      qsort(&hook_patches[i], end - i, sizeof(so_hook_patch), so_compare_patch_seq);
+
+    SceUInt64 span_time = sceKernelGetProcessTimeWide();
+    uint8_t span[256];
+    if (end - i == 1) {
+      kuKernelCpuUnrestrictedMemcpy((void *)span_start, hook_patches[i].data, hook_patches[i].size);
+    } else if (span_end - span_start > sizeof(span)) {
+      for (int j = i; j < end; j++)
+        kuKernelCpuUnrestrictedMemcpy((void *)hook_patches[j].addr, hook_patches[j].data, hook_patches[j].size);
+    } else {
+      // the gaps keep their current contents
+      memcpy(span, (void *)span_start, span_end - span_start);
+      for (int j = i; j < end; j++)
+        memcpy(&span[hook_patches[j].addr - span_start], hook_patches[j].data, hook_patches[j].size);
+      kuKernelCpuUnrestrictedMemcpy((void *)span_start, span, span_end - span_start);
+    }
+
+    // only the touched cache lines need maintenance
+    kuKernelFlushCaches((void *)span_start, span_end - span_start);
+    debugPrintf("  hook %08x-%08x: %d patches written in %llu us\n", span_start, span_end, end - i,
+                sceKernelGetProcessTimeWide() - span_time);
+
+    num_spans++;
+    i = end;
+  }
+
+  debugPrintf("%d hooks committed in %d writes, %llu us\n", num_hook_patches, num_spans,
+              sceKernelGetProcessTimeWide() - start);
+
+  num_hook_patches = 0;
+}
+
+// builds the jump hook_thumb/hook_arm write at addr, returns its size
+static uint32_t so_hook_build(uintptr_t addr, uintptr_t dst, int thumb, uint8_t *out) {
+  if (thumb) {
+    uint16_t hook[5];
+    int n = 0;
+    if (addr & 2)
+      hook[n++] = 0xbf00; // NOP
+    hook[n++] = 0xf8df; // LDR PC, [PC]
+    hook[n++] = 0xf000;
+    hook[n++] = dst & 0xffff;
+    hook[n++] = dst >> 16;
+    memcpy(out, hook, n * sizeof(uint16_t));
+    return n * sizeof(uint16_t);
   }
+
   uint32_t hook[2];
-  hook[0] = 0xf000f8df; // LDR PC, [PC]
+  hook[0] = 0xe51ff004; // LDR PC, [PC, #-0x4]
   hook[1] = dst;
-  kuKernelCpuUnrestrictedMemcpy((void *)addr, hook, sizeof(hook));
+  memcpy(out, hook, sizeof(hook));
+  return sizeof(hook);
+}
+
+void hook_thumb(uintptr_t addr, uintptr_t dst) {
+  if (addr == 0)
+    return;
+  addr &= ~1;
+  uint8_t hook[12];
+  uint32_t size = so_hook_build(addr, dst, 1, hook);
+  so_hook_write(addr, hook, size);
 }
 
 void hook_arm(uintptr_t addr, uintptr_t dst) {
   if (addr == 0)
     return;
-  uint32_t hook[2];
-  hook[0] = 0xe51ff004; // LDR PC, [PC, #-0x4]
-  hook[1] = dst;
-  kuKernelCpuUnrestrictedMemcpy((void *)addr, hook, sizeof(hook));
+  uint8_t hook[12];
+  uint32_t size = so_hook_build(addr, dst, 0, hook);
+  so_hook_write(addr, hook, size);
 }
 
 void hook_addr(uintptr_t addr, uintptr_t dst) {
@@ -54,16 +220,498 @@ void hook_addr(uintptr_t addr, uintptr_t dst) {
     hook_arm(addr, dst);
 }
 
+#define SO_MAX_DETOURS 128
+#define SO_DETOUR_SIZE 96 // bytes of trampoline per detour
+#define SO_DETOUR_MAX_LITERALS 4
+
+typedef struct {
+  uint32_t code[SO_DETOUR_SIZE / sizeof(uint32_t)];
+  uint32_t size;
+  uint32_t literal_at[SO_DETOUR_MAX_LITERALS];
+  uint32_t literals[SO_DETOUR_MAX_LITERALS];
+  int num_literals;
+} so_trampoline;
+
+static SceUID detour_blockid = -1;
+static uintptr_t detour_code;
+static int num_detours = 0;
+
+static int so_tramp_emit(so_trampoline *t, uint32_t value, uint32_t size) {
+  if (t->size + size > SO_DETOUR_SIZE)
+    return -1;
+  memcpy((uint8_t *)t->code + t->size, &value, size);
+  t->size += size;
+  return 0;
+}
+
+// loads value into a register from the literal pool after the code
+static int so_tramp_load(so_trampoline *t, int reg, uint32_t value, int thumb) {
+  if (t->num_literals == SO_DETOUR_MAX_LITERALS)
+    return -1;
+  t->literal_at[t->num_literals] = t->size;
+  t->literals[t->num_literals++] = value;
+  if (thumb)
+    return so_tramp_emit(t, 0xf8df | (reg << 28), 4); // LDR.W reg, [PC, #0]
+  return so_tramp_emit(t, 0xe59f0000 | (reg << 12), 4); // LDR reg, [PC, #0]
+}
+
+static int so_tramp_finish(so_trampoline *t, int thumb) {
+  while (t->size & 3) {
+    if (so_tramp_emit(t, 0xbf00, 2) < 0) // NOP
+      return -1;
+  }
+
+  for (int i = 0; i < t->num_literals; i++) {
+    uint32_t at = t->literal_at[i];
+    uint32_t offset = t->size - (thumb ? ((at + 4) & ~3) : at + 8);
+    uint16_t *ins = (uint16_t *)((uint8_t *)t->code + at);
+    if (thumb)
+      ins[1] |= offset;
+    else
+      t->code[at / sizeof(uint32_t)] |= offset;
+    if (so_tramp_emit(t, t->literals[i], 4) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+// copies whole instructions covering size bytes at addr, rewriting the PC
+// relative loads and calls; branches and IT blocks are refused. returns the
+// number of bytes copied
+static int so_relocate_thumb(so_trampoline *t, uintptr_t addr, uint32_t size) {
+  uint32_t off = 0;
+
+  while (off < size) {
+    uintptr_t pc = addr + off;
+    uintptr_t base = (pc + 4) & ~3;
+    uint16_t hw1 = *(uint16_t *)pc;
+    int ret;
+
+    if ((hw1 >> 11) < 0x1d) {
+      off += 2;
+      if ((hw1 & 0xf800) == 0x4800) // LDR Rt, [PC, #imm]
+        ret = so_tramp_load(t, (hw1 >> 8) & 7, *(uint32_t *)(base + (hw1 & 0xff) * 4), 1);
+      else if ((hw1 & 0xf800) == 0xa000) // ADR Rd, label
+        ret = so_tramp_load(t, (hw1 >> 8) & 7, base + (hw1 & 0xff) * 4, 1);
+      else if ((hw1 & 0xf000) == 0xd000 || (hw1 & 0xf800) == 0xe000 || (hw1 & 0xf500) == 0xb100 ||
+               ((hw1 & 0xff00) == 0xbf00 && (hw1 & 0xf)) || (hw1 & 0xfc78) == 0x4478 || (hw1 & 0xfd87) == 0x4487)
+        return -1; // B, CBZ, IT, and ADD/MOV/BX reading or writing PC
+      else
+        ret = so_tramp_emit(t, hw1, 2);
+    } else {
+      uint16_t hw2 = *(uint16_t *)(pc + 2);
+      off += 4;
+      if ((hw1 & 0xf800) == 0xf000 && (hw2 & 0xc000) == 0xc000) { // BL, BLX
+        uint32_t s = (hw1 >> 10) & 1;
+        uint32_t i1 = !(((hw2 >> 13) & 1) ^ s), i2 = !(((hw2 >> 11) & 1) ^ s);
+        int32_t imm = (s << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3ff) << 12) | ((hw2 & 0x7ff) << 1);
+        imm = (imm << 7) >> 7;
+        uintptr_t target = (hw2 & 0x1000) ? (pc + 4 + imm) | 1 : base + imm;
+        ret = so_tramp_load(t, 12, target, 1);
+        if (ret == 0)
+          ret = so_tramp_emit(t, 0x47e0, 2); // BLX IP
+      } else if ((hw1 & 0xff7f) == 0xf85f && (hw2 >> 12) != 15) { // LDR.W Rt, [PC, #imm]
+        uint32_t imm = hw2 & 0xfff;
+        uintptr_t literal = (hw1 & 0x80) ? base + imm : base - imm;
+        ret = so_tramp_load(t, hw2 >> 12, *(uint32_t *)literal, 1);
+      } else if ((hw1 & 0xfb5f) == 0xf20f && !(hw2 & 0x8000)) { // ADR.W Rd, label
+        uint32_t imm = ((hw1 >> 10) & 1) << 11 | ((hw2 >> 12) & 7) << 8 | (hw2 & 0xff);
+        ret = so_tramp_load(t, (hw2 >> 8) & 0xf, (hw1 & 0xa0) ? base - imm : base + imm, 1);
+      } else if (((hw1 & 0xf800) == 0xf000 && (hw2 & 0x8000)) || ((hw1 & 0xfe0f) == 0xf80f) ||
+                 (hw1 & 0xfe5f) == 0xe85f || (hw1 & 0xff3f) == 0xed1f ||
+                 ((hw1 & 0xfff0) == 0xe8d0 && (hw2 & 0xffe0) == 0xf000)) {
+        return -1; // other branches, PC relative loads, TBB/TBH
+      } else {
+        ret = so_tramp_emit(t, hw1 | (hw2 << 16), 4);
+      }
+    }
+
+    if (ret < 0)
+      return -1;
+  }
+
+  return off;
+}
+
+static int so_relocate_arm(so_trampoline *t, uintptr_t addr, uint32_t size) {
+  uint32_t off;
+
+  for (off = 0; off < size; off += 4) {
+    uintptr_t pc = addr + off;
+    uint32_t ins = *(uint32_t *)pc;
+    uint32_t rd = (ins >> 12) & 0xf;
+    int ret;
+
+    if ((ins & 0xff7f0000) == 0xe51f0000 && rd != 15) { // LDR Rt, [PC, #imm]
+      uint32_t imm = ins & 0xfff;
+      uintptr_t literal = (ins & 0x00800000) ? pc + 8 + imm : pc + 8 - imm;
+      ret = so_tramp_load(t, rd, *(uint32_t *)literal, 0);
+    } else if (((ins & 0xffff0000) == 0xe28f0000 || (ins & 0xffff0000) == 0xe24f0000) && rd != 15) { // ADR
+      uint32_t rot = ((ins >> 8) & 0xf) * 2, imm = ins & 0xff;
+      if (rot)
+        imm = (imm >> rot) | (imm << (32 - rot));
+      ret = so_tramp_load(t, rd, (ins & 0x00800000) ? pc + 8 + imm : pc + 8 - imm, 0);
+    } else if ((ins & 0xff000000) == 0xeb000000 || (ins & 0xfe000000) == 0xfa000000) { // BL, BLX
+      uintptr_t target = pc + 8 + (((int32_t)(ins << 8)) >> 6);
+      if ((ins & 0xfe000000) == 0xfa000000)
+        target |= ((ins >> 23) & 2) | 1;
+      ret = so_tramp_emit(t, 0xe28fe004, 4); // ADD LR, PC, #4
+      if (ret == 0)
+        ret = so_tramp_emit(t, 0xe51ff004, 4); // LDR PC, [PC, #-0x4]
+      if (ret == 0)
+        ret = so_tramp_emit(t, target, 4);
+    } else if ((ins & 0x0ffffff0) == 0x012fff10) { // BX Rm
+      ret = so_tramp_emit(t, ins, 4);
+    } else if ((ins & 0x0e000000) == 0x0a000000 || ((ins >> 16) & 0xf) == 15 ||
+               (((ins & 0x0e000000) == 0 || (ins & 0x0e000010) == 0x06000000) && (ins & 0xf) == 15)) {
+      return -1; // branches and anything else reading PC as Rn or Rm
+    } else {
+      ret = so_tramp_emit(t, ins, 4);
+    }
+
+    if (ret < 0)
+      return -1;
+  }
+
+  return off;
+}
+
+// prepares a hook from addr to dst without writing it; the original stays
+// callable through detour->trampoline
+int so_detour_create(so_detour *detour, uintptr_t addr, uintptr_t dst) {
+  so_trampoline t;
+  int thumb = addr & 1;
+
+  memset(detour, 0, sizeof(so_detour));
+  memset(&t, 0, sizeof(so_trampoline));
+  addr &= ~1;
+  if (addr == 0)
+    return -1;
+
+  if (detour_blockid < 0) {
+    detour_blockid = kuKernelAllocMemBlock("detour_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, ALIGN_MEM(SO_MAX_DETOURS * SO_DETOUR_SIZE, 0x1000), NULL);
+    if (detour_blockid < 0)
+      return detour_blockid;
+    sceKernelGetMemBlockBase(detour_blockid, (void **)&detour_code);
+  }
+
+  if (num_detours == SO_MAX_DETOURS)
+    return -1;
+
+  detour->addr = addr;
+  detour->size = so_hook_build(addr, dst, thumb, detour->patch);
+  memcpy(detour->original, (void *)addr, detour->size);
+
+  int copied = thumb ? so_relocate_thumb(&t, addr, detour->size) : so_relocate_arm(&t, addr, detour->size);
+  if (copied < 0) {
+    debugPrintf("detour %08x: prologue can't be relocated\n", addr);
+    return -1;
+  }
+
+  // jump back behind the copied instructions
+  int ret;
+  if (thumb) {
+    ret = (t.size & 2) ? so_tramp_emit(&t, 0xbf00, 2) : 0; // NOP
+    if (ret == 0)
+      ret = so_tramp_emit(&t, 0xf000f8df, 4); // LDR PC, [PC]
+    if (ret == 0)
+      ret = so_tramp_emit(&t, (addr + copied) | 1, 4);
+  } else {
+    ret = so_tramp_emit(&t, 0xe51ff004, 4); // LDR PC, [PC, #-0x4]
+    if (ret == 0)
+      ret = so_tramp_emit(&t, addr + copied, 4);
+  }
+  if (ret < 0 || so_tramp_finish(&t, thumb) < 0) {
+    debugPrintf("detour %08x: trampoline too large\n", addr);
+    return -1;
+  }
+
+  uintptr_t trampoline = detour_code + num_detours * SO_DETOUR_SIZE;
+  kuKernelCpuUnrestrictedMemcpy((void *)trampoline, t.code, t.size);
+  kuKernelFlushCaches((void *)trampoline, t.size);
+  num_detours++;
+
+  detour->trampoline = trampoline | thumb;
+  return 0;
+}
+
+// writes the hook or the original bytes back. a thread executing the first
+// instructions while they change may still crash, so toggle idle functions
+void so_detour_enable(so_detour *detour, int enable) {
+  enable = !!enable;
+  if (!detour->trampoline || detour->enabled == enable)
+    return;
+
+  so_hook_write(detour->addr, enable ? detour->patch : detour->original, detour->size);
+  if (!hook_transaction)
+    kuKernelFlushCaches((void *)detour->addr, detour->size);
+  detour->enabled = enable;
+}
+
 void so_flush_caches(so_module *mod) {
-  kuKernelFlushCaches((void *)mod->text_base, mod->text_size);
+  if (!mod->text_dirty) {
+    kuKernelFlushCaches((void *)mod->text_base, mod->text_size);
+    return;
+  }
+
+  // flush runs of consecutive dirty pages with one call each
+  int num_pages = (mod->text_block_size + (1 << SO_PAGE_SHIFT) - 1) >> SO_PAGE_SHIFT;
+  int run = -1;
+  for (int page = 0; page <= num_pages; page++) {
+    int dirty = page < num_pages && (mod->text_dirty[page / 32] & (1 << (page % 32)));
+    if (dirty && run < 0) {
+      run = page;
+    } else if (!dirty && run >= 0) {
+      kuKernelFlushCaches((void *)(mod->text_base + (run << SO_PAGE_SHIFT)), (page - run) << SO_PAGE_SHIFT);
+      run = -1;
+    }
+  }
+
+  memset(mod->text_dirty, 0, (num_pages + 31) / 32 * sizeof(uint32_t));
+}
+
+static SceUID so_alloc_block(const char *name, SceKernelMemBlockType type, uintptr_t addr, size_t size) {
+  SceKernelAllocMemBlockKernelOpt opt;
+  memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
+  opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
+  opt.attr = 0x1;
+  opt.field_C = (SceUInt32)addr;
+  return kuKernelAllocMemBlock(name, type, size, &opt);
+}
+
+static void so_link_module(so_module *mod) {
+  if (!head && !tail) {
+    head = mod;
+    tail = mod;
+  } else {
+    tail->next = mod;
+    tail = mod;
+  }
+}
+
+#define SO_CHUNK_SIZE (256 * 1024)
+
+static void *so_read_header(SceUID fd, size_t offset, size_t size) {
+  void *data = malloc(size);
+  if (!data)
+    return NULL;
+  if (sceIoLseek(fd, offset, SCE_SEEK_SET) != offset || sceIoRead(fd, data, size) != size) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+// read file data into memory that may not be writable from user mode
+static int so_read_unrestricted(SceUID fd, void *dst, size_t size, void *chunk) {
+  for (size_t off = 0; off < size; off += SO_CHUNK_SIZE) {
+    size_t len = size - off < SO_CHUNK_SIZE ? size - off : SO_CHUNK_SIZE;
+    if (sceIoRead(fd, chunk, len) != len)
+      return -1;
+    kuKernelCpuUnrestrictedMemcpy((void *)((uintptr_t)dst + off), chunk, len);
+  }
+  return 0;
+}
+
+static void so_zero_unrestricted(void *dst, size_t size, void *chunk) {
+  memset(chunk, 0, size < SO_CHUNK_SIZE ? size : SO_CHUNK_SIZE);
+  for (size_t off = 0; off < size; off += SO_CHUNK_SIZE) {
+    size_t len = size - off < SO_CHUNK_SIZE ? size - off : SO_CHUNK_SIZE;
+    kuKernelCpuUnrestrictedMemcpy((void *)((uintptr_t)dst + off), chunk, len);
+  }
+}
+
+#ifndef DT_ANDROID_REL
+#define DT_ANDROID_REL (DT_LOOS + 2)
+#define DT_ANDROID_RELSZ (DT_LOOS + 3)
+#endif
+#ifndef DT_RELR
+#define DT_RELRSZ 35
+#define DT_RELR 36
+#endif
+#ifndef DT_ANDROID_RELR
+#define DT_ANDROID_RELR 0x6fffe000
+#define DT_ANDROID_RELRSZ 0x6fffe001
+#endif
+
+#define APS2_GROUPED_BY_INFO 0x1
+#define APS2_GROUPED_BY_OFFSET_DELTA 0x2
+#define APS2_GROUPED_BY_ADDEND 0x4
+#define APS2_GROUP_HAS_ADDEND 0x8
+
+static int so_sleb128(const uint8_t **p, const uint8_t *end, int32_t *value) {
+  uint32_t result = 0;
+  int shift = 0;
+  uint8_t byte;
+
+  do {
+    if (*p >= end)
+      return -1;
+    byte = *(*p)++;
+    if (shift < 32)
+      result |= (uint32_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  if (shift < 32 && (byte & 0x40))
+    result |= ~0u << shift;
+
+  *value = (int32_t)result;
+  return 0;
+}
+
+// decode Android packed relocations (APS2) and append them to the plain DT_REL entries
+static int so_unpack_android_rel(so_module *mod, const uint8_t *packed, size_t size) {
+  const uint8_t *p = packed + 4, *end = packed + size;
+  int32_t count, offset, group_size, group_flags, group_delta = 0, info = 0, addend;
+
+  if (size < 4 || memcmp(packed, "APS2", 4) != 0)
+    return -1;
+
+  if (so_sleb128(&p, end, &count) < 0 || so_sleb128(&p, end, &offset) < 0 || count < 0)
+    return -1;
+
+  Elf32_Rel *rel = malloc((mod->num_reldyn + count) * sizeof(Elf32_Rel));
+  if (!rel)
+    return -1;
+  memcpy(rel, mod->reldyn, mod->num_reldyn * sizeof(Elf32_Rel));
+
+  int n = mod->num_reldyn;
+  while (n < mod->num_reldyn + count) {
+    if (so_sleb128(&p, end, &group_size) < 0 || so_sleb128(&p, end, &group_flags) < 0)
+      goto err;
+    // REL entries carry their addend in place
+    if ((group_flags & APS2_GROUP_HAS_ADDEND) || group_size < 0 || group_size > mod->num_reldyn + count - n)
+      goto err;
+    if ((group_flags & APS2_GROUPED_BY_OFFSET_DELTA) && so_sleb128(&p, end, &group_delta) < 0)
+      goto err;
+    if ((group_flags & APS2_GROUPED_BY_INFO) && so_sleb128(&p, end, &info) < 0)
+      goto err;
+
+    for (int i = 0; i < group_size; i++, n++) {
+      if (group_flags & APS2_GROUPED_BY_OFFSET_DELTA) {
+        offset += group_delta;
+      } else if (so_sleb128(&p, end, &addend) < 0) {
+        goto err;
+      } else {
+        offset += addend;
+      }
+      if (!(group_flags & APS2_GROUPED_BY_INFO) && so_sleb128(&p, end, &info) < 0)
+        goto err;
+      rel[n].r_offset = offset;
+      rel[n].r_info = info;
+    }
+  }
+
+  mod->reldyn = rel;
+  mod->num_reldyn = n;
+  mod->reldyn_unpacked = 1;
+
+  return 0;
+
+err:
+  free(rel);
+  return -1;
+}
+
+static int so_parse_dynamic(so_module *mod) {
+  const uint8_t *android_rel = NULL;
+  size_t android_relsz = 0;
+  uint32_t soname = 0;
+
+  for (int i = 0; i < mod->num_dynamic; i++) {
+    uintptr_t addr = mod->text_base + mod->dynamic[i].d_un.d_ptr;
+    uint32_t val = mod->dynamic[i].d_un.d_val;
+    switch (mod->dynamic[i].d_tag) {
+      case DT_SONAME:
+        soname = val;
+        break;
+      case DT_STRTAB:
+        mod->dynstr = (char *)addr;
+        break;
+      case DT_SYMTAB:
+        mod->dynsym = (Elf32_Sym *)addr;
+        break;
+      case DT_HASH:
+        mod->hash = (uint32_t *)addr;
+        break;
+      case DT_GNU_HASH:
+        mod->gnu_hash = (uint32_t *)addr;
+        break;
+      case DT_REL:
+        mod->reldyn = (Elf32_Rel *)addr;
+        break;
+      case DT_RELSZ:
+        mod->num_reldyn = val / sizeof(Elf32_Rel);
+        break;
+      case DT_JMPREL:
+        mod->relplt = (Elf32_Rel *)addr;
+        break;
+      case DT_PLTRELSZ:
+        mod->num_relplt = val / sizeof(Elf32_Rel);
+        break;
+      case DT_INIT_ARRAY:
+        mod->init_array = (void *)addr;
+        break;
+      case DT_INIT_ARRAYSZ:
+        mod->num_init_array = val / sizeof(void *);
+        break;
+      case DT_ANDROID_REL:
+        android_rel = (const uint8_t *)addr;
+        break;
+      case DT_ANDROID_RELSZ:
+        android_relsz = val;
+        break;
+      case DT_RELR:
+      case DT_ANDROID_RELR:
+        mod->relr = (uint32_t *)addr;
+        break;
+      case DT_RELRSZ:
+      case DT_ANDROID_RELRSZ:
+        mod->num_relr = val / sizeof(uint32_t);
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (mod->dynstr == NULL || mod->dynsym == NULL)
+    return -1;
+
+  mod->soname = mod->dynstr + soname;
+
+  // the dynamic segment has no symbol count, take it from the hash tables
+  if (mod->hash) {
+    mod->num_dynsym = mod->hash[1];
+  } else if (mod->gnu_hash) {
+    uint32_t nbucket = mod->gnu_hash[0];
+    uint32_t symoffset = mod->gnu_hash[1];
+    uint32_t *bucket = &mod->gnu_hash[4 + mod->gnu_hash[2]];
+    uint32_t *chain = &bucket[nbucket];
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < nbucket; i++) {
+      if (bucket[i] > last)
+        last = bucket[i];
+    }
+    if (last >= symoffset) {
+      while (!(chain[last - symoffset] & 1))
+        last++;
+      last++;
+    }
+    mod->num_dynsym = last > symoffset ? last : symoffset;
+  }
+
+  if (android_rel && so_unpack_android_rel(mod, android_rel, android_relsz) < 0)
+    return -1;
+
+  return 0;
 }
 
 int so_load(so_module *mod, const char *filename, uintptr_t load_addr) {
   int res = 0;
   uintptr_t data_addr = 0;
-  SceUID so_blockid;
-  void *so_data;
-  size_t so_size;
+  void *chunk = NULL;
 
   memset(mod, 0, sizeof(so_module));
 
@@ -71,28 +719,20 @@ int so_load(so_module *mod, const char *filename, uintptr_t load_addr) {
   if (fd < 0)
     return fd;
 
-  so_size = sceIoLseek(fd, 0, SCE_SEEK_END);
-  sceIoLseek(fd, 0, SCE_SEEK_SET);
+  // only the headers are staged, segments are streamed straight into their blocks
+  res = -1;
+  mod->ehdr = so_read_header(fd, 0, sizeof(Elf32_Ehdr));
+  if (!mod->ehdr)
+    goto err_close;
 
-  so_blockid = sceKernelAllocMemBlock("file", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, (so_size + 0xfff) & ~0xfff, NULL);
-  if (so_blockid < 0)
-    return so_blockid;
+  if (memcmp(mod->ehdr, ELFMAG, SELFMAG) != 0)
+    goto err_free_headers;
 
-  sceKernelGetMemBlockBase(so_blockid, &so_data);
-
-  sceIoRead(fd, so_data, so_size);
-  sceIoClose(fd);
-
-  if (memcmp(so_data, ELFMAG, SELFMAG) != 0) {
-    res = -1;
-    goto err_free_so;
-  }
-
-  mod->ehdr = (Elf32_Ehdr *)so_data;
-  mod->phdr = (Elf32_Phdr *)((uintptr_t)so_data + mod->ehdr->e_phoff);
-  mod->shdr = (Elf32_Shdr *)((uintptr_t)so_data + mod->ehdr->e_shoff);
-
-  mod->shstr = (char *)((uintptr_t)so_data + mod->shdr[mod->ehdr->e_shstrndx].sh_offset);
+  // everything else is found through the dynamic segment, section headers aren't needed
+  mod->phdr = so_read_header(fd, mod->ehdr->e_phoff, mod->ehdr->e_phnum * sizeof(Elf32_Phdr));
+  chunk = malloc(SO_CHUNK_SIZE);
+  if (!mod->phdr || !chunk)
+    goto err_free_headers;
 
   for (int i = 0; i < mod->ehdr->e_phnum; i++) {
     if (mod->phdr[i].p_type == PT_LOAD) {
@@ -102,14 +742,9 @@ int so_load(so_module *mod, const char *filename, uintptr_t load_addr) {
       if ((mod->phdr[i].p_flags & PF_X) == PF_X) {
         prog_size = ALIGN_MEM(mod->phdr[i].p_memsz, mod->phdr[i].p_align);
 
-        SceKernelAllocMemBlockKernelOpt opt;
-        memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
-        opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
-        opt.attr = 0x1;
-        opt.field_C = (SceUInt32)load_addr;
-        res = mod->text_blockid = kuKernelAllocMemBlock("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, prog_size, &opt);
+        res = mod->text_blockid = so_alloc_block("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, load_addr, prog_size);
         if (res < 0)
-          goto err_free_so;
+          goto err_free_headers;
 
         sceKernelGetMemBlockBase(mod->text_blockid, &prog_data);
 
@@ -117,20 +752,17 @@ int so_load(so_module *mod, const char *filename, uintptr_t load_addr) {
 
         mod->text_base = mod->phdr[i].p_vaddr;
         mod->text_size = mod->phdr[i].p_memsz;
+        mod->text_block_size = prog_size;
 
         data_addr = (uintptr_t)prog_data + prog_size;
       } else {
+        res = -1;
         if (data_addr == 0)
-          goto err_free_so;
+          goto err_free_headers;
 
         prog_size = ALIGN_MEM(mod->phdr[i].p_memsz + mod->phdr[i].p_vaddr - (data_addr - mod->text_base), mod->phdr[i].p_align);
 
-        SceKernelAllocMemBlockKernelOpt opt;
-        memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
-        opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
-        opt.attr = 0x1;
-        opt.field_C = (SceUInt32)data_addr;
-        res = mod->data_blockid = kuKernelAllocMemBlock("rw_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, prog_size, &opt);
+        res = mod->data_blockid = so_alloc_block("rw_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, data_addr, prog_size);
         if (res < 0)
           goto err_free_text;
 
@@ -140,86 +772,188 @@ int so_load(so_module *mod, const char *filename, uintptr_t load_addr) {
 
         mod->data_base = mod->phdr[i].p_vaddr;
         mod->data_size = mod->phdr[i].p_memsz;
+        mod->data_block_size = prog_size;
       }
 
-      char *zero = malloc(prog_size);
-      memset(zero, 0, prog_size);
-      kuKernelCpuUnrestrictedMemcpy(prog_data, zero, prog_size);
-      free(zero);
+      // zero only what the file doesn't cover: the head gap and the bss tail
+      uintptr_t file_start = mod->phdr[i].p_vaddr;
+      uintptr_t file_end = file_start + mod->phdr[i].p_filesz;
+      uintptr_t block_end = (uintptr_t)prog_data + prog_size;
+      so_zero_unrestricted(prog_data, file_start - (uintptr_t)prog_data, chunk);
+      so_zero_unrestricted((void *)file_end, block_end - file_end, chunk);
 
-      kuKernelCpuUnrestrictedMemcpy((void *)mod->phdr[i].p_vaddr, (void *)((uintptr_t)so_data + mod->phdr[i].p_offset), mod->phdr[i].p_filesz);
+      res = -1;
+      if (sceIoLseek(fd, mod->phdr[i].p_offset, SCE_SEEK_SET) != mod->phdr[i].p_offset ||
+          so_read_unrestricted(fd, (void *)file_start, mod->phdr[i].p_filesz, chunk) < 0)
+        goto err_free_data;
     }
   }
 
-  for (int i = 0; i < mod->ehdr->e_shnum; i++) {
-    char *sh_name = mod->shstr + mod->shdr[i].sh_name;
-    uintptr_t sh_addr = mod->text_base + mod->shdr[i].sh_addr;
-    size_t sh_size = mod->shdr[i].sh_size;
-    if (strcmp(sh_name, ".dynamic") == 0) {
-      mod->dynamic = (Elf32_Dyn *)sh_addr;
-      mod->num_dynamic = sh_size / sizeof(Elf32_Dyn);
-    } else if (strcmp(sh_name, ".dynstr") == 0) {
-      mod->dynstr = (char *)sh_addr;
-    } else if (strcmp(sh_name, ".dynsym") == 0) {
-      mod->dynsym = (Elf32_Sym *)sh_addr;
-      mod->num_dynsym = sh_size / sizeof(Elf32_Sym);
-    } else if (strcmp(sh_name, ".rel.dyn") == 0) {
-      mod->reldyn = (Elf32_Rel *)sh_addr;
-      mod->num_reldyn = sh_size / sizeof(Elf32_Rel);
-    } else if (strcmp(sh_name, ".rel.plt") == 0) {
-      mod->relplt = (Elf32_Rel *)sh_addr;
-      mod->num_relplt = sh_size / sizeof(Elf32_Rel);
-    } else if (strcmp(sh_name, ".init_array") == 0) {
-      mod->init_array = (void *)sh_addr;
-      mod->num_init_array = sh_size / sizeof(void *);
-    } else if (strcmp(sh_name, ".hash") == 0) {
-      mod->hash = (void *)sh_addr;
+  for (int i = 0; i < mod->ehdr->e_phnum; i++) {
+    if (mod->phdr[i].p_type == PT_DYNAMIC) {
+      mod->dynamic = (Elf32_Dyn *)(mod->text_base + mod->phdr[i].p_vaddr);
+      mod->num_dynamic = mod->phdr[i].p_memsz / sizeof(Elf32_Dyn);
     }
   }
 
-  if (mod->dynamic == NULL ||
-      mod->dynstr == NULL ||
-      mod->dynsym == NULL ||
-      mod->reldyn == NULL ||
-      mod->relplt == NULL) {
-    res = -2;
+  res = -2;
+  if (mod->dynamic == NULL || so_parse_dynamic(mod) < 0 || so_init_dirty(mod) < 0)
     goto err_free_data;
-  }
 
-  for (int i = 0; i < mod->num_dynamic; i++) {
-    switch (mod->dynamic[i].d_tag) {
-      case DT_SONAME:
-        mod->soname = mod->dynstr + mod->dynamic[i].d_un.d_ptr;
-        break;
-      default:
-        break;
-    }
-  }
+  free(chunk);
+  free(mod->phdr);
+  free(mod->ehdr);
+  mod->phdr = NULL;
+  mod->ehdr = NULL;
+  sceIoClose(fd);
 
-  sceKernelFreeMemBlock(so_blockid);
+  mod->path = strdup(filename);
 
-  if (!head && !tail) {
-    head = mod;
-    tail = mod;
-  } else {
-    tail->next = mod;
-    tail = mod;
-  }
+  so_link_module(mod);
 
   return 0;
 
 err_free_data:
-  sceKernelFreeMemBlock(mod->data_blockid);
+  if (mod->data_blockid > 0)
+    sceKernelFreeMemBlock(mod->data_blockid);
 err_free_text:
-  sceKernelFreeMemBlock(mod->text_blockid);
-err_free_so:
-  sceKernelFreeMemBlock(so_blockid);
+  if (mod->text_blockid > 0)
+    sceKernelFreeMemBlock(mod->text_blockid);
+err_free_headers:
+  free(chunk);
+  free(mod->phdr);
+  free(mod->ehdr);
+err_close:
+  sceIoClose(fd);
 
   return res;
 }
 
-int so_relocate(so_module *mod) {
-  for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+#ifdef SO_WORKERS
+#define SO_NUM_WORKERS 3
+#else
+#define SO_NUM_WORKERS 1 // every range runs on the calling thread
+#endif
+#define SO_MIN_JOB_SIZE 2048
+
+typedef struct so_job {
+  so_module *mod;
+  void (* func)(struct so_job *job);
+  void *data;
+  int start, end;
+  int default_dynlib_only;
+  int lazy;
+
+  // per-range results, merged in range order so diagnostics stay deterministic
+  so_import *imports;
+  int num_imports, max_imports;
+  int *missing;
+  int num_missing, max_missing;
+  int error;
+} so_job;
+
+static int so_job_thread(SceSize args, void *argp) {
+  so_job *job = *(so_job **)argp;
+  job->func(job);
+  return 0;
+}
+
+// split [0, count) into ranges over the user cores, jobs[0] is the template
+// and runs on the calling thread
+static int so_run_jobs(so_job *jobs, int count, int max_jobs) {
+  SceUID thids[SO_NUM_WORKERS];
+
+  int num_jobs = count / SO_MIN_JOB_SIZE;
+  if (num_jobs > max_jobs)
+    num_jobs = max_jobs;
+  if (num_jobs < 1)
+    num_jobs = 1;
+
+  int per_job = (count + num_jobs - 1) / num_jobs;
+  for (int j = 0; j < num_jobs; j++) {
+    if (j > 0)
+      jobs[j] = jobs[0];
+    jobs[j].start = j * per_job;
+    jobs[j].end = (j + 1) * per_job < count ? (j + 1) * per_job : count;
+    jobs[j].error = -1;
+  }
+
+  for (int j = 1; j < num_jobs; j++) {
+    thids[j] = sceKernelCreateThread("so_worker", so_job_thread, 0x10000100, 0x4000, 0, SCE_KERNEL_CPU_MASK_USER_0 << j, NULL);
+    if (thids[j] >= 0) {
+      so_job *job = &jobs[j];
+      sceKernelStartThread(thids[j], sizeof(job), &job);
+    } else {
+      jobs[j].func(&jobs[j]);
+    }
+  }
+
+  jobs[0].func(&jobs[0]);
+
+  for (int j = 1; j < num_jobs; j++) {
+    if (thids[j] >= 0) {
+      sceKernelWaitThreadEnd(thids[j], NULL, NULL);
+      sceKernelDeleteThread(thids[j]);
+    }
+  }
+
+  return num_jobs;
+}
+
+static void so_relocate_relr(so_module *mod) {
+  uintptr_t *where = NULL;
+
+  for (int i = 0; i < mod->num_relr; i++) {
+    uint32_t entry = mod->relr[i];
+    if ((entry & 1) == 0) {
+      // an address entry relocates one word and starts a new run
+      where = (uintptr_t *)(mod->text_base + entry);
+      so_mark_dirty(mod, (uintptr_t)where, sizeof(uintptr_t));
+      *where++ += mod->text_base;
+    } else {
+      // a bitmap entry covers the next 31 words after the run
+      so_mark_dirty(mod, (uintptr_t)where, 31 * sizeof(uintptr_t));
+      for (int j = 0; (entry >>= 1) != 0; j++) {
+        if (entry & 1)
+          where[j] += mod->text_base;
+      }
+      where += 31;
+    }
+  }
+}
+
+// linkers emit the R_ARM_RELATIVE entries as one sorted run at the start of
+// rel.dyn, apply that run in a tight loop without going through the switch
+static int so_relocate_relative_run(so_module *mod, int i, int end) {
+  Elf32_Rel *rel = &mod->reldyn[i];
+  uintptr_t base = mod->text_base;
+  if (end > mod->num_reldyn)
+    end = mod->num_reldyn;
+
+  // pages are marked as the run crosses into them, so a shuffled run doesn't
+  // dirty everything between its lowest and highest entry
+  uint32_t page = ~0u;
+  for (; i < end && ELF32_R_TYPE(rel->r_info) == R_ARM_RELATIVE; i++, rel++) {
+    uint32_t offset = rel->r_offset;
+    *(uintptr_t *)(base + offset) += base;
+    if ((offset >> SO_PAGE_SHIFT) != page) {
+      page = offset >> SO_PAGE_SHIFT;
+      so_mark_dirty(mod, base + offset, sizeof(uintptr_t));
+    }
+  }
+
+  return i;
+}
+
+static void so_relocate_job(so_job *job) {
+  so_module *mod = job->mod;
+
+  for (int i = job->start; i < job->end; i++) {
+    if (i < mod->num_reldyn && ELF32_R_TYPE(mod->reldyn[i].r_info) == R_ARM_RELATIVE) {
+      i = so_relocate_relative_run(mod, i, job->end) - 1;
+      continue;
+    }
+
     Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
     Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
     uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
@@ -248,10 +982,30 @@ int so_relocate(so_module *mod) {
       }
 
       default:
-        fatal_error("Error unknown relocation type %x\n", type);
+        if (job->error < 0)
+          job->error = i;
         break;
     }
   }
+}
+
+int so_relocate(so_module *mod) {
+  so_relocate_relr(mod);
+
+  // every relocation writes its own slot, so the ranges are independent
+  so_job jobs[SO_NUM_WORKERS];
+  memset(jobs, 0, sizeof(jobs));
+  jobs[0].mod = mod;
+  jobs[0].func = so_relocate_job;
+  int num_jobs = so_run_jobs(jobs, mod->num_reldyn + mod->num_relplt, SO_NUM_WORKERS);
+
+  for (int j = 0; j < num_jobs; j++) {
+    if (jobs[j].error >= 0) {
+      int i = jobs[j].error;
+      Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+      fatal_error("Error unknown relocation type %x\n", ELF32_R_TYPE(rel->r_info));
+    }
+  }
 
   return 0;
 }
@@ -281,8 +1035,158 @@ uintptr_t so_resolve_link(so_module *mod, const char *symbol) {
   return 0;
 }
 
-int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
-  for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+static so_default_dynlib *dynlib_table = NULL;
+static int num_dynlib_table = 0;
+static int *dynlib_slots = NULL;
+static uint32_t dynlib_mask = 0;
+
+// open addressing table over default_dynlib, indexed by so_hash of the symbol name
+static int so_build_dynlib_index(so_default_dynlib *default_dynlib, int num_default_dynlib) {
+  if (dynlib_table == default_dynlib && num_dynlib_table == num_default_dynlib)
+    return 0;
+
+  uint32_t size = 16;
+  while (size < num_default_dynlib * 2)
+    size <<= 1;
+
+  int *slots = malloc(size * sizeof(int));
+  if (!slots)
+    return -1;
+  memset(slots, 0xff, size * sizeof(int));
+
+  for (int j = 0; j < num_default_dynlib; j++) {
+    uint32_t h = so_hash((const uint8_t *)default_dynlib[j].symbol) & (size - 1);
+    while (slots[h] >= 0)
+      h = (h + 1) & (size - 1);
+    slots[h] = j;
+  }
+
+  free(dynlib_slots);
+  dynlib_slots = slots;
+  dynlib_mask = size - 1;
+  dynlib_table = default_dynlib;
+  num_dynlib_table = num_default_dynlib;
+
+  return 0;
+}
+
+static so_default_dynlib *so_lookup_dynlib(const char *symbol) {
+  // entries were inserted in table order, so duplicates resolve to the first one
+  for (uint32_t h = so_hash((const uint8_t *)symbol) & dynlib_mask; dynlib_slots[h] >= 0; h = (h + 1) & dynlib_mask) {
+    if (strcmp(symbol, dynlib_table[dynlib_slots[h]].symbol) == 0)
+      return &dynlib_table[dynlib_slots[h]];
+  }
+  return NULL;
+}
+
+static void so_add_import(so_job *job, uint32_t offset, uint32_t index) {
+  if (job->num_imports == job->max_imports) {
+    int max_imports = job->max_imports ? job->max_imports * 2 : 256;
+    so_import *imports = realloc(job->imports, max_imports * sizeof(so_import));
+    if (!imports) {
+      job->mod->cache_unsafe = 1;
+      return;
+    }
+    job->imports = imports;
+    job->max_imports = max_imports;
+  }
+
+  job->imports[job->num_imports].offset = offset;
+  job->imports[job->num_imports].index = index;
+  job->num_imports++;
+}
+
+static void so_add_missing(so_job *job, int index) {
+  if (job->num_missing == job->max_missing) {
+    int max_missing = job->max_missing ? job->max_missing * 2 : 32;
+    int *missing = realloc(job->missing, max_missing * sizeof(int));
+    if (!missing)
+      return;
+    job->missing = missing;
+    job->max_missing = max_missing;
+  }
+
+  job->missing[job->num_missing++] = index;
+}
+
+// returns the address of an undefined symbol, default_dynlib overrides dependencies
+static uintptr_t so_resolve_import(so_module *mod, const char *symbol, int default_dynlib_only, so_default_dynlib **entry) {
+  uintptr_t link = 0;
+
+  if (!default_dynlib_only)
+    link = so_resolve_link(mod, symbol);
+
+  *entry = so_lookup_dynlib(symbol);
+  if (*entry)
+    return (*entry)->func;
+
+  return link;
+}
+
+// PLT slots of a lazily bound module point at one of these until first called
+static const uint32_t so_lazy_trampoline[] = {
+  0xe59fc000, // LDR IP, [PC]
+  0xe59ff000, // LDR PC, [PC]
+  0x00000000, // so_lazy_slot *
+  0x00000000, // so_lazy_entry
+};
+
+// saves the argument registers, binds the slot passed in IP and tail-calls the target
+static const uint32_t so_lazy_entry[] = {
+  0xe92d500f, // PUSH {R0-R3, IP, LR}
+  0xe1a0000c, // MOV R0, IP
+  0xe59f3014, // LDR R3, [PC, #0x14]
+  0xe12fff33, // BLX R3
+  0xe1a0c000, // MOV IP, R0
+  0xe8bd000f, // POP {R0-R3}
+  0xe28dd004, // ADD SP, SP, #4
+  0xe49de004, // POP {LR}
+  0xe12fff1c, // BX IP
+  0x00000000, // so_lazy_bind
+};
+
+static uintptr_t so_lazy_bind(so_lazy_slot *slot) {
+  so_module *mod = slot->mod;
+  so_default_dynlib *entry;
+
+  uintptr_t addr = so_resolve_import(mod, slot->symbol, slot->default_dynlib_only, &entry);
+  if (!addr) {
+    printf("Missing: %s\n", slot->symbol);
+    addr = mod->text_base + slot->offset; // make it crash for debugging
+  }
+
+  *(uintptr_t *)(mod->text_base + slot->offset) = addr;
+
+  if (__sync_lock_test_and_set(&slot->bound, 1) == 0)
+    __sync_fetch_and_add(&mod->num_lazy_bound, 1);
+
+  return addr;
+}
+
+static int so_lazy_init(so_module *mod, int num_slots) {
+  size_t code_size = sizeof(so_lazy_entry) + num_slots * sizeof(so_lazy_trampoline);
+
+  mod->lazy_slots = calloc(num_slots, sizeof(so_lazy_slot));
+  if (!mod->lazy_slots)
+    return -1;
+
+  mod->lazy_blockid = kuKernelAllocMemBlock("lazy_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, ALIGN_MEM(code_size, 0x1000), NULL);
+  if (mod->lazy_blockid < 0) {
+    free(mod->lazy_slots);
+    mod->lazy_slots = NULL;
+    return mod->lazy_blockid;
+  }
+
+  sceKernelGetMemBlockBase(mod->lazy_blockid, (void **)&mod->lazy_code);
+
+  return 0;
+}
+
+static void so_resolve_job(so_job *job) {
+  so_module *mod = job->mod;
+  uint32_t *code = job->data;
+
+  for (int i = job->start; i < job->end; i++) {
     Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
     Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
     uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
@@ -294,33 +1198,38 @@ int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_defau
       case R_ARM_JUMP_SLOT:
       {
         if (sym->st_shndx == SHN_UNDEF) {
-          int resolved = 0;
-          if (!default_dynlib_only) {
-            uintptr_t link = so_resolve_link(mod, mod->dynstr + sym->st_name);
-            if (link) {
-              // debugPrintf("Resolved from dependencies: %s\n", mod->dynstr + sym->st_name);
-              *ptr = link;
-              resolved = 1;
-            }
-          }
+          const char *symbol = mod->dynstr + sym->st_name;
+
+          if (job->lazy && type == R_ARM_JUMP_SLOT && i >= mod->num_reldyn) {
+            so_lazy_slot *slot = &mod->lazy_slots[mod->num_lazy_slots];
+            slot->mod = mod;
+            slot->offset = rel->r_offset;
+            slot->symbol = symbol;
+            slot->default_dynlib_only = job->default_dynlib_only;
+
+            uint32_t *trampoline = &code[(sizeof(so_lazy_entry) + mod->num_lazy_slots * sizeof(so_lazy_trampoline)) / sizeof(uint32_t)];
+            memcpy(trampoline, so_lazy_trampoline, sizeof(so_lazy_trampoline));
+            trampoline[2] = (uintptr_t)slot;
+            trampoline[3] = mod->lazy_code;
 
-          for (int j = 0; j < size_default_dynlib / sizeof(so_default_dynlib); j++) {
-            if (strcmp(mod->dynstr + sym->st_name, default_dynlib[j].symbol) == 0) {
-              if (resolved) {
-                // debugPrintf("Overriden: %s\n", mod->dynstr + sym->st_name);
-              } else {
-                // debugPrintf("Resolved manually: %s\n", mod->dynstr + sym->st_name);
-              }
-              *ptr = default_dynlib[j].func;
-              resolved = 1;
-              break;
-            }
+            *ptr = mod->lazy_code + (uintptr_t)trampoline - (uintptr_t)code;
+            mod->num_lazy_slots++;
+            break;
           }
 
-          if (!resolved) {
-            //printf("Missing: %s\n", mod->dynstr + sym->st_name);
-            printf("  { \"%s\", (uintptr_t)&%s },\n", mod->dynstr + sym->st_name, mod->dynstr + sym->st_name);
+          so_default_dynlib *entry;
+          uintptr_t addr = so_resolve_import(mod, symbol, job->default_dynlib_only, &entry);
+          if (entry) {
+            so_add_import(job, rel->r_offset, entry - dynlib_table);
+          } else if (addr) {
+            // slots pointing into other modules can't be restored from the cache
+            mod->cache_unsafe = 1;
           }
+
+          if (addr)
+            *ptr = addr;
+          else
+            so_add_missing(job, i);
         }
 
         break;
@@ -330,10 +1239,335 @@ int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_defau
         break;
     }
   }
+}
+
+static int so_resolve_internal(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only, int lazy) {
+  if (so_build_dynlib_index(default_dynlib, size_default_dynlib / sizeof(so_default_dynlib)) < 0)
+    return -1;
+
+  uint32_t *code = NULL;
+  if (lazy) {
+    int num_slots = 0;
+    for (int i = 0; i < mod->num_relplt; i++) {
+      if (ELF32_R_TYPE(mod->relplt[i].r_info) == R_ARM_JUMP_SLOT &&
+          mod->dynsym[ELF32_R_SYM(mod->relplt[i].r_info)].st_shndx == SHN_UNDEF)
+        num_slots++;
+    }
+
+    if (so_lazy_init(mod, num_slots) < 0)
+      return -1;
+
+    // trampolines are built in a staging buffer and copied into the RX block once
+    code = malloc(sizeof(so_lazy_entry) + num_slots * sizeof(so_lazy_trampoline));
+    if (!code)
+      return -1;
+    memcpy(code, so_lazy_entry, sizeof(so_lazy_entry));
+    code[sizeof(so_lazy_entry) / sizeof(uint32_t) - 1] = (uintptr_t)&so_lazy_bind;
+
+    // lazily bound slots are not restored by the relocation cache
+    mod->cache_unsafe = 1;
+  }
+
+  // lookups are read-only and every slot is written once, only lazy slot
+  // allocation needs a single range
+  so_job jobs[SO_NUM_WORKERS];
+  memset(jobs, 0, sizeof(jobs));
+  jobs[0].mod = mod;
+  jobs[0].func = so_resolve_job;
+  jobs[0].data = code;
+  jobs[0].default_dynlib_only = default_dynlib_only;
+  jobs[0].lazy = lazy;
+  int num_jobs = so_run_jobs(jobs, mod->num_reldyn + mod->num_relplt, lazy ? 1 : SO_NUM_WORKERS);
+
+  int num_imports = 0;
+  for (int j = 0; j < num_jobs; j++)
+    num_imports += jobs[j].num_imports;
+
+  free(mod->imports);
+  mod->imports = malloc(num_imports * sizeof(so_import));
+  mod->num_imports = mod->max_imports = 0;
+  if (mod->imports || num_imports == 0)
+    mod->max_imports = num_imports;
+  else
+    mod->cache_unsafe = 1;
+
+  for (int j = 0; j < num_jobs; j++) {
+    if (mod->imports)
+      memcpy(&mod->imports[mod->num_imports], jobs[j].imports, jobs[j].num_imports * sizeof(so_import));
+    mod->num_imports += mod->imports ? jobs[j].num_imports : 0;
+
+    for (int k = 0; k < jobs[j].num_missing; k++) {
+      int i = jobs[j].missing[k];
+      Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+      const char *symbol = mod->dynstr + mod->dynsym[ELF32_R_SYM(rel->r_info)].st_name;
+      //printf("Missing: %s\n", symbol);
+      printf("  { \"%s\", (uintptr_t)&%s },\n", symbol, symbol);
+    }
+
+    free(jobs[j].imports);
+    free(jobs[j].missing);
+  }
+
+  if (lazy) {
+    size_t code_size = sizeof(so_lazy_entry) + mod->num_lazy_slots * sizeof(so_lazy_trampoline);
+    kuKernelCpuUnrestrictedMemcpy((void *)mod->lazy_code, code, code_size);
+    kuKernelFlushCaches((void *)mod->lazy_code, code_size);
+    free(code);
+  }
+
+  return 0;
+}
+
+int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+  return so_resolve_internal(mod, default_dynlib, size_default_dynlib, default_dynlib_only, 0);
+}
+
+int so_resolve_lazy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+  return so_resolve_internal(mod, default_dynlib, size_default_dynlib, default_dynlib_only, 1);
+}
+
+int so_lazy_report(so_module *mod, const char *filename) {
+  SceUID fd = sceIoOpen(filename, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd < 0)
+    return fd;
+
+  char line[512];
+  int len = snprintf(line, sizeof(line), "%d of %d lazy slots bound\n", mod->num_lazy_bound, mod->num_lazy_slots);
+  sceIoWrite(fd, line, len);
+
+  for (int i = 0; i < mod->num_lazy_slots; i++) {
+    if (mod->lazy_slots[i].bound) {
+      len = snprintf(line, sizeof(line), "%s\n", mod->lazy_slots[i].symbol);
+      sceIoWrite(fd, line, len < sizeof(line) ? len : sizeof(line) - 1);
+    }
+  }
+
+  sceIoClose(fd);
+
+  return 0;
+}
+
+#define SO_CACHE_MAGIC 0x48434f53 // "SOCH"
+#define SO_CACHE_VERSION 2
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+
+  // fingerprint of everything the relocated image depends on
+  uint32_t so_size;
+  SceDateTime so_mtime;
+  uint32_t dynlib_hash;
+  uint32_t num_dynlib;
+  uint32_t load_addr;
+
+  uint32_t text_base, text_size, text_block_size;
+  uint32_t data_block, data_base, data_size, data_block_size;
+
+  // module pointers, relative to text_base (0 if missing)
+  uint32_t dynamic, dynsym, dynstr, reldyn, relplt, init_array, hash, gnu_hash, soname;
+  int32_t num_dynamic, num_dynsym, num_reldyn, num_relplt, num_init_array;
+
+  int32_t num_imports;
+} so_cache_header;
+
+static uint32_t so_dynlib_fingerprint(so_default_dynlib *default_dynlib, int num_default_dynlib) {
+  // only names matter, shim addresses are re-patched on every load
+  uint32_t h = 0;
+  for (int j = 0; j < num_default_dynlib; j++)
+    h = h * 31 + so_hash((const uint8_t *)default_dynlib[j].symbol);
+  return h;
+}
+
+static int so_cache_fingerprint(so_cache_header *hdr, const char *so_filename, uintptr_t load_addr, so_default_dynlib *default_dynlib, int size_default_dynlib) {
+  SceIoStat stat;
+  if (sceIoGetstat(so_filename, &stat) < 0)
+    return -1;
+
+  memset(hdr, 0, sizeof(so_cache_header));
+  hdr->magic = SO_CACHE_MAGIC;
+  hdr->version = SO_CACHE_VERSION;
+  hdr->so_size = stat.st_size;
+  hdr->so_mtime = stat.st_mtime;
+  hdr->num_dynlib = size_default_dynlib / sizeof(so_default_dynlib);
+  hdr->dynlib_hash = so_dynlib_fingerprint(default_dynlib, hdr->num_dynlib);
+  hdr->load_addr = load_addr;
+
+  return 0;
+}
+
+#define SO_CACHE_PTR(mod, p) ((p) ? (uint32_t)((uintptr_t)(p) - (mod)->text_base) : 0)
+#define SO_CACHE_ADDR(mod, off) ((off) ? (void *)((mod)->text_base + (off)) : NULL)
+
+int so_cache_save(so_module *mod, const char *filename, const char *so_filename, uintptr_t load_addr, so_default_dynlib *default_dynlib, int size_default_dynlib) {
+  so_cache_header hdr;
+  void *data_block;
+
+  if (mod->cache_unsafe)
+    return -1;
+
+  if (so_cache_fingerprint(&hdr, so_filename, load_addr, default_dynlib, size_default_dynlib) < 0)
+    return -1;
+
+  sceKernelGetMemBlockBase(mod->data_blockid, &data_block);
+
+  hdr.text_base = mod->text_base;
+  hdr.text_size = mod->text_size;
+  hdr.text_block_size = mod->text_block_size;
+  hdr.data_block = (uintptr_t)data_block;
+  hdr.data_base = mod->data_base;
+  hdr.data_size = mod->data_size;
+  hdr.data_block_size = mod->data_block_size;
+
+  hdr.dynamic = SO_CACHE_PTR(mod, mod->dynamic);
+  hdr.dynsym = SO_CACHE_PTR(mod, mod->dynsym);
+  hdr.dynstr = SO_CACHE_PTR(mod, mod->dynstr);
+  // unpacked relocations live on the heap, they aren't needed after a cached load
+  hdr.reldyn = mod->reldyn_unpacked ? 0 : SO_CACHE_PTR(mod, mod->reldyn);
+  hdr.relplt = SO_CACHE_PTR(mod, mod->relplt);
+  hdr.init_array = SO_CACHE_PTR(mod, mod->init_array);
+  hdr.hash = SO_CACHE_PTR(mod, mod->hash);
+  hdr.gnu_hash = SO_CACHE_PTR(mod, mod->gnu_hash);
+  hdr.soname = SO_CACHE_PTR(mod, mod->soname);
+  hdr.num_dynamic = mod->num_dynamic;
+  hdr.num_dynsym = mod->num_dynsym;
+  hdr.num_reldyn = mod->reldyn_unpacked ? 0 : mod->num_reldyn;
+  hdr.num_relplt = mod->num_relplt;
+  hdr.num_init_array = mod->num_init_array;
+  hdr.num_imports = mod->num_imports;
+
+  SceUID fd = sceIoOpen(filename, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd < 0)
+    return fd;
+
+  // the header is written last so a partially written cache never matches
+  uint32_t magic = hdr.magic;
+  hdr.magic = 0;
+  int ok = sceIoWrite(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+           sceIoWrite(fd, (void *)mod->text_base, hdr.text_block_size) == hdr.text_block_size &&
+           sceIoWrite(fd, data_block, hdr.data_block_size) == hdr.data_block_size &&
+           sceIoWrite(fd, mod->imports, hdr.num_imports * sizeof(so_import)) == hdr.num_imports * sizeof(so_import);
+  if (ok) {
+    hdr.magic = magic;
+    sceIoLseek(fd, 0, SCE_SEEK_SET);
+    ok = sceIoWrite(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+  }
+  sceIoClose(fd);
+
+  if (!ok) {
+    sceIoRemove(filename);
+    return -1;
+  }
 
   return 0;
 }
 
+int so_cache_load(so_module *mod, const char *filename, const char *so_filename, uintptr_t load_addr, so_default_dynlib *default_dynlib, int size_default_dynlib) {
+  so_cache_header hdr, expected;
+  void *text_block, *data_block;
+  int res = -1;
+
+  memset(mod, 0, sizeof(so_module));
+
+  if (so_cache_fingerprint(&expected, so_filename, load_addr, default_dynlib, size_default_dynlib) < 0)
+    return -1;
+
+  SceUID fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
+  if (fd < 0)
+    return fd;
+
+  if (sceIoRead(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      hdr.magic != expected.magic ||
+      hdr.version != expected.version ||
+      hdr.so_size != expected.so_size ||
+      memcmp(&hdr.so_mtime, &expected.so_mtime, sizeof(SceDateTime)) != 0 ||
+      hdr.dynlib_hash != expected.dynlib_hash ||
+      hdr.num_dynlib != expected.num_dynlib ||
+      hdr.load_addr != expected.load_addr)
+    goto err_close;
+
+  res = mod->text_blockid = so_alloc_block("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, hdr.text_base, hdr.text_block_size);
+  if (res < 0)
+    goto err_close;
+  sceKernelGetMemBlockBase(mod->text_blockid, &text_block);
+
+  res = mod->data_blockid = so_alloc_block("rw_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, hdr.data_block, hdr.data_block_size);
+  if (res < 0)
+    goto err_free_text;
+  sceKernelGetMemBlockBase(mod->data_blockid, &data_block);
+
+  res = -1;
+  if ((uintptr_t)text_block != hdr.text_base || (uintptr_t)data_block != hdr.data_block)
+    goto err_free_data;
+
+  // the text block isn't writable from user mode, bounce it through a small buffer
+  void *chunk = malloc(SO_CHUNK_SIZE);
+  if (!chunk)
+    goto err_free_data;
+  int read_res = so_read_unrestricted(fd, text_block, hdr.text_block_size, chunk);
+  free(chunk);
+  if (read_res < 0)
+    goto err_free_data;
+
+  if (sceIoRead(fd, data_block, hdr.data_block_size) != hdr.data_block_size)
+    goto err_free_data;
+
+  mod->imports = malloc(hdr.num_imports * sizeof(so_import));
+  if (!mod->imports && hdr.num_imports)
+    goto err_free_data;
+  if (sceIoRead(fd, mod->imports, hdr.num_imports * sizeof(so_import)) != hdr.num_imports * sizeof(so_import))
+    goto err_free_imports;
+  mod->num_imports = mod->max_imports = hdr.num_imports;
+
+  sceIoClose(fd);
+
+  mod->text_base = hdr.text_base;
+  mod->text_size = hdr.text_size;
+  mod->text_block_size = hdr.text_block_size;
+  mod->data_base = hdr.data_base;
+  mod->data_size = hdr.data_size;
+  mod->data_block_size = hdr.data_block_size;
+
+  mod->dynamic = SO_CACHE_ADDR(mod, hdr.dynamic);
+  mod->dynsym = SO_CACHE_ADDR(mod, hdr.dynsym);
+  mod->dynstr = SO_CACHE_ADDR(mod, hdr.dynstr);
+  mod->reldyn = SO_CACHE_ADDR(mod, hdr.reldyn);
+  mod->relplt = SO_CACHE_ADDR(mod, hdr.relplt);
+  mod->init_array = SO_CACHE_ADDR(mod, hdr.init_array);
+  mod->hash = SO_CACHE_ADDR(mod, hdr.hash);
+  mod->gnu_hash = SO_CACHE_ADDR(mod, hdr.gnu_hash);
+  mod->soname = SO_CACHE_ADDR(mod, hdr.soname);
+  mod->num_dynamic = hdr.num_dynamic;
+  mod->num_dynsym = hdr.num_dynsym;
+  mod->num_reldyn = hdr.num_reldyn;
+  mod->num_relplt = hdr.num_relplt;
+  mod->num_init_array = hdr.num_init_array;
+
+  so_init_dirty(mod);
+
+  mod->path = strdup(so_filename);
+
+  // shim addresses change between builds, so only the symbolic import slots are patched
+  for (int i = 0; i < mod->num_imports; i++)
+    *(uintptr_t *)(mod->text_base + mod->imports[i].offset) = default_dynlib[mod->imports[i].index].func;
+
+  so_link_module(mod);
+
+  return 0;
+
+err_free_imports:
+  free(mod->imports);
+  mod->imports = NULL;
+err_free_data:
+  sceKernelFreeMemBlock(mod->data_blockid);
+err_free_text:
+  sceKernelFreeMemBlock(mod->text_blockid);
+err_close:
+  sceIoClose(fd);
+
+  return res;
+}
+
 void so_initialize(so_module *mod) {
   for (int i = 0; i < mod->num_init_array; i++) {
     if (mod->init_array[i])
@@ -352,7 +1586,51 @@ uint32_t so_hash(const uint8_t *name) {
   return h;
 }
 
+uint32_t so_gnu_hash(const uint8_t *name) {
+  uint32_t h = 5381;
+  while (*name)
+    h = (h << 5) + h + *name++;
+  return h;
+}
+
+static uintptr_t so_gnu_symbol(so_module *mod, const char *symbol) {
+  uint32_t hash = so_gnu_hash((const uint8_t *)symbol);
+  uint32_t nbucket = mod->gnu_hash[0];
+  uint32_t symoffset = mod->gnu_hash[1];
+  uint32_t bloom_size = mod->gnu_hash[2];
+  uint32_t bloom_shift = mod->gnu_hash[3];
+  uint32_t *bloom = &mod->gnu_hash[4];
+  uint32_t *bucket = &bloom[bloom_size];
+  uint32_t *chain = &bucket[nbucket];
+
+  // reject most misses with the bloom filter before touching the buckets
+  uint32_t word = bloom[(hash / 32) & (bloom_size - 1)];
+  uint32_t mask = (1u << (hash % 32)) | (1u << ((hash >> bloom_shift) % 32));
+  if ((word & mask) != mask)
+    return 0;
+
+  uint32_t i = bucket[hash % nbucket];
+  if (i < symoffset)
+    return 0;
+
+  for (;; i++) {
+    uint32_t chain_hash = chain[i - symoffset];
+    if ((hash | 1) == (chain_hash | 1) &&
+        mod->dynsym[i].st_shndx != SHN_UNDEF &&
+        strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0)
+      return mod->text_base + mod->dynsym[i].st_value;
+    // the low bit marks the end of the chain
+    if (chain_hash & 1)
+      break;
+  }
+
+  return 0;
+}
+
 uintptr_t so_symbol(so_module *mod, const char *symbol) {
+  if (mod->gnu_hash)
+    return so_gnu_symbol(mod, symbol);
+
   if (mod->hash) {
     uint32_t hash = so_hash((const uint8_t *)symbol);
     uint32_t nbucket = mod->hash[0];
@@ -375,3 +1653,155 @@ uintptr_t so_symbol(so_module *mod, const char *symbol) {
 
   return 0;
 }
+
+static int so_compare_range(const void *a, const void *b) {
+  const so_symbol_range *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int so_add_symbols(so_symbol_range *ranges, int n, Elf32_Sym *syms, int num_syms, const char *strtab) {
+  for (int i = 0; i < num_syms; i++) {
+    int type = ELF32_ST_TYPE(syms[i].st_info);
+    if (syms[i].st_shndx == SHN_UNDEF || syms[i].st_value == 0 || (type != STT_FUNC && type != STT_OBJECT))
+      continue;
+    ranges[n].start = syms[i].st_value & ~1;
+    ranges[n].size = syms[i].st_size;
+    ranges[n].name = strtab + syms[i].st_name;
+    n++;
+  }
+  return n;
+}
+
+// .symtab isn't part of any segment, so it has to be read from the file
+static int so_read_symtab(so_module *mod, Elf32_Sym **syms, char **strtab) {
+  Elf32_Ehdr ehdr;
+  Elf32_Shdr *shdr = NULL;
+  int num_syms = 0;
+
+  *syms = NULL;
+  *strtab = NULL;
+
+  if (!mod->path)
+    return 0;
+
+  SceUID fd = sceIoOpen(mod->path, SCE_O_RDONLY, 0);
+  if (fd < 0)
+    return 0;
+
+  if (sceIoRead(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr))
+    goto out;
+
+  shdr = so_read_header(fd, ehdr.e_shoff, ehdr.e_shnum * sizeof(Elf32_Shdr));
+  if (!shdr)
+    goto out;
+
+  for (int i = 0; i < ehdr.e_shnum; i++) {
+    if (shdr[i].sh_type == SHT_SYMTAB && shdr[i].sh_link < ehdr.e_shnum) {
+      Elf32_Shdr *str = &shdr[shdr[i].sh_link];
+      *syms = so_read_header(fd, shdr[i].sh_offset, shdr[i].sh_size);
+      *strtab = so_read_header(fd, str->sh_offset, str->sh_size);
+      if (*syms && *strtab) {
+        num_syms = shdr[i].sh_size / sizeof(Elf32_Sym);
+      } else {
+        free(*syms);
+        free(*strtab);
+        *syms = NULL;
+        *strtab = NULL;
+      }
+      break;
+    }
+  }
+
+out:
+  free(shdr);
+  sceIoClose(fd);
+  return num_syms;
+}
+
+static void so_build_symbol_index(so_module *mod) {
+  Elf32_Sym *symtab;
+  char *strtab;
+
+  int num_symtab = so_read_symtab(mod, &symtab, &strtab);
+
+  so_symbol_range *ranges = malloc((mod->num_dynsym + num_symtab) * sizeof(so_symbol_range));
+  if (!ranges) {
+    free(symtab);
+    free(strtab);
+    return;
+  }
+
+  int n = so_add_symbols(ranges, 0, mod->dynsym, mod->num_dynsym, mod->dynstr);
+  n = so_add_symbols(ranges, n, symtab, num_symtab, strtab);
+  free(symtab);
+
+  qsort(ranges, n, sizeof(so_symbol_range), so_compare_range);
+
+  // drop aliases, the first name seen for an address wins
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    if (m > 0 && ranges[m - 1].start == ranges[i].start) {
+      if (ranges[m - 1].size == 0)
+        ranges[m - 1].size = ranges[i].size;
+      continue;
+    }
+    ranges[m++] = ranges[i];
+  }
+
+  mod->symbol_strtab = strtab;
+  mod->num_symbol_ranges = m;
+  __sync_synchronize();
+  mod->symbol_ranges = ranges;
+}
+
+// builds the index so_addr_to_symbol searches, it reads .symtab from the
+// file. call it up front where a lookup must not wait on the card
+int so_index_symbols(so_module *mod) {
+  if (mod->symbol_ranges)
+    return 0;
+
+  // concurrent callers just miss until it's ready
+  if (__sync_lock_test_and_set(&mod->symbol_index_busy, 1) != 0)
+    return -1;
+  so_build_symbol_index(mod);
+  if (!mod->symbol_ranges) {
+    // let a later call retry
+    __sync_lock_release(&mod->symbol_index_busy);
+    return -1;
+  }
+
+  return 0;
+}
+
+const char *so_addr_to_symbol(so_module *mod, uintptr_t addr, uintptr_t *sym_addr) {
+  if (so_index_symbols(mod) < 0)
+    return NULL;
+
+  if (addr < mod->text_base || addr >= mod->text_base + mod->text_block_size + mod->data_block_size)
+    return NULL;
+
+  uint32_t offset = (addr & ~1) - mod->text_base;
+  int lo = 0, hi = mod->num_symbol_ranges - 1, found = -1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (mod->symbol_ranges[mid].start <= offset) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  if (found < 0)
+    return NULL;
+
+  so_symbol_range *range = &mod->symbol_ranges[found];
+  // symbols without a size cover everything up to the next one
+  if (range->size && offset >= range->start + range->size)
+    return NULL;
+
+  if (sym_addr)
+    *sym_addr = mod->text_base + range->start;
+
+  return range->name;
+}
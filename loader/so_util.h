@@ -5,12 +5,37 @@
 
 #define ALIGN_MEM(x, align) (((x) + ((align) - 1)) & ~((align) - 1))
 
+typedef struct {
+  uint32_t offset;
+  uint32_t index;
+} so_import;
+
+struct so_module;
+
+typedef struct {
+  uint32_t start;
+  uint32_t size;
+  const char *name;
+} so_symbol_range;
+
+typedef struct {
+  struct so_module *mod;
+  uint32_t offset;
+  const char *symbol;
+  int default_dynlib_only;
+  int bound;
+} so_lazy_slot;
+
 typedef struct so_module {
   struct so_module *next;
 
   SceUID text_blockid, data_blockid;
   uintptr_t text_base, data_base;
   size_t text_size, data_size;
+  size_t text_block_size, data_block_size;
+
+  // one bit per text page written since the last so_flush_caches
+  uint32_t *text_dirty;
 
   Elf32_Ehdr *ehdr;
   Elf32_Phdr *phdr;
@@ -21,18 +46,46 @@ typedef struct so_module {
   Elf32_Rel *reldyn;
   Elf32_Rel *relplt;
 
+  uint32_t *relr;
+
   int (** init_array)(void);
   uint32_t *hash;
+  uint32_t *gnu_hash;
 
   int num_dynamic;
   int num_dynsym;
   int num_reldyn;
   int num_relplt;
+  int num_relr;
   int num_init_array;
 
   char *soname;
   char *shstr;
   char *dynstr;
+
+  // reldyn was decoded from DT_ANDROID_REL into a heap copy
+  int reldyn_unpacked;
+
+  // import slots resolved from default_dynlib, used by the relocation cache
+  so_import *imports;
+  int num_imports;
+  int max_imports;
+  int cache_unsafe;
+
+  char *path;
+
+  // sorted address ranges for so_addr_to_symbol, built on first use
+  so_symbol_range *symbol_ranges;
+  int num_symbol_ranges;
+  int symbol_index_busy;
+  char *symbol_strtab;
+
+  // PLT slots bound on first call by so_resolve_lazy
+  SceUID lazy_blockid;
+  uintptr_t lazy_code;
+  so_lazy_slot *lazy_slots;
+  int num_lazy_slots;
+  int num_lazy_bound;
 } so_module;
 
 typedef struct {
@@ -40,15 +93,38 @@ typedef struct {
   uintptr_t func;
 } so_default_dynlib;
 
+// a hook that keeps the original callable through a trampoline holding the
+// relocated prologue
+typedef struct {
+  uintptr_t addr;
+  uintptr_t trampoline;
+  uint32_t size;
+  uint8_t original[12];
+  uint8_t patch[12];
+  int enabled;
+} so_detour;
+
 void hook_thumb(uintptr_t addr, uintptr_t dst);
 void hook_arm(uintptr_t addr, uintptr_t dst);
 void hook_addr(uintptr_t addr, uintptr_t dst);
+void so_hook_begin(void);
+void so_hook_commit(void);
+int so_detour_create(so_detour *detour, uintptr_t addr, uintptr_t dst);
+void so_detour_enable(so_detour *detour, int enable);
 
 void so_flush_caches(so_module *mod);
 int so_load(so_module *mod, const char *filename, uintptr_t load_addr);
 int so_relocate(so_module *mod);
 int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
+int so_resolve_lazy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
+int so_lazy_report(so_module *mod, const char *filename);
+int so_cache_load(so_module *mod, const char *filename, const char *so_filename, uintptr_t load_addr, so_default_dynlib *default_dynlib, int size_default_dynlib);
+int so_cache_save(so_module *mod, const char *filename, const char *so_filename, uintptr_t load_addr, so_default_dynlib *default_dynlib, int size_default_dynlib);
 void so_initialize(so_module *mod);
 uintptr_t so_symbol(so_module *mod, const char *symbol);
+int so_index_symbols(so_module *mod);
+const char *so_addr_to_symbol(so_module *mod, uintptr_t addr, uintptr_t *sym_addr);
+uint32_t so_hash(const uint8_t *name);
+uint32_t so_gnu_hash(const uint8_t *name);
 
 #endif
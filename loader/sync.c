@@ -0,0 +1,208 @@
+/* sync.c -- pooled lightweight mutexes and condvars for the pthread imports
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef SYNC_HOST
+#include <psp2/kernel/error.h>
+#include <psp2/kernel/threadmgr.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifndef SYNC_HOST
+#include "main.h"
+#endif
+#include "sync.h"
+
+typedef struct {
+  uint8_t *slots;
+  uint32_t slot_size;
+  int max_slots;
+  int num_used;
+  void *free;
+  volatile int lock;
+  int warned;
+} sync_pool;
+
+static sync_mutex sync_mutexes[SYNC_MAX_MUTEXES] __attribute__((aligned(8)));
+static sync_cond sync_conds[SYNC_MAX_CONDS] __attribute__((aligned(8)));
+
+static sync_pool sync_mutex_pool = { (uint8_t *)sync_mutexes, sizeof(sync_mutex), SYNC_MAX_MUTEXES };
+static sync_pool sync_cond_pool = { (uint8_t *)sync_conds, sizeof(sync_cond), SYNC_MAX_CONDS };
+
+// only taken when objects are created or destroyed
+static void sync_pool_lock(sync_pool *pool) {
+  while (__sync_lock_test_and_set(&pool->lock, 1) != 0)
+    sceKernelDelayThread(100);
+}
+
+static void *sync_pool_alloc(sync_pool *pool) {
+  void *p = NULL;
+
+  sync_pool_lock(pool);
+  if (pool->free) {
+    p = pool->free;
+    pool->free = *(void **)p;
+  } else if (pool->num_used < pool->max_slots) {
+    p = pool->slots + pool->num_used++ * pool->slot_size;
+  }
+  __sync_lock_release(&pool->lock);
+
+  // an exhausted pool falls back to the heap rather than failing the game
+  if (!p) {
+    if (!pool->warned) {
+      pool->warned = 1;
+      debugPrintf("sync: pool of %d objects exhausted, using the heap\n", pool->max_slots);
+    }
+    p = malloc(pool->slot_size);
+    if (!p)
+      return NULL;
+  }
+
+  memset(p, 0, pool->slot_size);
+  return p;
+}
+
+static void sync_pool_free(sync_pool *pool, void *p) {
+  uint8_t *slot = p;
+  if (slot < pool->slots || slot >= pool->slots + pool->max_slots * pool->slot_size) {
+    free(p);
+    return;
+  }
+
+  sync_pool_lock(pool);
+  *(void **)p = pool->free;
+  pool->free = p;
+  __sync_lock_release(&pool->lock);
+}
+
+static sync_mutex *sync_mutex_new(uintptr_t type) {
+  sync_mutex *m = sync_pool_alloc(&sync_mutex_pool);
+  if (!m)
+    return NULL;
+
+  // errorcheck and normal are both non-recursive, relocking fails instead
+  // of deadlocking
+  int attr = type == SYNC_MUTEX_RECURSIVE ? SCE_KERNEL_MUTEX_ATTR_RECURSIVE : 0;
+  if (sceKernelCreateLwMutex(&m->work, "game_mutex", attr, 0, NULL) < 0) {
+    sync_pool_free(&sync_mutex_pool, m);
+    return NULL;
+  }
+
+  return m;
+}
+
+static void sync_mutex_delete(sync_mutex *m) {
+  sceKernelDeleteLwMutex(&m->work);
+  sync_pool_free(&sync_mutex_pool, m);
+}
+
+// slow path of sync_mutex_get: the first thread to swap the initializer
+// for a mutex wins, the others throw theirs away
+sync_mutex *sync_mutex_create(volatile uintptr_t *word) {
+  uintptr_t type = *word;
+  if (type > SYNC_MUTEX_ERRORCHECK)
+    return (sync_mutex *)type;
+
+  sync_mutex *m = sync_mutex_new(type);
+  if (!m)
+    return NULL;
+
+  if (!__sync_bool_compare_and_swap(word, type, (uintptr_t)m)) {
+    sync_mutex_delete(m);
+    return sync_mutex_get(word);
+  }
+
+  return m;
+}
+
+int sync_mutex_init(volatile uintptr_t *word, int type) {
+  sync_mutex *m = sync_mutex_new(type);
+  if (!m)
+    return SYNC_ENOMEM;
+
+  *word = (uintptr_t)m;
+  return 0;
+}
+
+int sync_mutex_destroy(volatile uintptr_t *word) {
+  uintptr_t v = *word;
+  if (v > SYNC_MUTEX_ERRORCHECK && __sync_bool_compare_and_swap(word, v, 0))
+    sync_mutex_delete((sync_mutex *)v);
+  return 0;
+}
+
+sync_cond *sync_cond_create(volatile uintptr_t *word) {
+  if (*word)
+    return (sync_cond *)*word;
+
+  sync_cond *c = sync_pool_alloc(&sync_cond_pool);
+  if (!c)
+    return NULL;
+
+  if (!__sync_bool_compare_and_swap(word, 0, (uintptr_t)c)) {
+    sync_pool_free(&sync_cond_pool, c);
+    return (sync_cond *)*word;
+  }
+
+  return c;
+}
+
+int sync_cond_destroy(volatile uintptr_t *word) {
+  sync_cond *c = (sync_cond *)*word;
+  if (c && __sync_bool_compare_and_swap(word, (uintptr_t)c, 0)) {
+    if (c->mutex)
+      sceKernelDeleteLwCond(&c->work);
+    sync_pool_free(&sync_cond_pool, c);
+  }
+  return 0;
+}
+
+// the caller holds m, which keeps other waiters out while the lwcond is
+// bound or rebound to it
+int sync_cond_wait(sync_cond *c, sync_mutex *m, const struct timespec *abstime) {
+  if (c->mutex != m) {
+    if (c->waiters)
+      return SYNC_EINVAL;
+    if (c->mutex)
+      sceKernelDeleteLwCond(&c->work);
+    c->mutex = NULL;
+    if (sceKernelCreateLwCond(&c->work, "game_cond", 0, &m->work, NULL) < 0)
+      return SYNC_EINVAL;
+    __sync_synchronize();
+    c->mutex = m;
+  }
+
+  unsigned int timeout = 0;
+  if (abstime) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t us = (int64_t)(abstime->tv_sec - now.tv_sec) * 1000000 + abstime->tv_nsec / 1000 - now.tv_usec;
+    if (us <= 0)
+      return SYNC_ETIMEDOUT;
+    timeout = us > 0xffffffff ? 0xffffffff : us;
+  }
+
+  __sync_fetch_and_add(&c->waiters, 1);
+  int ret = sceKernelWaitLwCond(&c->work, abstime ? &timeout : NULL);
+  __sync_fetch_and_sub(&c->waiters, 1);
+
+  if (ret == SCE_KERNEL_ERROR_WAIT_TIMEOUT)
+    return SYNC_ETIMEDOUT;
+  return ret < 0 ? SYNC_EINVAL : 0;
+}
+
+int sync_cond_signal(sync_cond *c, int all) {
+  if (!c->mutex || !c->waiters)
+    return 0;
+
+  if (all)
+    sceKernelSignalLwCondAll(&c->work);
+  else
+    sceKernelSignalLwCond(&c->work);
+  return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef __SYNC_H__
+#define __SYNC_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#ifndef SYNC_HOST
+#include <psp2/kernel/threadmgr.h>
+#include "config.h"
+#endif
+
+// lightweight mutexes and condvars behind the game's 4 byte pthread types,
+// taken from preallocated pools the first time a static initializer is used
+
+#define SYNC_MAX_MUTEXES 1024
+#define SYNC_MAX_CONDS 512
+
+// bionic static initializers
+#define SYNC_MUTEX_NORMAL 0x0000
+#define SYNC_MUTEX_RECURSIVE 0x4000
+#define SYNC_MUTEX_ERRORCHECK 0x8000
+
+// error codes go back to the game, so they are bionic's, not newlib's
+#define SYNC_EPERM 1
+#define SYNC_ENOMEM 12
+#define SYNC_EINVAL 22
+#define SYNC_EDEADLK 35
+#define SYNC_ETIMEDOUT 110
+
+typedef struct {
+  SceKernelLwMutexWork work; // the first word links free slots
+} sync_mutex;
+
+typedef struct {
+  SceKernelLwCondWork work;
+  sync_mutex *mutex; // an lwcond is bound to one mutex, set by the first wait
+  volatile int waiters;
+} sync_cond;
+
+sync_mutex *sync_mutex_create(volatile uintptr_t *word);
+int sync_mutex_init(volatile uintptr_t *word, int type);
+int sync_mutex_destroy(volatile uintptr_t *word);
+sync_cond *sync_cond_create(volatile uintptr_t *word);
+int sync_cond_destroy(volatile uintptr_t *word);
+int sync_cond_wait(sync_cond *c, sync_mutex *m, const struct timespec *abstime);
+int sync_cond_signal(sync_cond *c, int all);
+
+// anything above the static initializers is already a pooled object, so
+// this is the only check on the lock path
+static inline sync_mutex *sync_mutex_get(volatile uintptr_t *word) {
+  uintptr_t v = *word;
+  if (__builtin_expect(v > SYNC_MUTEX_ERRORCHECK, 1))
+    return (sync_mutex *)v;
+  return sync_mutex_create(word);
+}
+
+static inline sync_cond *sync_cond_get(volatile uintptr_t *word) {
+  uintptr_t v = *word;
+  if (__builtin_expect(v != 0, 1))
+    return (sync_cond *)v;
+  return sync_cond_create(word);
+}
+
+#endif
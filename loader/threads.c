@@ -0,0 +1,256 @@
+/* threads.c -- thread creation, core placement and cpu time per thread
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "threads.h"
+
+#ifdef THREAD_POLICY
+
+// THREADS_POLICY_PATH overrides the rules below, one per line:
+//   pattern cpu_mask priority stack_size
+// the first rule whose pattern is part of the thread's name wins, "*"
+// matches any. the name is the SDL one, the entry symbol for pthreads,
+// or "main" and "audio". 0 leaves a setting alone, and threads no rule
+// matches are left where the kernel puts them
+typedef struct {
+  char pattern[32];
+  int cpu_mask;
+  int priority;
+  int stack_size;
+} threads_rule;
+
+static threads_rule threads_rules[THREADS_MAX_RULES] = {
+  { "main", SCE_KERNEL_CPU_MASK_USER_0, 0, 0 },
+  { "audio", SCE_KERNEL_CPU_MASK_USER_1, 0x10000100 - 10, 0 },
+};
+static int num_threads_rules = 2;
+
+typedef struct {
+  volatile SceUID thid;
+  char name[32];
+  SceUInt64 last_clocks;
+} threads_entry;
+
+static threads_entry threads[THREADS_MAX];
+static volatile int num_threads = 0;
+static SceUInt64 threads_last_write = 0;
+static int threads_writing = 0;
+
+static so_module *threads_mod = NULL;
+
+typedef struct {
+  void *(*entry)(void *);
+  int (*sdl_entry)(void *);
+  void *arg;
+  const threads_rule *rule;
+  char name[32];
+} threads_start_info;
+
+static void threads_load_policy(void) {
+  FILE *f = fopen(THREADS_POLICY_PATH, "r");
+  if (!f)
+    return;
+
+  char line[128];
+  num_threads_rules = 0;
+  while (fgets(line, sizeof(line), f) && num_threads_rules < THREADS_MAX_RULES) {
+    threads_rule *rule = &threads_rules[num_threads_rules];
+    memset(rule, 0, sizeof(threads_rule));
+    if (line[0] == '#' || sscanf(line, "%31s %i %i %i", rule->pattern, &rule->cpu_mask, &rule->priority, &rule->stack_size) < 1)
+      continue;
+    num_threads_rules++;
+  }
+  fclose(f);
+
+  debugPrintf("threads: %d placement rules from %s\n", num_threads_rules, THREADS_POLICY_PATH);
+}
+
+static const threads_rule *threads_match(const char *name) {
+  for (int i = 0; i < num_threads_rules; i++) {
+    const char *pattern = threads_rules[i].pattern;
+    if (strcmp(pattern, "*") == 0 || (name && strstr(name, pattern)))
+      return &threads_rules[i];
+  }
+  return NULL;
+}
+
+static void threads_register(SceUID thid, const char *name) {
+  int i = __sync_fetch_and_add(&num_threads, 1);
+  if (i >= THREADS_MAX)
+    return;
+
+  strncpy(threads[i].name, name ? name : "?", sizeof(threads[i].name) - 1);
+  __sync_synchronize();
+  threads[i].thid = thid;
+}
+
+static void threads_apply(const threads_rule *rule, const char *name) {
+  SceUID thid = sceKernelGetThreadId();
+
+  if (rule && rule->cpu_mask)
+    sceKernelChangeThreadCpuAffinityMask(thid, rule->cpu_mask);
+  if (rule && rule->priority)
+    sceKernelChangeThreadPriority(thid, rule->priority);
+
+  debugPrintf("threads: %s (0x%08x) cpu mask 0x%x priority 0x%x\n", name ? name : "?", thid,
+              rule ? rule->cpu_mask : 0, rule ? rule->priority : 0);
+  threads_register(thid, name);
+}
+
+void threads_place_self(const char *name) {
+  threads_apply(threads_match(name), name);
+}
+
+static void *threads_entry_pthread(void *p) {
+  threads_start_info info = *(threads_start_info *)p;
+  free(p);
+  threads_apply(info.rule, info.name);
+  return info.entry(info.arg);
+}
+
+static int threads_entry_sdl(void *p) {
+  threads_start_info info = *(threads_start_info *)p;
+  free(p);
+  threads_apply(info.rule, info.name);
+  return info.sdl_entry(info.arg);
+}
+
+static threads_start_info *threads_new_info(const char *name, void *arg) {
+  threads_start_info *info = calloc(1, sizeof(threads_start_info));
+  if (!info)
+    return NULL;
+
+  strncpy(info->name, name ? name : "?", sizeof(info->name) - 1);
+  info->rule = threads_match(name);
+  info->arg = arg;
+  return info;
+}
+
+void threads_write_stats(void) {
+  char line[128];
+
+  if (__sync_lock_test_and_set(&threads_writing, 1) != 0)
+    return;
+
+  SceUInt64 now = sceKernelGetProcessTimeWide();
+  SceUInt64 elapsed = now - threads_last_write;
+  threads_last_write = now;
+
+  SceUID fd = sceIoOpen(THREADS_STATS_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (fd >= 0) {
+    int len = snprintf(line, sizeof(line), "%-32s %8s %4s %10s %12s %6s\n", "thread", "mask", "cpu", "priority", "cpu ms", "load");
+    sceIoWrite(fd, line, len);
+
+    int count = num_threads < THREADS_MAX ? num_threads : THREADS_MAX;
+    for (int i = 0; i < count; i++) {
+      threads_entry *t = &threads[i];
+      SceKernelThreadInfo info;
+      info.size = sizeof(info);
+      if (!t->thid || sceKernelGetThreadInfo(t->thid, &info) < 0) {
+        len = snprintf(line, sizeof(line), "%-32s exited, %llu ms\n", t->name, t->last_clocks / 1000);
+      } else {
+        // load since the previous report, in percent of one core
+        SceUInt64 delta = info.runClocks - t->last_clocks;
+        t->last_clocks = info.runClocks;
+        len = snprintf(line, sizeof(line), "%-32s %8x %4d %10x %12llu %5.1f%%\n", t->name,
+                       info.currentCpuAffinityMask, info.lastExecutedCpuId, info.currentPriority,
+                       info.runClocks / 1000, elapsed ? delta * 100.0f / elapsed : 0.0f);
+      }
+      if (len >= sizeof(line))
+        len = sizeof(line) - 1;
+      sceIoWrite(fd, line, len);
+    }
+    sceIoClose(fd);
+  }
+
+  __sync_lock_release(&threads_writing);
+}
+
+static int threads_stats_thread(SceSize args, void *argp) {
+  while (1) {
+    sceKernelDelayThread(THREADS_STATS_INTERVAL);
+    threads_write_stats();
+  }
+
+  return sceKernelExitDeleteThread(0);
+}
+
+int threads_start(so_module *mod) {
+  // entry symbols are looked up inside the game's pthread_create, the index
+  // has to exist before the first one so no caller waits on it or misses
+  if (so_index_symbols(mod) == 0)
+    threads_mod = mod;
+  threads_load_policy();
+  threads_last_write = sceKernelGetProcessTimeWide();
+
+  SceUID thid = sceKernelCreateThread("thread_stats", threads_stats_thread, 0x10000100 + 20, 0x4000, 0, 0, NULL);
+  if (thid < 0)
+    return thid;
+
+  sceKernelStartThread(thid, 0, NULL);
+  atexit(threads_write_stats);
+
+  return 0;
+}
+
+#endif
+
+// stack_size comes from the game's pthread_attr_t, a rule's stack size
+// takes precedence over it
+int threads_create(pthread_t *thread, size_t stack_size, void *(*entry)(void *), void *arg) {
+  pthread_attr_t attr;
+  int ret;
+
+  pthread_attr_init(&attr);
+  if (stack_size)
+    pthread_attr_setstacksize(&attr, stack_size);
+
+#ifdef THREAD_POLICY
+  const char *name = threads_mod ? so_addr_to_symbol(threads_mod, (uintptr_t)entry, NULL) : NULL;
+  threads_start_info *info = threads_new_info(name, arg);
+  if (info) {
+    info->entry = entry;
+    if (info->rule && info->rule->stack_size)
+      pthread_attr_setstacksize(&attr, info->rule->stack_size);
+    ret = pthread_create(thread, &attr, threads_entry_pthread, info);
+    if (ret != 0)
+      free(info);
+    pthread_attr_destroy(&attr);
+    return ret;
+  }
+#endif
+
+  ret = pthread_create(thread, &attr, entry, arg);
+  pthread_attr_destroy(&attr);
+  return ret;
+}
+
+SDL_Thread *threads_create_sdl(SDL_ThreadFunction fn, const char *name, void *data) {
+#ifdef THREAD_POLICY
+  threads_start_info *info = threads_new_info(name, data);
+  if (info) {
+    info->sdl_entry = fn;
+    SDL_Thread *thread;
+    if (info->rule && info->rule->stack_size)
+      thread = SDL_CreateThreadWithStackSize(threads_entry_sdl, name, info->rule->stack_size, info);
+    else
+      thread = SDL_CreateThread(threads_entry_sdl, name, info);
+    if (!thread)
+      free(info);
+    return thread;
+  }
+#endif
+
+  return SDL_CreateThread(fn, name, data);
+}
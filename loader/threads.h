@@ -0,0 +1,25 @@
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#include <pthread.h>
+#include <SDL2/SDL.h>
+#include "config.h"
+#include "so_util.h"
+
+#define THREADS_POLICY_PATH DATA_PATH "/" "threads.cfg"
+#define THREADS_STATS_PATH DATA_PATH "/" "thread_stats.txt"
+
+#define THREADS_MAX 64        // threads tracked for the cpu time report
+#define THREADS_MAX_RULES 16
+#define THREADS_STATS_INTERVAL 10000000 // us between writes of the report
+
+int threads_create(pthread_t *thread, size_t stack_size, void *(*entry)(void *), void *arg);
+SDL_Thread *threads_create_sdl(SDL_ThreadFunction fn, const char *name, void *data);
+
+#ifdef THREAD_POLICY
+int threads_start(so_module *mod);
+void threads_place_self(const char *name);
+void threads_write_stats(void);
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+/* trace.c -- chrome trace event recorder
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <psp2/io/fcntl.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "trace.h"
+
+#ifdef TRACE
+
+typedef struct {
+  const char *name;
+  SceUInt64 start;
+  uint32_t dur;
+  char arg[TRACE_ARG_SIZE];
+} trace_record;
+
+// each buffer is only ever written by its own thread, the flush reads
+// whatever has been published through head
+typedef struct {
+  volatile SceUID thid;
+  volatile uint32_t head;
+  trace_record *records;
+  const char *phase;
+  SceUInt64 phase_start;
+  char name[32];
+} trace_thread;
+
+static trace_thread trace_threads[TRACE_MAX_THREADS];
+static uint32_t trace_dropped = 0;
+static int trace_flushing = 0;
+
+static trace_thread *trace_get_thread(void) {
+  SceUID thid = sceKernelGetThreadId();
+  uint32_t h = (uint32_t)thid * 0x9e3779b1;
+
+  for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+    trace_thread *t = &trace_threads[(h + i) % TRACE_MAX_THREADS];
+    if (t->thid == thid)
+      return t->records ? t : NULL;
+    if (t->thid == 0 && __sync_bool_compare_and_swap(&t->thid, 0, thid)) {
+      SceKernelThreadInfo info;
+      info.size = sizeof(info);
+      if (sceKernelGetThreadInfo(thid, &info) >= 0)
+        strncpy(t->name, info.name, sizeof(t->name) - 1);
+      t->records = malloc(TRACE_MAX_EVENTS * sizeof(trace_record));
+      return t->records ? t : NULL;
+    }
+  }
+
+  return NULL;
+}
+
+void trace_event(const char *name, SceUInt64 start, const char *arg) {
+  SceUInt64 now = sceKernelGetProcessTimeWide();
+
+  trace_thread *t = trace_get_thread();
+  if (!t) {
+    __sync_fetch_and_add(&trace_dropped, 1);
+    return;
+  }
+
+  trace_record *r = &t->records[t->head % TRACE_MAX_EVENTS];
+  r->name = name;
+  r->start = start;
+  r->dur = now - start;
+  if (arg) {
+    // keep the tail, it's the interesting part of a path
+    size_t len = strlen(arg);
+    if (len >= TRACE_ARG_SIZE)
+      arg += len - (TRACE_ARG_SIZE - 1);
+    strncpy(r->arg, arg, TRACE_ARG_SIZE - 1);
+    r->arg[TRACE_ARG_SIZE - 1] = '\0';
+  } else {
+    r->arg[0] = '\0';
+  }
+
+  __sync_synchronize();
+  t->head++;
+}
+
+void trace_phase(const char *name) {
+  SceUInt64 now = sceKernelGetProcessTimeWide();
+
+  trace_thread *t = trace_get_thread();
+  if (!t)
+    return;
+
+  if (t->phase)
+    trace_event(t->phase, t->phase_start, NULL);
+
+  t->phase = name;
+  t->phase_start = now;
+}
+
+static char *trace_buf;
+static int trace_buf_len;
+static SceUID trace_fd;
+
+#define TRACE_BUF_SIZE (64 * 1024)
+
+static void trace_write(const char *fmt, ...) {
+  va_list list;
+
+  if (trace_buf_len > TRACE_BUF_SIZE - 512) {
+    sceIoWrite(trace_fd, trace_buf, trace_buf_len);
+    trace_buf_len = 0;
+  }
+
+  va_start(list, fmt);
+  int len = vsnprintf(trace_buf + trace_buf_len, TRACE_BUF_SIZE - trace_buf_len, fmt, list);
+  va_end(list);
+
+  if (len > 0)
+    trace_buf_len += len < TRACE_BUF_SIZE - trace_buf_len ? len : TRACE_BUF_SIZE - trace_buf_len - 1;
+}
+
+static void trace_write_string(const char *s) {
+  char escaped[TRACE_ARG_SIZE * 2];
+  int n = 0;
+
+  for (; *s && n < sizeof(escaped) - 2; s++) {
+    if (*s == '"' || *s == '\\')
+      escaped[n++] = '\\';
+    escaped[n++] = (*s >= 0x20) ? *s : '?';
+  }
+  escaped[n] = '\0';
+
+  trace_write("%s", escaped);
+}
+
+void trace_flush(void) {
+  if (__sync_lock_test_and_set(&trace_flushing, 1) != 0)
+    return;
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+
+  trace_buf = malloc(TRACE_BUF_SIZE);
+  trace_fd = sceIoOpen(TRACE_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+  if (!trace_buf || trace_fd < 0)
+    goto out;
+
+  trace_buf_len = 0;
+  trace_write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  int first = 1;
+  for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+    trace_thread *t = &trace_threads[i];
+    if (!t->records)
+      continue;
+
+    trace_write("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"",
+                first ? "" : ",\n", t->thid);
+    trace_write_string(t->name);
+    trace_write("\"}}");
+    first = 0;
+
+    uint32_t head = t->head;
+    __sync_synchronize();
+    uint32_t tail = head > TRACE_MAX_EVENTS ? head - TRACE_MAX_EVENTS : 0;
+
+    for (uint32_t j = tail; j < head; j++) {
+      trace_record *r = &t->records[j % TRACE_MAX_EVENTS];
+      trace_write(",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%u",
+                  r->name, t->thid, r->start, r->dur);
+      if (r->arg[0]) {
+        trace_write(",\"args\":{\"arg\":\"");
+        trace_write_string(r->arg);
+        trace_write("\"}");
+      }
+      trace_write("}");
+    }
+  }
+
+  trace_write("\n]}\n");
+  sceIoWrite(trace_fd, trace_buf, trace_buf_len);
+
+  debugPrintf("trace: written in %llu us, %u events dropped\n", sceKernelGetProcessTimeWide() - start, trace_dropped);
+
+out:
+  if (trace_fd >= 0)
+    sceIoClose(trace_fd);
+  free(trace_buf);
+  trace_buf = NULL;
+  __sync_lock_release(&trace_flushing);
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <psp2/kernel/processmgr.h>
+#include "config.h"
+
+#define TRACE_PATH DATA_PATH "/" "trace.json"
+
+#define TRACE_MAX_THREADS 64
+#define TRACE_MAX_EVENTS 4096 // per thread, the oldest are overwritten
+#define TRACE_ARG_SIZE 24
+
+#ifdef TRACE
+
+typedef struct {
+  const char *name;
+  SceUInt64 start;
+  const char *arg;
+} trace_scope;
+
+void trace_event(const char *name, SceUInt64 start, const char *arg);
+void trace_phase(const char *name);
+void trace_flush(void);
+
+static inline void trace_scope_end(trace_scope *scope) {
+  trace_event(scope->name, scope->start, scope->arg);
+}
+
+// records a complete event from here to the end of the enclosing block,
+// name must be a string literal
+#define TRACE_SCOPE(name) \
+  trace_scope _trace_scope __attribute__((cleanup(trace_scope_end))) = { name, sceKernelGetProcessTimeWide(), NULL }
+
+// same, with a string argument that must still be valid at the end
+#define TRACE_SCOPE_ARG(name, arg) \
+  trace_scope _trace_scope __attribute__((cleanup(trace_scope_end))) = { name, sceKernelGetProcessTimeWide(), arg }
+
+#define TRACE_PHASE(name) trace_phase(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+#define TRACE_PHASE(name)
+
+#endif
+
+#endif
@@ -0,0 +1,384 @@
+/* detourtest.c -- host checks for the prologue relocation in so_util.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Host tool, build with: cc -O2 -o detourtest tools/detourtest.c
+ * Usage: detourtest
+ *
+ * Feeds hand assembled Thumb and ARM prologues to so_relocate_thumb and
+ * so_relocate_arm and decodes the trampolines they build: plain
+ * instructions have to be copied as they are, PC relative loads, ADR and
+ * BL/BLX have to come out as loads from the literal pool with the
+ * original values, and branches and other PC reads have to be refused.
+ * The code sits below 4 GiB so its addresses fit the 32-bit literals.
+ * Exits non-zero when a check fails.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SO_HOST
+
+// SceIoStat has its own
+#undef st_mtime
+
+typedef int SceUID;
+typedef unsigned int SceSize;
+typedef uint32_t SceUInt32;
+typedef unsigned long long SceUInt64;
+typedef int SceKernelMemBlockType;
+
+typedef struct {
+  time_t t;
+} SceDateTime;
+
+typedef struct {
+  SceSize st_size;
+  SceDateTime st_mtime;
+} SceIoStat;
+
+typedef struct {
+  SceSize size;
+  SceUInt32 field_4;
+  SceUInt32 attr;
+  SceUInt32 field_C;
+} SceKernelAllocMemBlockKernelOpt;
+
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RW 0x0c20d060
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX 0x0c20d050
+#define SCE_KERNEL_CPU_MASK_USER_0 0x10000
+
+#define SCE_O_RDONLY O_RDONLY
+#define SCE_O_WRONLY O_WRONLY
+#define SCE_O_CREAT O_CREAT
+#define SCE_O_TRUNC O_TRUNC
+#define SCE_SEEK_SET SEEK_SET
+#define SCE_SEEK_END SEEK_END
+
+// none of these are reached by the relocation, they only let so_util.c link
+
+static int debugPrintf(const char *fmt, ...) {
+  return 0;
+}
+
+static void fatal_error(const char *fmt, ...) {
+  va_list list;
+  va_start(list, fmt);
+  vfprintf(stderr, fmt, list);
+  va_end(list);
+  exit(1);
+}
+
+static SceUInt64 sceKernelGetProcessTimeWide(void) {
+  return 0;
+}
+
+static SceUID sceIoOpen(const char *path, int flags, int mode) {
+  return -1;
+}
+
+static int sceIoRead(SceUID fd, void *data, SceSize size) {
+  return -1;
+}
+
+static int sceIoWrite(SceUID fd, const void *data, SceSize size) {
+  return -1;
+}
+
+static long long sceIoLseek(SceUID fd, long long offset, int whence) {
+  return -1;
+}
+
+static int sceIoClose(SceUID fd) {
+  return -1;
+}
+
+static int sceIoRemove(const char *path) {
+  return -1;
+}
+
+static int sceIoGetstat(const char *path, SceIoStat *out) {
+  return -1;
+}
+
+static SceUID kuKernelAllocMemBlock(const char *name, SceKernelMemBlockType type, SceSize size, SceKernelAllocMemBlockKernelOpt *opt) {
+  return -1;
+}
+
+static int sceKernelGetMemBlockBase(SceUID uid, void **base) {
+  return -1;
+}
+
+static int sceKernelFreeMemBlock(SceUID uid) {
+  return -1;
+}
+
+// out of line, the lazy staging buffer it is passed is NULL when unused
+__attribute__((noinline)) static int kuKernelCpuUnrestrictedMemcpy(void *dst, const void *src, SceSize len) {
+  memcpy(dst, src, len);
+  return 0;
+}
+
+static int kuKernelFlushCaches(const void *ptr, SceSize len) {
+  return 0;
+}
+
+static SceUID sceKernelCreateThread(const char *name, int (*entry)(SceSize, void *), int prio, SceSize stack, SceUInt32 attr, int affinity, void *opt) {
+  return -1;
+}
+
+static int sceKernelStartThread(SceUID thid, SceSize args, void *argp) {
+  return -1;
+}
+
+static int sceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt32 *timeout) {
+  return -1;
+}
+
+static int sceKernelDeleteThread(SceUID thid) {
+  return -1;
+}
+
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+
+#include "../loader/so_util.c"
+
+#define CODE_BASE 0x81000000
+
+static int failures = 0;
+
+#define CHECK(cond, ...)              \
+  do {                                \
+    if (!(cond)) {                    \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__);            \
+      printf("\n");                   \
+      failures++;                     \
+    }                                 \
+  } while (0)
+
+static uint8_t *code;
+
+// places halfwords or words at CODE_BASE + at
+static void put16(uint32_t at, const uint16_t *hw, int n) {
+  memcpy(code + at, hw, n * sizeof(uint16_t));
+}
+
+static void put32(uint32_t at, const uint32_t *w, int n) {
+  memcpy(code + at, w, n * sizeof(uint32_t));
+}
+
+// relocates and finishes a trampoline like so_detour_create, without the
+// jump back
+static int relocate(so_trampoline *t, uint32_t at, uint32_t size, int thumb) {
+  memset(t, 0, sizeof(so_trampoline));
+  int copied = thumb ? so_relocate_thumb(t, CODE_BASE + at, size) : so_relocate_arm(t, CODE_BASE + at, size);
+  if (copied >= 0 && so_tramp_finish(t, thumb) < 0)
+    return -2;
+  return copied;
+}
+
+static uint16_t tramp16(so_trampoline *t, uint32_t at) {
+  return *(uint16_t *)((uint8_t *)t->code + at);
+}
+
+// the register and value an LDR.W Rt, [PC, #imm] in the trampoline loads
+static int thumb_load(so_trampoline *t, uint32_t at, int *reg, uint32_t *value) {
+  uint16_t hw1 = tramp16(t, at), hw2 = tramp16(t, at + 2);
+  if (hw1 != 0xf8df)
+    return -1;
+  uint32_t literal = ((at + 4) & ~3) + (hw2 & 0xfff);
+  if (literal + 4 > t->size)
+    return -1;
+  *reg = hw2 >> 12;
+  *value = t->code[literal / 4];
+  return 0;
+}
+
+// the same for an ARM LDR Rt, [PC, #imm]
+static int arm_load(so_trampoline *t, uint32_t at, int *reg, uint32_t *value) {
+  uint32_t ins = t->code[at / 4];
+  if ((ins & 0xffff0000) != 0xe59f0000)
+    return -1;
+  uint32_t literal = at + 8 + (ins & 0xfff);
+  if (literal + 4 > t->size)
+    return -1;
+  *reg = (ins >> 12) & 0xf;
+  *value = t->code[literal / 4];
+  return 0;
+}
+
+static void test_thumb_copy(void) {
+  so_trampoline t;
+
+  // PUSH {R4, LR}; MOV R4, R0; SUB.W SP, SP, #8; MOVS R0, #1
+  static const uint16_t plain[] = { 0xb510, 0x4604, 0xf1ad, 0x0d08, 0x2001 };
+  put16(0x100, plain, 5);
+  CHECK(relocate(&t, 0x100, 8, 1) == 8, "thumb plain: copied %d", relocate(&t, 0x100, 8, 1));
+  CHECK(memcmp(t.code, plain, 8) == 0 && t.num_literals == 0, "thumb plain: code changed");
+
+  // a 32-bit instruction across the end of the hook is copied whole
+  static const uint16_t straddle[] = { 0xb510, 0x4604, 0x2001, 0xf1ad, 0x0d08 };
+  put16(0x140, straddle, 5);
+  CHECK(relocate(&t, 0x140, 8, 1) == 10, "thumb straddle: copied %d", relocate(&t, 0x140, 8, 1));
+  CHECK(memcmp(t.code, straddle, 10) == 0, "thumb straddle: code changed");
+}
+
+static void test_thumb_rewrites(void) {
+  so_trampoline t;
+  int reg;
+  uint32_t value;
+
+  // LDR R3, [PC, #8] at 0x200 reads the word at ((0x204) & ~3) + 8
+  static const uint16_t ldr[] = { 0x4b02, 0xbf00, 0xbf00, 0xbf00 };
+  put16(0x200, ldr, 4);
+  *(uint32_t *)(code + 0x20c) = 0xdeadbeef;
+  CHECK(relocate(&t, 0x200, 8, 1) == 8, "thumb ldr: refused");
+  CHECK(thumb_load(&t, 0, &reg, &value) == 0 && reg == 3 && value == 0xdeadbeef,
+        "thumb ldr: loads r%d = %08x", reg, value);
+
+  // the same from a halfword aligned PC, which is rounded down
+  static const uint16_t ldr2[] = { 0x4a01, 0xbf00, 0xbf00, 0xbf00 };
+  put16(0x222, ldr2, 4);
+  *(uint32_t *)(code + 0x228) = 0x12345678;
+  CHECK(relocate(&t, 0x222, 8, 1) == 8, "thumb ldr unaligned: refused");
+  CHECK(thumb_load(&t, 0, &reg, &value) == 0 && reg == 2 && value == 0x12345678,
+        "thumb ldr unaligned: loads r%d = %08x", reg, value);
+
+  // ADR R1, label loads the address itself
+  static const uint16_t adr[] = { 0xa104, 0xbf00, 0xbf00, 0xbf00 };
+  put16(0x240, adr, 4);
+  CHECK(relocate(&t, 0x240, 8, 1) == 8, "thumb adr: refused");
+  CHECK(thumb_load(&t, 0, &reg, &value) == 0 && reg == 1 && value == CODE_BASE + 0x244 + 16,
+        "thumb adr: loads r%d = %08x", reg, value);
+
+  // LDR.W R5, [PC, #-4] and ADR.W R6, label - 0x10
+  static const uint16_t wide[] = { 0xf85f, 0x5004, 0xf2af, 0x0610 };
+  put16(0x280, wide, 4);
+  *(uint32_t *)(code + 0x280) = 0xf85f | 0x5004 << 16; // the literal is the instruction itself
+  CHECK(relocate(&t, 0x280, 8, 1) == 8, "thumb wide: refused");
+  CHECK(thumb_load(&t, 0, &reg, &value) == 0 && reg == 5 && value == (0xf85f | 0x5004 << 16),
+        "thumb ldr.w: loads r%d = %08x", reg, value);
+  CHECK(thumb_load(&t, 4, &reg, &value) == 0 && reg == 6 && value == CODE_BASE + 0x288 - 0x10,
+        "thumb adr.w: loads r%d = %08x", reg, value);
+
+  // BL +0x100 and BLX -0x1000, both through IP with the right mode bit
+  static const uint16_t calls[] = { 0xf000, 0xf880, 0xf7ff, 0xe800 };
+  put16(0x300, calls, 4);
+  CHECK(relocate(&t, 0x300, 8, 1) == 8, "thumb bl: refused");
+  CHECK(thumb_load(&t, 0, &reg, &value) == 0 && reg == 12 && value == ((CODE_BASE + 0x304 + 0x100) | 1),
+        "thumb bl: loads r%d = %08x", reg, value);
+  CHECK(tramp16(&t, 4) == 0x47e0, "thumb bl: %04x instead of BLX IP", tramp16(&t, 4));
+  CHECK(thumb_load(&t, 6, &reg, &value) == 0 && reg == 12 && value == CODE_BASE + 0x308 - 0x1000,
+        "thumb blx: loads r%d = %08x", reg, value);
+  CHECK(tramp16(&t, 10) == 0x47e0, "thumb blx: %04x instead of BLX IP", tramp16(&t, 10));
+}
+
+static void test_thumb_refused(void) {
+  so_trampoline t;
+  static const struct {
+    const char *name;
+    uint16_t hw[2];
+  } refused[] = {
+    { "B.N", { 0xe7fe, 0xbf00 } },
+    { "BEQ.N", { 0xd0fe, 0xbf00 } },
+    { "CBZ", { 0xb100, 0xbf00 } },
+    { "IT EQ", { 0xbf08, 0xbf00 } },
+    { "MOV R0, PC", { 0x4678, 0xbf00 } },
+    { "ADD R0, PC", { 0x4478, 0xbf00 } },
+    { "B.W", { 0xf000, 0xb800 } },
+    { "LDRB.W R0, [PC]", { 0xf81f, 0x0000 } },
+    { "TBB [R0, R1]", { 0xe8d0, 0xf001 } },
+  };
+
+  for (int i = 0; i < (int)(sizeof(refused) / sizeof(refused[0])); i++) {
+    static const uint16_t pad[] = { 0xbf00, 0xbf00 };
+    put16(0x400, refused[i].hw, 2);
+    put16(0x404, pad, 2);
+    CHECK(relocate(&t, 0x400, 8, 1) == -1, "thumb %s: relocated", refused[i].name);
+  }
+}
+
+static void test_arm(void) {
+  so_trampoline t;
+  int reg;
+  uint32_t value;
+
+  // PUSH {R4, LR}; MOV R4, R0
+  static const uint32_t plain[] = { 0xe92d4010, 0xe1a04000 };
+  put32(0x500, plain, 2);
+  CHECK(relocate(&t, 0x500, 8, 0) == 8 && memcmp(t.code, plain, 8) == 0, "arm plain: code changed");
+
+  // LDR R0, [PC, #4] reads pc + 12; LDR R1, [PC, #-12] reads pc - 4
+  static const uint32_t ldr[] = { 0xe59f0004, 0xe51f100c };
+  put32(0x540, ldr, 2);
+  *(uint32_t *)(code + 0x54c) = 0xcafef00d;
+  *(uint32_t *)(code + 0x540) = 0xe59f0004;
+  CHECK(relocate(&t, 0x540, 8, 0) == 8, "arm ldr: refused");
+  CHECK(arm_load(&t, 0, &reg, &value) == 0 && reg == 0 && value == 0xcafef00d, "arm ldr: loads r%d = %08x", reg, value);
+  CHECK(arm_load(&t, 4, &reg, &value) == 0 && reg == 1 && value == 0xe59f0004, "arm ldr -: loads r%d = %08x", reg, value);
+
+  // ADR R2, pc + 0x400 (rotated immediate) and ADR R3, pc - 8
+  static const uint32_t adr[] = { 0xe28f2b01, 0xe24f3008 };
+  put32(0x580, adr, 2);
+  CHECK(relocate(&t, 0x580, 8, 0) == 8, "arm adr: refused");
+  CHECK(arm_load(&t, 0, &reg, &value) == 0 && reg == 2 && value == CODE_BASE + 0x588 + 0x400,
+        "arm adr: loads r%d = %08x", reg, value);
+  CHECK(arm_load(&t, 4, &reg, &value) == 0 && reg == 3 && value == CODE_BASE + 0x58c - 8,
+        "arm adr -: loads r%d = %08x", reg, value);
+
+  // BL -8 and BLX +0x22 (H set) return behind the target word
+  static const uint32_t calls[] = { 0xebfffffc, 0xfb000007 };
+  put32(0x600, calls, 2);
+  CHECK(relocate(&t, 0x600, 8, 0) == 8, "arm bl: refused");
+  CHECK(t.code[0] == 0xe28fe004 && t.code[1] == 0xe51ff004 && t.code[2] == CODE_BASE + 0x608 - 0x10,
+        "arm bl: %08x %08x %08x", t.code[0], t.code[1], t.code[2]);
+  CHECK(t.code[3] == 0xe28fe004 && t.code[4] == 0xe51ff004 && t.code[5] == ((CODE_BASE + 0x60c + 0x1e) | 3),
+        "arm blx: %08x %08x %08x", t.code[3], t.code[4], t.code[5]);
+
+  static const struct {
+    const char *name;
+    uint32_t ins;
+  } refused[] = {
+    { "B", 0xeafffffe },
+    { "BNE", 0x1afffffe },
+    { "ADD R0, PC, R1", 0xe08f0001 },
+    { "LDR R0, [PC, R1]", 0xe79f0001 },
+    { "MOV R0, PC", 0xe1a0000f },
+    { "ADD R0, R1, PC", 0xe081000f },
+  };
+
+  for (int i = 0; i < (int)(sizeof(refused) / sizeof(refused[0])); i++) {
+    static const uint32_t pad = 0xe320f000; // NOP
+    put32(0x700, &refused[i].ins, 1);
+    put32(0x704, &pad, 1);
+    CHECK(relocate(&t, 0x700, 8, 0) == -1, "arm %s: relocated", refused[i].name);
+  }
+}
+
+int main(void) {
+  code = mmap((void *)CODE_BASE, 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (code == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  test_thumb_copy();
+  test_thumb_rewrites();
+  test_thumb_refused();
+  test_arm();
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures != 0;
+}
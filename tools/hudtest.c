@@ -0,0 +1,169 @@
+/* hudtest.c -- host checks for the overlay numbers in hud_stats.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Host tool, build with: cc -O2 -o hudtest tools/hudtest.c
+ * Usage: hudtest
+ *
+ * Drives loader/hud_stats.c the way hud.c does, with a null renderer:
+ * synthetic frame times, idle thread times and draw counts go in and the
+ * refreshed numbers and overlay text are checked. Exits non-zero when a
+ * check fails, and times the per-frame part against the 0.3 ms budget.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../loader/hud_stats.c"
+
+#define FRAME_US 16667
+
+static int failures = 0;
+
+#define CHECK(cond, ...)              \
+  do {                                \
+    if (!(cond)) {                    \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__);            \
+      printf("\n");                   \
+      failures++;                     \
+    }                                 \
+  } while (0)
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// one second of 60 fps with a single slow frame in the second window
+static void test_windows(void) {
+  hud_stats s;
+  memset(&s, 0, sizeof(s));
+
+  uint64_t now = 1000000;
+  uint64_t idle[HUD_NUM_CORES] = { 0, 0, 0 };
+  hud_stats_update(&s, now, idle, 0, 0, 0);
+  hud_stats_frame(&s, now);
+
+  int updates = 0, frames = 0;
+  for (int frame = 1; frame <= 60; frame++) {
+    now += frame == 20 ? 50000 : FRAME_US;
+    frames++;
+
+    // the game draws frame + 1 times and binds frame textures
+    for (int i = 0; i <= frame; i++)
+      __sync_fetch_and_add(&s.draws, 1);
+    __sync_fetch_and_add(&s.textures, frame);
+    hud_stats_frame(&s, now);
+    CHECK(s.frame_draws == (uint32_t)frame + 1 && s.frame_textures == (uint32_t)frame && s.draws == 0 && s.textures == 0,
+          "frame %d counted %u draws %u textures", frame, s.frame_draws, s.frame_textures);
+
+    if (!hud_stats_update_due(&s, now))
+      continue;
+
+    // core 0 idles a quarter of the time, core 1 never, core 2 reports more
+    // idle time than elapsed, as a coarse idle clock can
+    uint64_t elapsed = now - s.last_update;
+    idle[0] += (elapsed + 3) / 4;
+    idle[2] += elapsed + 1000;
+    hud_stats_update(&s, now, idle, 12 << 20, 64 << 20, 40 << 20);
+    updates++;
+
+    double fps = frames * 1e6 / elapsed;
+    CHECK(s.fps_x10 >= (uint32_t)(fps * 10) - 1 && s.fps_x10 <= (uint32_t)(fps * 10), "window %d fps %u.%u, expected %.2f",
+          updates, s.fps_x10 / 10, s.fps_x10 % 10, fps);
+    frames = 0;
+    CHECK(s.cpu_load[0] == 75 && s.cpu_load[1] == 100 && s.cpu_load[2] == 0,
+          "window %d cpu %d %d %d", updates, s.cpu_load[0], s.cpu_load[1], s.cpu_load[2]);
+
+    // the slow frame only shows in the window it ended in
+    uint32_t expect = updates == 2 ? 50000 : FRAME_US;
+    CHECK(s.max_frame_us == expect, "window %d max %u us, expected %u", updates, s.max_frame_us, expect);
+  }
+  CHECK(updates == 4, "%d refreshes in a second", updates);
+}
+
+// the graph is a ring of the last HUD_GRAPH_FRAMES frame times
+static void test_graph(void) {
+  hud_stats s;
+  memset(&s, 0, sizeof(s));
+
+  uint64_t now = 1;
+  hud_stats_frame(&s, now);
+  for (int frame = 1; frame <= HUD_GRAPH_FRAMES + 40; frame++) {
+    now += frame;
+    hud_stats_frame(&s, now);
+  }
+
+  CHECK(s.frame_pos == 40 % HUD_GRAPH_FRAMES, "graph position %d", s.frame_pos);
+  int newest = (s.frame_pos + HUD_GRAPH_FRAMES - 1) % HUD_GRAPH_FRAMES;
+  CHECK(s.frame_us[newest] == HUD_GRAPH_FRAMES + 40, "newest frame %u us", s.frame_us[newest]);
+  CHECK(s.frame_us[s.frame_pos] == 41, "oldest frame %u us", s.frame_us[s.frame_pos]);
+}
+
+static void test_format(void) {
+  hud_stats s;
+  memset(&s, 0, sizeof(s));
+  s.fps_x10 = 599;
+  s.max_frame_us = 50123;
+  s.hud_us = 215;
+  s.cpu_load[0] = 75;
+  s.cpu_load[1] = 100;
+  s.cpu_load[2] = 0;
+  s.heap_used = 12 << 20;
+  s.heap_total = 64 << 20;
+  s.gpu_free = 40 << 20;
+  s.frame_draws = 61;
+  s.frame_textures = 60;
+
+  char buf[256];
+  int len = hud_stats_format(&s, buf, sizeof(buf));
+  const char *expect = "FPS 59.9 MAX 50.1MS HUD 0.21MS\n"
+                       "CPU 75% 100% 0%\n"
+                       "HEAP 12/64MB VGL FREE 40MB\n"
+                       "DRAW 61 TEX 60";
+  CHECK(len == (int)strlen(expect) && strcmp(buf, expect) == 0, "overlay text:\n%s", buf);
+
+  // a short buffer is cut, not overrun
+  char small[8];
+  memset(small, 'x', sizeof(small));
+  hud_stats_format(&s, small, 4);
+  CHECK(strcmp(small, "FPS") == 0 && small[4] == 'x', "short buffer holds \"%.4s\"", small);
+}
+
+// what hud.c adds to every frame, the text is only formatted on refreshes
+static void bench_frame(void) {
+  static hud_stats s;
+  uint64_t idle[HUD_NUM_CORES] = { 0, 0, 0 };
+  char buf[256];
+  int frames = 1000000;
+
+  double start = now_us();
+  uint64_t now = 1;
+  for (int i = 0; i < frames; i++) {
+    now += FRAME_US;
+    __sync_fetch_and_add(&s.draws, 1);
+    hud_stats_frame(&s, now);
+    if (hud_stats_update_due(&s, now)) {
+      hud_stats_update(&s, now, idle, 0, 0, 0);
+      hud_stats_format(&s, buf, sizeof(buf));
+    }
+  }
+  double elapsed = (now_us() - start) / frames;
+
+  printf("stats    %8.1f ns/frame, budget 300000 ns with drawing\n", elapsed * 1000);
+}
+
+int main(void) {
+  test_windows();
+  test_graph();
+  test_format();
+  bench_frame();
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures != 0;
+}
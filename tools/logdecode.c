@@ -0,0 +1,262 @@
+/* logdecode.c -- renders a BINARY_LOG homm3_log.bin as text
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Host tool, build with: cc -O2 -o logdecode tools/logdecode.c
+ * Usage: logdecode libhomm3.so homm3_log.bin > homm3_log.txt
+ */
+
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../loader/logger.h"
+
+static uint8_t *so_data;
+static size_t so_size;
+
+static uint32_t module_base = 0;
+static uint32_t module_size = 0;
+
+static uint8_t *read_file(const char *path, size_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t *data = malloc(*size + 1);
+  if (data && fread(data, 1, *size, f) != *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(f);
+
+  return data;
+}
+
+// maps an address from the log back to the string in the .so file
+static const char *so_string(uint32_t addr) {
+  if (addr < module_base || addr >= module_base + module_size)
+    return NULL;
+
+  uint32_t vaddr = addr - module_base;
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *)so_data;
+  Elf32_Phdr *phdr = (Elf32_Phdr *)(so_data + ehdr->e_phoff);
+
+  for (int i = 0; i < ehdr->e_phnum; i++) {
+    if (phdr[i].p_type == PT_LOAD && vaddr >= phdr[i].p_vaddr && vaddr < phdr[i].p_vaddr + phdr[i].p_filesz) {
+      uint32_t offset = phdr[i].p_offset + vaddr - phdr[i].p_vaddr;
+      if (offset < so_size && memchr(so_data + offset, '\0', so_size - offset))
+        return (const char *)so_data + offset;
+    }
+  }
+
+  return NULL;
+}
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+} reader;
+
+static int get(reader *r, void *dst, size_t len) {
+  if ((size_t)(r->end - r->p) < len)
+    return -1;
+  memcpy(dst, r->p, len);
+  r->p += len;
+  return 0;
+}
+
+static int get_string(reader *r, char *dst, size_t size) {
+  uint8_t kind;
+  if (get(r, &kind, 1) < 0)
+    return -1;
+
+  if (kind == LOG_BIN_STR_MODULE) {
+    uint32_t addr;
+    if (get(r, &addr, 4) < 0)
+      return -1;
+    const char *s = so_string(addr);
+    if (s)
+      snprintf(dst, size, "%s", s);
+    else
+      snprintf(dst, size, "<0x%08x>", addr);
+    return 0;
+  }
+
+  uint16_t len;
+  if (get(r, &len, 2) < 0 || r->end - r->p < len)
+    return -1;
+  snprintf(dst, size, "%.*s", len, (const char *)r->p);
+  r->p += len;
+  return 0;
+}
+
+// mirrors the conversion walk in logger_vlog_binary
+static void decode_android(reader *r, FILE *out) {
+  char tag[LOG_LINE_SIZE], fmt[LOG_LINE_SIZE], arg[LOG_LINE_SIZE];
+  uint8_t prio;
+
+  if (get(r, &prio, 1) < 0 || get_string(r, tag, sizeof(tag)) < 0 || get_string(r, fmt, sizeof(fmt)) < 0)
+    return;
+
+  fprintf(out, "[LOG] %s: ", tag);
+
+  for (const char *p = fmt; *p; p++) {
+    if (*p != '%') {
+      fputc(*p, out);
+      continue;
+    }
+
+    char spec[64];
+    int n = 0;
+    spec[n++] = *p++;
+
+    while (*p && strchr("-+ #0'", *p) && n < 16)
+      spec[n++] = *p++;
+    for (int i = 0; i < 2; i++) {
+      if (*p == '*') {
+        int32_t v;
+        if (get(r, &v, 4) < 0)
+          goto truncated;
+        n += snprintf(spec + n, sizeof(spec) - n, "%d", v);
+        p++;
+      } else {
+        while (*p >= '0' && *p <= '9' && n < 48)
+          spec[n++] = *p++;
+      }
+      if (i == 1 || *p != '.')
+        break;
+      spec[n++] = *p++;
+    }
+
+    int wide = 0;
+    while (*p && strchr("hlLqjzt", *p)) {
+      if (*p == 'q' || *p == 'j' || *p == 'L' || (*p == 'l' && p[1] == 'l'))
+        wide = 1;
+      p += (*p == 'l' && p[1] == 'l') ? 2 : 1;
+    }
+
+    if (*p == '\0')
+      break;
+
+    switch (*p) {
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        if (wide) {
+          int64_t v;
+          if (get(r, &v, 8) < 0)
+            goto truncated;
+          spec[n++] = 'l';
+          spec[n++] = 'l';
+          spec[n++] = *p;
+          spec[n] = '\0';
+          fprintf(out, spec, (long long)v);
+        } else {
+          int32_t v;
+          if (get(r, &v, 4) < 0)
+            goto truncated;
+          spec[n++] = *p;
+          spec[n] = '\0';
+          fprintf(out, spec, v);
+        }
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      {
+        double v;
+        if (get(r, &v, 8) < 0)
+          goto truncated;
+        spec[n++] = *p;
+        spec[n] = '\0';
+        fprintf(out, spec, v);
+        break;
+      }
+      case 's':
+        if (get_string(r, arg, sizeof(arg)) < 0)
+          goto truncated;
+        spec[n++] = 's';
+        spec[n] = '\0';
+        fprintf(out, spec, arg);
+        break;
+      case 'p':
+      {
+        uint32_t v;
+        if (get(r, &v, 4) < 0)
+          goto truncated;
+        fprintf(out, "0x%x", v);
+        break;
+      }
+      case 'n':
+        break;
+      case '%':
+        fputc('%', out);
+        break;
+      default:
+        fputc('%', out);
+        fputc(*p, out);
+        break;
+    }
+  }
+
+  fputc('\n', out);
+  return;
+
+truncated:
+  fprintf(out, "<truncated>\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s libhomm3.so homm3_log.bin\n", argv[0]);
+    return 1;
+  }
+
+  so_data = read_file(argv[1], &so_size);
+  if (!so_data || so_size < sizeof(Elf32_Ehdr) || memcmp(so_data, ELFMAG, SELFMAG) != 0) {
+    fprintf(stderr, "could not read %s\n", argv[1]);
+    return 1;
+  }
+
+  size_t log_size;
+  uint8_t *log_data = read_file(argv[2], &log_size);
+  if (!log_data) {
+    fprintf(stderr, "could not read %s\n", argv[2]);
+    return 1;
+  }
+
+  size_t pos = 0;
+  while (pos + 2 < log_size) {
+    uint16_t len = log_data[pos] | (log_data[pos + 1] << 8);
+    pos += 2;
+    if (len == 0 || pos + len > log_size)
+      break;
+
+    reader r = { log_data + pos + 1, log_data + pos + len };
+    switch (log_data[pos]) {
+      case LOG_BIN_TEXT:
+        fwrite(r.p, 1, r.end - r.p, stdout);
+        break;
+      case LOG_BIN_ANDROID:
+        decode_android(&r, stdout);
+        break;
+      case LOG_BIN_SESSION:
+        get(&r, &module_base, 4);
+        get(&r, &module_size, 4);
+        break;
+      default:
+        break;
+    }
+
+    pos += len;
+  }
+
+  free(log_data);
+  free(so_data);
+
+  return 0;
+}
@@ -0,0 +1,246 @@
+/* replaytest.c -- host checks for the input recording format in replay.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Host tool, build with: cc -O2 -o replaytest tools/replaytest.c
+ * Usage: replaytest
+ *
+ * Records a scripted session through loader/replay.c into a temporary
+ * file and plays it back with different live values: every recorded value
+ * and event has to come back in order, and a mismatched call, the end of
+ * the stream, a cut-off file and a foreign header have to drop back to
+ * live input. Exits non-zero when a check fails.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../loader/replay.c"
+
+// the size of an SDL_Event, the stream only stores raw bytes
+typedef struct {
+  uint32_t type;
+  uint32_t timestamp;
+  int32_t data[12];
+} test_event;
+
+enum {
+  STEP_VALUE,
+  STEP_EVENTS,
+  STEP_COUNT, // NULL events, only the count
+};
+
+typedef struct {
+  int step;
+  int kind;       // or the number of events
+  uint32_t value; // or the number played back into the buffer
+} test_step;
+
+// deltas both ways, wrap arounds and both ends of the range
+static const test_step script[] = {
+  { STEP_VALUE, REPLAY_TICKS, 0 },
+  { STEP_VALUE, REPLAY_TIME, 1700000000 },
+  { STEP_VALUE, REPLAY_TICKS, 16 },
+  { STEP_EVENTS, 3, 3 },
+  { STEP_VALUE, REPLAY_RAND, 0x7fffffff },
+  { STEP_VALUE, REPLAY_RAND, 0 },
+  { STEP_VALUE, REPLAY_RAND, 0xffffffff },
+  { STEP_VALUE, REPLAY_RAND, 0x80000000 },
+  { STEP_VALUE, REPLAY_RAND, 1 },
+  { STEP_COUNT, 5, 0 },
+  { STEP_VALUE, REPLAY_MOUSE_X, 480 },
+  { STEP_VALUE, REPLAY_MOUSE_Y, 272 },
+  { STEP_VALUE, REPLAY_MOUSE_X, 12 },
+  { STEP_VALUE, REPLAY_MOUSE_BUTTONS, 1 },
+  { STEP_EVENTS, 0, 0 },
+  { STEP_VALUE, REPLAY_TICKS, 5 }, // ticks going backwards
+  { STEP_EVENTS, 4, 2 },           // played back into a buffer of two
+  { STEP_VALUE, REPLAY_MOD_STATE, 0x40 },
+  { STEP_EVENTS, 1, 1 },
+  { STEP_VALUE, REPLAY_TICKS, 0xfffffff0 },
+  { STEP_VALUE, REPLAY_TICKS, 0x10 }, // wraps
+};
+
+#define NUM_STEPS (sizeof(script) / sizeof(script[0]))
+
+static int failures = 0;
+static char path[32];
+
+#define CHECK(cond, ...)              \
+  do {                                \
+    if (!(cond)) {                    \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__);            \
+      printf("\n");                   \
+      failures++;                     \
+    }                                 \
+  } while (0)
+
+// events are numbered across the session so their order can be checked
+static void make_events(test_event *events, int count, int first) {
+  memset(events, 0, count * sizeof(test_event));
+  for (int i = 0; i < count; i++) {
+    events[i].type = 0x300 + (first + i) % 3;
+    events[i].timestamp = first + i;
+    events[i].data[11] = -(first + i);
+  }
+}
+
+static long file_size(void) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return -1;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+static void record_script(void) {
+  replay_stream s;
+  test_event events[8];
+  int numbered = 0;
+
+  CHECK(replay_open(&s, path, REPLAY_RECORD, sizeof(test_event)) == 0, "can't record to %s", path);
+  for (int i = 0; i < (int)NUM_STEPS; i++) {
+    const test_step *t = &script[i];
+    if (t->step == STEP_VALUE) {
+      CHECK(replay_value(&s, t->kind, t->value) == t->value, "step %d: recording changed the value", i);
+    } else if (t->step == STEP_EVENTS) {
+      make_events(events, t->kind, numbered);
+      numbered += t->kind;
+      CHECK(replay_events(&s, events, t->kind, 8) == t->kind, "step %d: recording changed the count", i);
+    } else {
+      CHECK(replay_events(&s, NULL, t->kind, 0) == t->kind, "step %d: recording changed the count", i);
+    }
+  }
+  CHECK(s.calls == NUM_STEPS, "%u calls recorded", s.calls);
+  replay_close(&s);
+}
+
+static void test_round_trip(void) {
+  replay_stream s;
+  test_event events[8], expect[8];
+  int numbered = 0;
+
+  record_script();
+
+  CHECK(replay_open(&s, path, REPLAY_PLAY, sizeof(test_event)) == 0, "can't play %s", path);
+  for (int i = 0; i < (int)NUM_STEPS; i++) {
+    const test_step *t = &script[i];
+    if (t->step == STEP_VALUE) {
+      uint32_t value = replay_value(&s, t->kind, 12345);
+      CHECK(value == t->value, "step %d: played %08x, recorded %08x", i, value, t->value);
+    } else if (t->step == STEP_EVENTS) {
+      memset(events, 0xee, sizeof(events));
+      int n = replay_events(&s, events, 0, t->value);
+      make_events(expect, t->kind, numbered);
+      numbered += t->kind;
+      CHECK(n == (int)t->value, "step %d: played %d events, expected %u", i, n, t->value);
+      CHECK(memcmp(events, expect, n * sizeof(test_event)) == 0, "step %d: events differ or are out of order", i);
+      CHECK(n == 8 || ((uint8_t *)&events[n])[0] == 0xee, "step %d: wrote past the events played", i);
+    } else {
+      int n = replay_events(&s, NULL, 0, 0);
+      CHECK(n == t->kind, "step %d: played a count of %d, recorded %d", i, n, t->kind);
+    }
+    CHECK(s.mode == REPLAY_PLAY, "step %d: playback stopped early, desync %d", i, s.desync);
+  }
+  CHECK(s.calls == NUM_STEPS, "%u calls played", s.calls);
+
+  // past the end every call gets its live value and it isn't a desync
+  CHECK(replay_value(&s, REPLAY_TICKS, 777) == 777, "after the end ticks aren't live");
+  CHECK(s.mode == REPLAY_OFF && s.desync == 0, "end of stream: mode %d desync %d", s.mode, s.desync);
+  CHECK(replay_value(&s, REPLAY_RAND, 778) == 778, "after the end rand isn't live");
+  replay_close(&s);
+}
+
+// a steady 16 ms tick takes a kind byte and a single varint byte
+static void test_compact(void) {
+  replay_stream s;
+  CHECK(replay_open(&s, path, REPLAY_RECORD, sizeof(test_event)) == 0, "can't record to %s", path);
+  for (uint32_t i = 0; i < 1000; i++)
+    replay_value(&s, REPLAY_TICKS, 1000 + i * 16);
+  replay_close(&s);
+
+  // the first delta of 1000 takes two bytes
+  long expect = sizeof(replay_header) + 1000 * 2 + 1;
+  CHECK(file_size() == expect, "1000 ticks took %ld bytes, expected %ld", file_size(), expect);
+}
+
+static void test_desync(void) {
+  replay_stream s;
+  record_script();
+
+  CHECK(replay_open(&s, path, REPLAY_PLAY, sizeof(test_event)) == 0, "can't play %s", path);
+  CHECK(replay_value(&s, REPLAY_TICKS, 1) == 0, "first ticks not played");
+  CHECK(replay_value(&s, REPLAY_RAND, 99) == 99, "a mismatched kind isn't live");
+  CHECK(s.mode == REPLAY_OFF && s.desync == 1, "mismatch: mode %d desync %d", s.mode, s.desync);
+  CHECK(replay_value(&s, REPLAY_TICKS, 100) == 100, "ticks after a desync aren't live");
+
+  // events asked for where a value was recorded
+  test_event events[8];
+  CHECK(replay_open(&s, path, REPLAY_PLAY, sizeof(test_event)) == 0, "can't play %s", path);
+  CHECK(replay_events(&s, events, 0, 8) == 0 && s.desync == 1, "events in place of ticks: desync %d", s.desync);
+  replay_close(&s);
+}
+
+static void test_truncated(void) {
+  replay_stream s;
+  test_event events[8];
+  record_script();
+
+  // the last two ticks take a kind and one varint byte each, cutting three
+  // bytes leaves the kind of the second to last without its value
+  long size = file_size();
+  CHECK(truncate(path, size - 3) == 0, "can't truncate %s", path);
+
+  CHECK(replay_open(&s, path, REPLAY_PLAY, sizeof(test_event)) == 0, "can't play %s", path);
+  int steps = 0;
+  while (s.mode == REPLAY_PLAY && steps < (int)NUM_STEPS) {
+    const test_step *t = &script[steps];
+    if (t->step == STEP_VALUE)
+      replay_value(&s, t->kind, 0);
+    else
+      replay_events(&s, t->step == STEP_COUNT ? NULL : events, 0, t->value);
+    steps++;
+  }
+  CHECK(s.mode == REPLAY_OFF && s.desync == 0, "cut-off file: mode %d desync %d", s.mode, s.desync);
+  CHECK(steps == NUM_STEPS - 1, "cut-off file stopped after %d of %d calls", steps, (int)NUM_STEPS);
+}
+
+static void test_header(void) {
+  replay_stream s;
+  record_script();
+  CHECK(replay_open(&s, path, REPLAY_PLAY, sizeof(test_event) + 4) < 0, "played with another event size");
+  CHECK(s.mode == REPLAY_OFF && s.f == NULL, "failed open left the stream open");
+
+  FILE *f = fopen(path, "wb");
+  fputs("not a recording", f);
+  fclose(f);
+  CHECK(replay_open(&s, path, REPLAY_PLAY, sizeof(test_event)) < 0, "played a foreign file");
+  CHECK(replay_open(&s, "/nonexistent/replay.bin", REPLAY_PLAY, sizeof(test_event)) < 0, "played a missing file");
+}
+
+int main(void) {
+  strcpy(path, "/tmp/replaytest-XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  test_round_trip();
+  test_compact();
+  test_desync();
+  test_truncated();
+  test_header();
+
+  unlink(path);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures != 0;
+}
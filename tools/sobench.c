@@ -0,0 +1,1153 @@
+/* sobench.c -- host benchmarks for the module loader in so_util.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Host tool, build with: cc -O2 -pthread -o sobench tools/sobench.c
+ * Usage: sobench [relocations]
+ *
+ * Builds a synthetic ARM module in a temporary file and runs loader/so_util.c
+ * on it, with memblocks as anonymous mappings and the sce and kubridge calls
+ * as thin stand-ins. uintptr_t is narrowed and the blocks are mapped below
+ * 4 GiB so the relocated words come out as on the Vita. Lazy binding and
+ * detours keep block bases in narrowed words and aren't exercised. The
+ * numbers compare code paths on the host CPU, not card or Vita timings.
+ */
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SO_HOST
+#define SO_WORKERS // off in config.h, the workers case compares both
+
+// SceIoStat has its own
+#undef st_mtime
+
+typedef int SceUID;
+typedef unsigned int SceSize;
+typedef uint32_t SceUInt32;
+typedef unsigned long long SceUInt64;
+typedef int SceKernelMemBlockType;
+
+typedef struct {
+  time_t t;
+} SceDateTime;
+
+typedef struct {
+  SceSize st_size;
+  SceDateTime st_mtime;
+} SceIoStat;
+
+typedef struct {
+  SceSize size;
+  SceUInt32 field_4;
+  SceUInt32 attr;
+  SceUInt32 field_C;
+} SceKernelAllocMemBlockKernelOpt;
+
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RW 0x0c20d060
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX 0x0c20d050
+#define SCE_KERNEL_CPU_MASK_USER_0 0x10000
+
+#define SCE_O_RDONLY O_RDONLY
+#define SCE_O_WRONLY O_WRONLY
+#define SCE_O_CREAT O_CREAT
+#define SCE_O_TRUNC O_TRUNC
+#define SCE_SEEK_SET SEEK_SET
+#define SCE_SEEK_END SEEK_END
+
+static int debugPrintf(const char *fmt, ...) {
+  return 0;
+}
+
+static void fatal_error(const char *fmt, ...) {
+  va_list list;
+  va_start(list, fmt);
+  vfprintf(stderr, fmt, list);
+  va_end(list);
+  exit(1);
+}
+
+static SceUInt64 sceKernelGetProcessTimeWide(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static size_t bench_bytes_read = 0;
+
+static SceUID sceIoOpen(const char *path, int flags, int mode) {
+  return open(path, flags, mode);
+}
+
+static int sceIoRead(SceUID fd, void *data, SceSize size) {
+  int n = read(fd, data, size);
+  if (n > 0)
+    bench_bytes_read += n;
+  return n;
+}
+
+static int sceIoWrite(SceUID fd, const void *data, SceSize size) {
+  return write(fd, data, size);
+}
+
+static long long sceIoLseek(SceUID fd, long long offset, int whence) {
+  return lseek(fd, offset, whence);
+}
+
+static int sceIoClose(SceUID fd) {
+  return close(fd);
+}
+
+static int sceIoRemove(const char *path) {
+  return unlink(path);
+}
+
+static int sceIoGetstat(const char *path, SceIoStat *out) {
+  struct stat st;
+  if (stat(path, &st) < 0)
+    return -1;
+  out->st_size = st.st_size;
+  out->st_mtime.t = st.st_mtim.tv_sec;
+  return 0;
+}
+
+#define BENCH_MAX_BLOCKS 64
+#define BENCH_BLOCK_BASE 0x60000000
+#define BENCH_BLOCK_END 0x90000000
+
+typedef struct {
+  void *base;
+  size_t size;
+} bench_block;
+
+static bench_block bench_blocks[BENCH_MAX_BLOCKS];
+static size_t bench_block_bytes = 0, bench_block_peak = 0;
+static uintptr_t bench_block_next = BENCH_BLOCK_BASE;
+static size_t bench_flushed = 0;
+
+// the loader keeps addresses in 32-bit words, every block has to land below
+// 4 GiB. blocks without an address are taken from a window below the module
+static SceUID bench_alloc_block(uintptr_t addr, size_t size) {
+  if (!addr) {
+    if (bench_block_next + size > BENCH_BLOCK_END)
+      bench_block_next = BENCH_BLOCK_BASE;
+    addr = bench_block_next;
+    bench_block_next += (size + 0xffff) & ~0xffff;
+  }
+
+  void *base = mmap((void *)addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (base == MAP_FAILED)
+    return -1;
+
+  for (int i = 1; i < BENCH_MAX_BLOCKS; i++) {
+    if (!bench_blocks[i].base) {
+      bench_blocks[i].base = base;
+      bench_blocks[i].size = size;
+      bench_block_bytes += size;
+      if (bench_block_bytes > bench_block_peak)
+        bench_block_peak = bench_block_bytes;
+      return i;
+    }
+  }
+
+  munmap(base, size);
+  return -1;
+}
+
+static SceUID kuKernelAllocMemBlock(const char *name, SceKernelMemBlockType type, SceSize size, SceKernelAllocMemBlockKernelOpt *opt) {
+  return bench_alloc_block(opt && (opt->attr & 1) ? opt->field_C : 0, size);
+}
+
+static SceUID sceKernelAllocMemBlock(const char *name, SceKernelMemBlockType type, SceSize size, void *opt) {
+  return bench_alloc_block(0, size);
+}
+
+// out of line, the lazy and detour callers pass narrowed words
+__attribute__((noinline)) static int sceKernelGetMemBlockBase(SceUID uid, void **base) {
+  *base = bench_blocks[uid].base;
+  return 0;
+}
+
+static int sceKernelFreeMemBlock(SceUID uid) {
+  if (uid <= 0 || uid >= BENCH_MAX_BLOCKS || !bench_blocks[uid].base)
+    return -1;
+  munmap(bench_blocks[uid].base, bench_blocks[uid].size);
+  bench_block_bytes -= bench_blocks[uid].size;
+  bench_blocks[uid].base = NULL;
+  return 0;
+}
+
+static int kuKernelCpuUnrestrictedMemcpy(void *dst, const void *src, SceSize len) {
+  memcpy(dst, src, len);
+  return 0;
+}
+
+static int kuKernelFlushCaches(const void *ptr, SceSize len) {
+  __sync_fetch_and_add(&bench_flushed, len);
+  return 0;
+}
+
+#define BENCH_MAX_THREADS 16
+
+typedef struct {
+  pthread_t thread;
+  int (*entry)(SceSize args, void *argp);
+  SceSize args;
+  uint8_t argp[16];
+  int used;
+} bench_thread;
+
+static bench_thread bench_threads[BENCH_MAX_THREADS];
+
+// with no workers so_run_jobs runs every range on the calling thread
+static int bench_workers = 1;
+static int bench_threads_started = 0;
+
+static void *bench_thread_entry(void *arg) {
+  bench_thread *t = arg;
+  t->entry(t->args, t->argp);
+  return NULL;
+}
+
+static SceUID sceKernelCreateThread(const char *name, int (*entry)(SceSize, void *), int prio, SceSize stack, SceUInt32 attr, int affinity, void *opt) {
+  if (!bench_workers)
+    return -1;
+  for (int i = 0; i < BENCH_MAX_THREADS; i++) {
+    if (__sync_lock_test_and_set(&bench_threads[i].used, 1) == 0) {
+      __sync_fetch_and_add(&bench_threads_started, 1);
+      bench_threads[i].entry = entry;
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int sceKernelStartThread(SceUID thid, SceSize args, void *argp) {
+  bench_thread *t = &bench_threads[thid];
+  t->args = args < sizeof(t->argp) ? args : sizeof(t->argp);
+  memcpy(t->argp, argp, t->args);
+  return pthread_create(&t->thread, NULL, bench_thread_entry, t) ? -1 : 0;
+}
+
+static int sceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt32 *timeout) {
+  return pthread_join(bench_threads[thid].thread, NULL) ? -1 : 0;
+}
+
+static int sceKernelDeleteThread(SceUID thid) {
+  __sync_lock_release(&bench_threads[thid].used);
+  return 0;
+}
+
+// the heap the loader uses is counted, sizes are kept in front of each
+// allocation so frees can be
+static size_t bench_heap_bytes = 0, bench_heap_peak = 0;
+
+static void bench_heap_add(size_t size) {
+  size_t bytes = __sync_add_and_fetch(&bench_heap_bytes, size);
+  size_t peak;
+  while (bytes > (peak = bench_heap_peak) && !__sync_bool_compare_and_swap(&bench_heap_peak, peak, bytes))
+    ;
+}
+
+static void *bench_malloc(size_t size) {
+  size_t *p = malloc(size + 16);
+  if (!p)
+    return NULL;
+  p[0] = size;
+  bench_heap_add(size);
+  return (uint8_t *)p + 16;
+}
+
+static void bench_free(void *ptr) {
+  if (!ptr)
+    return;
+  size_t *p = (size_t *)((uint8_t *)ptr - 16);
+  __sync_sub_and_fetch(&bench_heap_bytes, p[0]);
+  free(p);
+}
+
+static void *bench_calloc(size_t n, size_t size) {
+  void *p = bench_malloc(n * size);
+  if (p)
+    memset(p, 0, n * size);
+  return p;
+}
+
+static void *bench_realloc(void *ptr, size_t size) {
+  if (!ptr)
+    return bench_malloc(size);
+
+  size_t *p = (size_t *)((uint8_t *)ptr - 16);
+  size_t old = p[0];
+  p = realloc(p, size + 16);
+  if (!p)
+    return NULL;
+  p[0] = size;
+  if (size > old)
+    bench_heap_add(size - old);
+  else
+    __sync_sub_and_fetch(&bench_heap_bytes, old - size);
+  return (uint8_t *)p + 16;
+}
+
+static char *bench_strdup(const char *s) {
+  size_t len = strlen(s) + 1;
+  char *p = bench_malloc(len);
+  if (p)
+    memcpy(p, s, len);
+  return p;
+}
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#define free bench_free
+#define strdup bench_strdup
+
+// the missing import printout is kept so the serial and threaded runs can be
+// compared
+static char bench_log[64 * 1024];
+static size_t bench_log_len = 0;
+
+static int bench_printf(const char *fmt, ...) {
+  va_list list;
+  va_start(list, fmt);
+  int len = vsnprintf(bench_log + bench_log_len, sizeof(bench_log) - bench_log_len, fmt, list);
+  va_end(list);
+  if (len > 0)
+    bench_log_len += len;
+  if (bench_log_len >= sizeof(bench_log))
+    bench_log_len = sizeof(bench_log) - 1;
+  return len;
+}
+
+#define printf bench_printf
+
+// the loader stores addresses in 32-bit words, here and in the old paths
+// copied from it they are cast to and from host pointers
+#define uintptr_t uint32_t
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+
+#include "../loader/so_util.c"
+
+#undef printf
+
+#define BENCH_LOAD_ADDRESS 0x98000000
+#define BENCH_PAGE 0x1000
+#define BENCH_DYNLIB 327 // entries in main.c's default_dynlib
+#define BENCH_IMPORTS 300
+#define BENCH_DEFINED 16
+#define BENCH_FUNC_BASE 0x81000000
+
+// how the relocations in rel.dyn are stored
+enum {
+  BENCH_REL,
+  BENCH_RELR, // relative ones as a RELR bitmap, the rest as REL
+  BENCH_APS2, // all of them packed as DT_ANDROID_REL
+};
+
+typedef struct {
+  int format;
+  int num_relative;
+  int scattered;    // relative entries listed out of page order
+  int num_abs;      // against defined symbols
+  int num_glob_dat; // against imports
+  int num_jump_slot;
+  size_t code_size;
+  size_t bss_size;
+  size_t extra_size; // symtab and debug info past the segments, never loaded
+} bench_spec;
+
+typedef struct {
+  bench_spec spec;
+  char path[32];
+  size_t file_size;
+  size_t table_size; // bytes of rel.dyn and relr as stored
+  uint32_t slots; // vaddr of the first relocated word
+  char **names;
+  so_default_dynlib dynlib[BENCH_DYNLIB];
+} bench_image;
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// import names share prefixes like the real table does, which is what makes
+// the linear strcmp scan slow
+static const char *bench_prefixes[] = { "SDL_", "Mix_", "gl", "pthread_", "__aeabi_", "str", "f", "sce" };
+
+// where import i sits in the dynlib, spread through the table
+static int bench_dynlib_pos(int i) {
+  return (i * 7) % BENCH_DYNLIB;
+}
+
+static void bench_sleb128(uint8_t *buf, uint32_t *pos, int32_t value) {
+  int more = 1;
+  while (more) {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)))
+      more = 0;
+    else
+      byte |= 0x80;
+    buf[(*pos)++] = byte;
+  }
+}
+
+// APS2 groups for word-consecutive entries: the relative ones share an
+// info, the others carry one each
+static uint32_t bench_pack_aps2(uint8_t *out, const Elf32_Rel *rel, int count, int num_relative) {
+  uint32_t pos = 0;
+  memcpy(out, "APS2", 4);
+  pos += 4;
+  bench_sleb128(out, &pos, count);
+  bench_sleb128(out, &pos, count ? rel[0].r_offset - 4 : 0);
+
+  if (num_relative) {
+    bench_sleb128(out, &pos, num_relative);
+    bench_sleb128(out, &pos, APS2_GROUPED_BY_INFO | APS2_GROUPED_BY_OFFSET_DELTA);
+    bench_sleb128(out, &pos, 4);
+    bench_sleb128(out, &pos, ELF32_R_INFO(0, R_ARM_RELATIVE));
+  }
+  if (count > num_relative) {
+    bench_sleb128(out, &pos, count - num_relative);
+    bench_sleb128(out, &pos, APS2_GROUPED_BY_OFFSET_DELTA);
+    bench_sleb128(out, &pos, 4);
+    for (int i = num_relative; i < count; i++)
+      bench_sleb128(out, &pos, rel[i].r_info);
+  }
+
+  return pos;
+}
+
+// the relative words are consecutive: one address entry, then bitmaps of
+// 31 words each
+static int bench_pack_relr(uint32_t *out, uint32_t first, int count) {
+  int n = 0;
+  if (count == 0)
+    return 0;
+
+  out[n++] = first;
+  for (int left = count - 1; left > 0; left -= 31) {
+    int bits = left < 31 ? left : 31;
+    out[n++] = (((1u << bits) - 1) << 1) | 1;
+  }
+
+  return n;
+}
+
+static uint32_t bench_put(uint8_t *buf, uint32_t *pos, const void *data, uint32_t size) {
+  uint32_t at = *pos;
+  memcpy(buf + at, data, size);
+  *pos = ALIGN_MEM(at + size, 4);
+  return at;
+}
+
+// text: headers, dynsym, dynstr, hash, relocations and filler code. data:
+// the dynamic segment and one word per relocation, then bss
+static int bench_build(bench_image *img, const bench_spec *spec) {
+  int num_imports = BENCH_IMPORTS;
+  int num_syms = 1 + num_imports + BENCH_DEFINED;
+  int num_reldyn = spec->num_relative + spec->num_abs + spec->num_glob_dat;
+  int num_slots = num_reldyn + spec->num_jump_slot;
+
+  memset(img, 0, sizeof(bench_image));
+  img->spec = *spec;
+
+  img->names = calloc(num_syms, sizeof(char *));
+  for (int i = 1; i < num_syms; i++) {
+    char name[64];
+    if (i <= num_imports)
+      snprintf(name, sizeof(name), "%sImport%04d", bench_prefixes[i % 8], i);
+    else
+      snprintf(name, sizeof(name), "Defined%04d", i);
+    img->names[i] = strdup(name);
+  }
+
+  // the dynlib holds every import plus shims the module doesn't use
+  for (int i = 0; i < num_imports; i++)
+    img->dynlib[bench_dynlib_pos(i)].symbol = strdup(img->names[1 + i]);
+  for (int j = 0; j < BENCH_DYNLIB; j++) {
+    if (!img->dynlib[j].symbol) {
+      char name[64];
+      snprintf(name, sizeof(name), "%sUnused%04d", bench_prefixes[j % 8], j);
+      img->dynlib[j].symbol = strdup(name);
+    }
+    img->dynlib[j].func = BENCH_FUNC_BASE + j * 16;
+  }
+
+  size_t strtab_size = 64;
+  for (int i = 1; i < num_syms; i++)
+    strtab_size += strlen(img->names[i]) + 1;
+
+  size_t text_size = sizeof(Elf32_Ehdr) + 3 * sizeof(Elf32_Phdr) + num_syms * sizeof(Elf32_Sym) + strtab_size +
+                     (2 + 64 + num_syms) * sizeof(uint32_t) + num_slots * sizeof(Elf32_Rel) + spec->code_size + 64;
+  uint32_t data_off = ALIGN_MEM(text_size, BENCH_PAGE);
+  int num_dynamic = 16;
+  size_t data_size = num_dynamic * sizeof(Elf32_Dyn) + num_slots * sizeof(uint32_t);
+  size_t file_size = data_off + data_size + spec->extra_size;
+  uint8_t *buf = calloc(1, file_size);
+  if (!buf)
+    return -1;
+
+  uint32_t pos = sizeof(Elf32_Ehdr) + 3 * sizeof(Elf32_Phdr);
+
+  // strings
+  char *strtab = calloc(1, strtab_size);
+  uint32_t str_len = 1, *name_off = calloc(num_syms, sizeof(uint32_t));
+  uint32_t soname = str_len;
+  str_len += sprintf(strtab + str_len, "libbench.so") + 1;
+  uint32_t needed[3];
+  static const char *needed_names[] = { "libc.so", "libm.so", "libdl.so" };
+  for (int i = 0; i < 3; i++) {
+    needed[i] = str_len;
+    str_len += sprintf(strtab + str_len, "%s", needed_names[i]) + 1;
+  }
+  for (int i = 1; i < num_syms; i++) {
+    name_off[i] = str_len;
+    str_len += sprintf(strtab + str_len, "%s", img->names[i]) + 1;
+  }
+
+  // symbols
+  Elf32_Sym *syms = calloc(num_syms, sizeof(Elf32_Sym));
+  for (int i = 1; i < num_syms; i++) {
+    syms[i].st_name = name_off[i];
+    syms[i].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+    if (i > num_imports) {
+      syms[i].st_shndx = 1;
+      syms[i].st_value = 0x400 + (i - num_imports) * 16;
+    }
+  }
+  uint32_t dynsym = bench_put(buf, &pos, syms, num_syms * sizeof(Elf32_Sym));
+  uint32_t dynstr = bench_put(buf, &pos, strtab, str_len);
+
+  // sysv hash, so_parse_dynamic takes the symbol count from it
+  uint32_t nbucket = 64;
+  uint32_t *hash = calloc(2 + nbucket + num_syms, sizeof(uint32_t));
+  hash[0] = nbucket;
+  hash[1] = num_syms;
+  for (int i = 1; i < num_syms; i++) {
+    uint32_t b = so_hash((const uint8_t *)img->names[i]) % nbucket;
+    hash[2 + nbucket + i] = hash[2 + b];
+    hash[2 + b] = i;
+  }
+  uint32_t hash_off = bench_put(buf, &pos, hash, (2 + nbucket + num_syms) * sizeof(uint32_t));
+
+  // relocations, one word each, in data order: relative, abs, glob_dat, jump slots
+  uint32_t slots = data_off + num_dynamic * sizeof(Elf32_Dyn);
+  uint32_t *words = (uint32_t *)(buf + slots);
+  Elf32_Rel *rel = calloc(num_slots, sizeof(Elf32_Rel));
+  int n = 0;
+  for (int i = 0; i < spec->num_relative; i++, n++) {
+    rel[n].r_offset = slots + n * 4;
+    rel[n].r_info = ELF32_R_INFO(0, R_ARM_RELATIVE);
+    words[n] = 0x400 + (i * 4) % (spec->code_size ? spec->code_size : 4);
+  }
+  if (spec->scattered) {
+    // a coprime stride visits every word once, jumping pages on each entry
+    int stride = 4099;
+    while (spec->num_relative % stride == 0)
+      stride += 2;
+    for (int i = 0; i < spec->num_relative; i++)
+      rel[i].r_offset = slots + (int)(((int64_t)i * stride) % spec->num_relative) * 4;
+  }
+  for (int i = 0; i < spec->num_abs; i++, n++) {
+    rel[n].r_offset = slots + n * 4;
+    rel[n].r_info = ELF32_R_INFO(1 + num_imports + i % BENCH_DEFINED, R_ARM_ABS32);
+  }
+  for (int i = 0; i < spec->num_glob_dat; i++, n++) {
+    rel[n].r_offset = slots + n * 4;
+    rel[n].r_info = ELF32_R_INFO(1 + i % num_imports, R_ARM_GLOB_DAT);
+  }
+  for (int i = 0; i < spec->num_jump_slot; i++, n++) {
+    rel[n].r_offset = slots + n * 4;
+    rel[n].r_info = ELF32_R_INFO(1 + i % num_imports, R_ARM_JUMP_SLOT);
+  }
+  uint32_t reldyn = 0, reldyn_size = 0, relr = 0, relr_size = 0;
+  if (spec->format == BENCH_APS2) {
+    uint8_t *packed = calloc(1, 16 + num_reldyn * 12);
+    reldyn_size = bench_pack_aps2(packed, rel, num_reldyn, spec->num_relative);
+    reldyn = bench_put(buf, &pos, packed, reldyn_size);
+    free(packed);
+  } else if (spec->format == BENCH_RELR) {
+    uint32_t *packed = calloc(2 + spec->num_relative / 31, sizeof(uint32_t));
+    relr_size = bench_pack_relr(packed, rel[0].r_offset, spec->num_relative) * sizeof(uint32_t);
+    relr = bench_put(buf, &pos, packed, relr_size);
+    free(packed);
+    reldyn_size = (num_reldyn - spec->num_relative) * sizeof(Elf32_Rel);
+    reldyn = bench_put(buf, &pos, &rel[spec->num_relative], reldyn_size);
+  } else {
+    reldyn_size = num_reldyn * sizeof(Elf32_Rel);
+    reldyn = bench_put(buf, &pos, rel, reldyn_size);
+  }
+  uint32_t relplt = bench_put(buf, &pos, &rel[num_reldyn], spec->num_jump_slot * sizeof(Elf32_Rel));
+
+  // filler code, the part of the image that is only copied
+  for (uint32_t i = 0; i < spec->code_size; i += 4)
+    *(uint32_t *)(buf + pos + i) = 0xe1a00000; // NOP
+  pos += spec->code_size;
+
+  Elf32_Dyn *dyn = (Elf32_Dyn *)(buf + data_off);
+  int d = 0;
+  for (int i = 0; i < 3; i++) {
+    dyn[d].d_tag = DT_NEEDED;
+    dyn[d++].d_un.d_val = needed[i];
+  }
+  dyn[d].d_tag = DT_SONAME;
+  dyn[d++].d_un.d_val = soname;
+  dyn[d].d_tag = DT_STRTAB;
+  dyn[d++].d_un.d_ptr = dynstr;
+  dyn[d].d_tag = DT_SYMTAB;
+  dyn[d++].d_un.d_ptr = dynsym;
+  dyn[d].d_tag = DT_HASH;
+  dyn[d++].d_un.d_ptr = hash_off;
+  dyn[d].d_tag = spec->format == BENCH_APS2 ? DT_ANDROID_REL : DT_REL;
+  dyn[d++].d_un.d_ptr = reldyn;
+  dyn[d].d_tag = spec->format == BENCH_APS2 ? DT_ANDROID_RELSZ : DT_RELSZ;
+  dyn[d++].d_un.d_val = reldyn_size;
+  if (relr) {
+    dyn[d].d_tag = DT_RELR;
+    dyn[d++].d_un.d_ptr = relr;
+    dyn[d].d_tag = DT_RELRSZ;
+    dyn[d++].d_un.d_val = relr_size;
+  }
+  dyn[d].d_tag = DT_JMPREL;
+  dyn[d++].d_un.d_ptr = relplt;
+  dyn[d].d_tag = DT_PLTRELSZ;
+  dyn[d++].d_un.d_val = spec->num_jump_slot * sizeof(Elf32_Rel);
+  dyn[d].d_tag = DT_NULL;
+
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *)buf;
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_type = ET_DYN;
+  ehdr->e_machine = EM_ARM;
+  ehdr->e_phoff = sizeof(Elf32_Ehdr);
+  ehdr->e_phentsize = sizeof(Elf32_Phdr);
+  ehdr->e_phnum = 3;
+
+  Elf32_Phdr *phdr = (Elf32_Phdr *)(buf + sizeof(Elf32_Ehdr));
+  phdr[0].p_type = PT_LOAD;
+  phdr[0].p_flags = PF_R | PF_X;
+  phdr[0].p_filesz = phdr[0].p_memsz = pos;
+  phdr[0].p_align = BENCH_PAGE;
+  phdr[1].p_type = PT_LOAD;
+  phdr[1].p_flags = PF_R | PF_W;
+  phdr[1].p_offset = phdr[1].p_vaddr = data_off;
+  phdr[1].p_filesz = data_size;
+  phdr[1].p_memsz = data_size + spec->bss_size;
+  phdr[1].p_align = BENCH_PAGE;
+  phdr[2].p_type = PT_DYNAMIC;
+  phdr[2].p_offset = phdr[2].p_vaddr = data_off;
+  phdr[2].p_filesz = phdr[2].p_memsz = num_dynamic * sizeof(Elf32_Dyn);
+
+  strcpy(img->path, "/tmp/sobench-XXXXXX");
+  int fd = mkstemp(img->path);
+  int ok = fd >= 0 && write(fd, buf, file_size) == (ssize_t)file_size;
+  if (fd >= 0)
+    close(fd);
+
+  img->file_size = file_size;
+  img->table_size = reldyn_size + relr_size;
+  img->slots = slots;
+
+  free(rel);
+  free(hash);
+  free(syms);
+  free(name_off);
+  free(strtab);
+  free(buf);
+
+  return ok ? 0 : -1;
+}
+
+static void bench_destroy(bench_image *img) {
+  unlink(img->path);
+  for (int i = 0; i < BENCH_DYNLIB; i++)
+    free(img->dynlib[i].symbol);
+  for (int i = 1; i < 1 + BENCH_IMPORTS + BENCH_DEFINED; i++)
+    free(img->names[i]);
+  free(img->names);
+}
+
+static int bench_load(bench_image *img, so_module *mod) {
+  bench_bytes_read = 0;
+  if (so_load(mod, img->path, BENCH_LOAD_ADDRESS) < 0)
+    return -1;
+  return 0;
+}
+
+static void bench_unload(so_module *mod) {
+  if (mod->reldyn_unpacked)
+    free(mod->reldyn);
+  free(mod->text_dirty);
+  free(mod->imports);
+  free(mod->path);
+  sceKernelFreeMemBlock(mod->data_blockid);
+  sceKernelFreeMemBlock(mod->text_blockid);
+  head = tail = NULL;
+}
+
+#define BENCH_CHECK_RELOCS 1
+#define BENCH_CHECK_IMPORTS 2
+
+// 1 when the relocated words hold what so_relocate and so_resolve should
+// have written
+static int bench_check(bench_image *img, so_module *mod, int what) {
+  const bench_spec *spec = &img->spec;
+  uint32_t *words = (uint32_t *)(mod->text_base + img->slots);
+  int n = 0;
+
+  for (int i = 0; i < spec->num_relative; i++, n++) {
+    if ((what & BENCH_CHECK_RELOCS) && words[n] != mod->text_base + 0x400 + (i * 4) % (spec->code_size ? spec->code_size : 4))
+      return 0;
+  }
+  for (int i = 0; i < spec->num_abs; i++, n++) {
+    if ((what & BENCH_CHECK_RELOCS) && words[n] != mod->text_base + 0x400 + (1 + i % BENCH_DEFINED) * 16)
+      return 0;
+  }
+  for (int i = 0; i < spec->num_glob_dat + spec->num_jump_slot; i++, n++) {
+    int j = i < spec->num_glob_dat ? i : i - spec->num_glob_dat;
+    if ((what & BENCH_CHECK_IMPORTS) && words[n] != BENCH_FUNC_BASE + bench_dynlib_pos(j % BENCH_IMPORTS) * 16)
+      return 0;
+  }
+
+  return 1;
+}
+
+static void bench_clear_imports(bench_image *img, so_module *mod) {
+  const bench_spec *spec = &img->spec;
+  int first = spec->num_relative + spec->num_abs;
+  memset((void *)(mod->text_base + img->slots + first * 4), 0, (spec->num_glob_dat + spec->num_jump_slot) * 4);
+}
+
+// so_resolve before the hashed index: every undefined symbol scanned the
+// whole default_dynlib with strcmp
+static void old_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+  for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+    Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+    Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+    uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
+
+    int type = ELF32_R_TYPE(rel->r_info);
+    switch (type) {
+      case R_ARM_ABS32:
+      case R_ARM_GLOB_DAT:
+      case R_ARM_JUMP_SLOT:
+      {
+        if (sym->st_shndx == SHN_UNDEF) {
+          int resolved = 0;
+          if (!default_dynlib_only) {
+            uintptr_t link = so_resolve_link(mod, mod->dynstr + sym->st_name);
+            if (link) {
+              *ptr = link;
+              resolved = 1;
+            }
+          }
+
+          for (int j = 0; j < size_default_dynlib / sizeof(so_default_dynlib); j++) {
+            if (strcmp(mod->dynstr + sym->st_name, default_dynlib[j].symbol) == 0) {
+              *ptr = default_dynlib[j].func;
+              resolved = 1;
+              break;
+            }
+          }
+
+          if (!resolved)
+            printf("Missing: %s\n", mod->dynstr + sym->st_name);
+        }
+
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+}
+
+// the hashed lookup on one thread, so only the index is compared
+static void new_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+  so_job job;
+  memset(&job, 0, sizeof(job));
+  so_build_dynlib_index(default_dynlib, size_default_dynlib / sizeof(so_default_dynlib));
+  job.mod = mod;
+  job.default_dynlib_only = default_dynlib_only;
+  job.start = 0;
+  job.end = mod->num_reldyn + mod->num_relplt;
+  so_resolve_job(&job);
+  free(job.imports);
+  free(job.missing);
+}
+
+static void bench_resolve(bench_image *img, int iterations) {
+  so_module mod;
+  if (bench_load(img, &mod) < 0) {
+    printf("resolve: could not load %s\n", img->path);
+    return;
+  }
+  so_relocate(&mod);
+
+  int num_imports = img->spec.num_glob_dat + img->spec.num_jump_slot;
+  int size = sizeof(img->dynlib);
+
+  for (int pass = 0; pass < 2; pass++) {
+    bench_clear_imports(img, &mod);
+    double start = now_us();
+    for (int i = 0; i < iterations; i++) {
+      if (pass == 0)
+        old_resolve(&mod, img->dynlib, size, 0);
+      else
+        new_resolve(&mod, img->dynlib, size, 0);
+    }
+    double elapsed = (now_us() - start) / iterations;
+
+    printf("resolve  %-10s %10.1f us %8.1f ns/import  %s\n", pass == 0 ? "linear" : "hashed", elapsed,
+           elapsed * 1000 / num_imports, bench_check(img, &mod, BENCH_CHECK_IMPORTS) ? "ok" : "WRONG SLOTS");
+  }
+
+  bench_unload(&mod);
+}
+
+// so_load before streaming: the whole file staged in a memblock and a zeroed
+// heap buffer the size of each segment. the synthetic module has no section
+// headers, so the dynamic segment is parsed the current way
+static int old_load(so_module *mod, const char *filename, uintptr_t load_addr) {
+  uintptr_t data_addr = 0;
+  void *so_data;
+
+  memset(mod, 0, sizeof(so_module));
+
+  SceUID fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
+  if (fd < 0)
+    return fd;
+
+  size_t so_size = sceIoLseek(fd, 0, SCE_SEEK_END);
+  sceIoLseek(fd, 0, SCE_SEEK_SET);
+
+  SceUID so_blockid = sceKernelAllocMemBlock("file", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, (so_size + 0xfff) & ~0xfff, NULL);
+  if (so_blockid < 0) {
+    sceIoClose(fd);
+    return so_blockid;
+  }
+
+  sceKernelGetMemBlockBase(so_blockid, &so_data);
+  sceIoRead(fd, so_data, so_size);
+  sceIoClose(fd);
+
+  Elf32_Ehdr *ehdr = so_data;
+  Elf32_Phdr *phdr = (Elf32_Phdr *)((uint8_t *)so_data + ehdr->e_phoff);
+
+  for (int i = 0; i < ehdr->e_phnum; i++) {
+    if (phdr[i].p_type == PT_LOAD) {
+      void *prog_data;
+      size_t prog_size;
+
+      if ((phdr[i].p_flags & PF_X) == PF_X) {
+        prog_size = ALIGN_MEM(phdr[i].p_memsz, phdr[i].p_align);
+        mod->text_blockid = so_alloc_block("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, load_addr, prog_size);
+        sceKernelGetMemBlockBase(mod->text_blockid, &prog_data);
+        phdr[i].p_vaddr += (Elf32_Addr)prog_data;
+        mod->text_base = phdr[i].p_vaddr;
+        mod->text_size = phdr[i].p_memsz;
+        mod->text_block_size = prog_size;
+        data_addr = (uintptr_t)prog_data + prog_size;
+      } else {
+        prog_size = ALIGN_MEM(phdr[i].p_memsz + phdr[i].p_vaddr - (data_addr - mod->text_base), phdr[i].p_align);
+        mod->data_blockid = so_alloc_block("rw_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, data_addr, prog_size);
+        sceKernelGetMemBlockBase(mod->data_blockid, &prog_data);
+        phdr[i].p_vaddr += (Elf32_Addr)mod->text_base;
+        mod->data_base = phdr[i].p_vaddr;
+        mod->data_size = phdr[i].p_memsz;
+        mod->data_block_size = prog_size;
+      }
+
+      char *zero = malloc(prog_size);
+      memset(zero, 0, prog_size);
+      kuKernelCpuUnrestrictedMemcpy(prog_data, zero, prog_size);
+      free(zero);
+
+      kuKernelCpuUnrestrictedMemcpy((void *)phdr[i].p_vaddr, (uint8_t *)so_data + phdr[i].p_offset, phdr[i].p_filesz);
+    } else if (phdr[i].p_type == PT_DYNAMIC) {
+      mod->dynamic = (Elf32_Dyn *)(mod->text_base + phdr[i].p_vaddr);
+      mod->num_dynamic = phdr[i].p_memsz / sizeof(Elf32_Dyn);
+    }
+  }
+
+  int res = so_parse_dynamic(mod) < 0 || so_init_dirty(mod) < 0 ? -2 : 0;
+
+  sceKernelFreeMemBlock(so_blockid);
+
+  return res;
+}
+
+static void bench_load_case(bench_image *img, int iterations) {
+  for (int pass = 0; pass < 2; pass++) {
+    size_t block_peak = 0, heap_peak = 0, bytes_read = 0;
+    double elapsed = 0;
+    int ok = 1;
+
+    for (int i = 0; i < iterations; i++) {
+      so_module mod;
+      size_t block_start = bench_block_bytes, heap_start = bench_heap_bytes;
+      bench_block_peak = block_start;
+      bench_heap_peak = heap_start;
+      bench_bytes_read = 0;
+
+      double start = now_us();
+      int res = pass == 0 ? old_load(&mod, img->path, BENCH_LOAD_ADDRESS) : so_load(&mod, img->path, BENCH_LOAD_ADDRESS);
+      elapsed += now_us() - start;
+
+      if (res < 0) {
+        printf("load: could not load %s\n", img->path);
+        return;
+      }
+
+      block_peak = bench_block_peak - block_start;
+      heap_peak = bench_heap_peak - heap_start;
+      bytes_read = bench_bytes_read;
+
+      // the image has to come out the same either way
+      if (i == 0) {
+        so_relocate(&mod);
+        so_resolve(&mod, img->dynlib, sizeof(img->dynlib), 0);
+        ok = bench_check(img, &mod, BENCH_CHECK_RELOCS | BENCH_CHECK_IMPORTS);
+      }
+
+      bench_unload(&mod);
+    }
+
+    // blocks include the module's own, heap is what the loader held on top
+    printf("load     %-10s %10.1f us  peak %6zu KiB blocks %6zu KiB heap, read %6zu KiB  %s\n",
+           pass == 0 ? "staged" : "streamed", elapsed / iterations, block_peak / 1024, heap_peak / 1024,
+           bytes_read / 1024, ok ? "ok" : "WRONG SLOTS");
+  }
+}
+
+// so_relocate as it was, every entry through the generic switch
+static void old_relocate(so_module *mod) {
+  so_relocate_relr(mod);
+  for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+    Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+    Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+    uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
+
+    switch (ELF32_R_TYPE(rel->r_info)) {
+      case R_ARM_ABS32:
+        if (sym->st_shndx != SHN_UNDEF)
+          *ptr += mod->text_base + sym->st_value;
+        else
+          *ptr = mod->text_base + rel->r_offset;
+        break;
+      case R_ARM_RELATIVE:
+        *ptr += mod->text_base;
+        break;
+      case R_ARM_GLOB_DAT:
+      case R_ARM_JUMP_SLOT:
+        *ptr = sym->st_shndx != SHN_UNDEF ? mod->text_base + sym->st_value : mod->text_base + rel->r_offset;
+        break;
+    }
+  }
+}
+
+static void bench_relocate_case(bench_image *img, const char *name, int iterations) {
+  so_module mod;
+  if (bench_load(img, &mod) < 0) {
+    printf("relocate: could not load %s\n", img->path);
+    return;
+  }
+
+  // every pass starts from the words as loaded
+  int num_relocs = img->spec.num_relative + img->spec.num_abs + img->spec.num_glob_dat + img->spec.num_jump_slot;
+  uint32_t *words = (uint32_t *)(mod.text_base + img->slots);
+  uint32_t *loaded = malloc(num_relocs * sizeof(uint32_t));
+  memcpy(loaded, words, num_relocs * sizeof(uint32_t));
+
+  bench_workers = 0;
+  for (int pass = img->spec.format == BENCH_REL ? 0 : 1; pass < 2; pass++) {
+    double elapsed = 0;
+    for (int i = 0; i < iterations; i++) {
+      memcpy(words, loaded, num_relocs * sizeof(uint32_t));
+      double start = now_us();
+      if (pass == 0)
+        old_relocate(&mod);
+      else
+        so_relocate(&mod);
+      elapsed += now_us() - start;
+    }
+    elapsed /= iterations;
+
+    printf("relocate %-4s %-7s %8.1f us %8.2f ns/reloc  %6zu KiB table  %s\n", name, pass == 0 ? "generic" : "runs",
+           elapsed, elapsed * 1000 / num_relocs, img->table_size / 1024,
+           bench_check(img, &mod, BENCH_CHECK_RELOCS) ? "ok" : "WRONG SLOTS");
+  }
+  bench_workers = 1;
+
+  // packed tables are expanded by so_load, time that on its own
+  if (img->spec.format == BENCH_APS2) {
+    const uint8_t *packed = NULL;
+    size_t size = 0;
+    for (int i = 0; i < mod.num_dynamic; i++) {
+      if (mod.dynamic[i].d_tag == DT_ANDROID_REL)
+        packed = (const uint8_t *)(mod.text_base + mod.dynamic[i].d_un.d_ptr);
+      else if (mod.dynamic[i].d_tag == DT_ANDROID_RELSZ)
+        size = mod.dynamic[i].d_un.d_val;
+    }
+
+    double elapsed = 0;
+    int ok = 1;
+    for (int i = 0; i < iterations; i++) {
+      so_module unpacked = mod;
+      unpacked.reldyn = NULL;
+      unpacked.num_reldyn = 0;
+      double start = now_us();
+      if (so_unpack_android_rel(&unpacked, packed, size) < 0)
+        ok = 0;
+      elapsed += now_us() - start;
+      if (ok && memcmp(unpacked.reldyn, mod.reldyn, mod.num_reldyn * sizeof(Elf32_Rel)) != 0)
+        ok = 0;
+      free(unpacked.reldyn);
+    }
+
+    printf("unpack   %-4s %-7s %8.1f us %8.2f ns/reloc  %6zu KiB as REL  %s\n", name, "", elapsed / iterations,
+           elapsed / iterations * 1000 / mod.num_reldyn, mod.num_reldyn * sizeof(Elf32_Rel) / 1024, ok ? "ok" : "WRONG ENTRIES");
+  }
+
+  free(loaded);
+  bench_unload(&mod);
+}
+
+// so_relocate and so_resolve as main.c calls them, with and without the
+// worker threads. the dynlib is cut short so some imports go missing
+static void bench_workers_case(bench_image *img, int iterations) {
+  so_module mod;
+  if (bench_load(img, &mod) < 0) {
+    printf("workers: could not load %s\n", img->path);
+    return;
+  }
+
+  int num_relocs = img->spec.num_relative + img->spec.num_abs + img->spec.num_glob_dat + img->spec.num_jump_slot;
+  size_t words_size = num_relocs * sizeof(uint32_t);
+  uint32_t *words = (uint32_t *)(mod.text_base + img->slots);
+  uint32_t *loaded = malloc(words_size);
+  uint32_t *result[2] = { malloc(words_size), malloc(words_size) };
+  uint32_t *resolved[2] = { malloc(words_size), malloc(words_size) };
+  so_import *imports[2] = { NULL, NULL };
+  int num_imports[2] = { 0, 0 };
+  char *log[2] = { NULL, NULL };
+  memcpy(loaded, words, words_size);
+
+  int size = sizeof(img->dynlib) - 32 * sizeof(so_default_dynlib);
+
+  for (int step = 0; step < 2; step++) {
+    for (int workers = 0; workers < 2; workers++) {
+      bench_workers = workers;
+      bench_threads_started = 0;
+      double elapsed = 0;
+      for (int i = 0; i < iterations; i++) {
+        if (step == 0) {
+          memcpy(words, loaded, words_size);
+          double start = now_us();
+          so_relocate(&mod);
+          elapsed += now_us() - start;
+        } else {
+          memcpy(words, result[0], words_size);
+          bench_log_len = 0;
+          double start = now_us();
+          so_resolve(&mod, img->dynlib, size, 0);
+          elapsed += now_us() - start;
+        }
+      }
+      elapsed /= iterations;
+
+      int same = 1;
+      if (step == 0) {
+        memcpy(result[workers], words, words_size);
+        same = memcmp(result[0], words, words_size) == 0;
+      } else {
+        memcpy(resolved[workers], words, words_size);
+        imports[workers] = malloc(mod.num_imports * sizeof(so_import));
+        memcpy(imports[workers], mod.imports, mod.num_imports * sizeof(so_import));
+        num_imports[workers] = mod.num_imports;
+        bench_log[bench_log_len] = '\0';
+        log[workers] = strdup(bench_log);
+        same = memcmp(resolved[0], words, words_size) == 0 && num_imports[workers] == num_imports[0] &&
+               memcmp(imports[workers], imports[0], num_imports[0] * sizeof(so_import)) == 0 &&
+               strcmp(log[workers], log[0]) == 0;
+      }
+
+      printf("%-8s %-10s %10.1f us  %d worker threads  %s\n", step == 0 ? "relocate" : "resolve",
+             workers ? "threaded" : "serial", elapsed, bench_threads_started / iterations,
+             same ? "same as serial" : "DIFFERENT");
+    }
+  }
+  bench_workers = 1;
+
+  int missing = 0;
+  for (const char *p = log[0]; (p = strstr(p, "{ \"")) != NULL; p++)
+    missing++;
+  printf("resolve  %d missing imports printed, %ld cores online\n", missing, sysconf(_SC_NPROCESSORS_ONLN));
+
+  for (int i = 0; i < 2; i++) {
+    free(result[i]);
+    free(resolved[i]);
+    free(imports[i]);
+    free(log[i]);
+  }
+  free(loaded);
+  bench_unload(&mod);
+}
+
+int main(int argc, char *argv[]) {
+  int relocations = argc > 1 ? atoi(argv[1]) : 120000;
+  static const char *formats[] = { "rel", "relr", "aps2", "shuf" };
+  bench_image img[4];
+  bench_spec spec;
+
+  // roughly the mix of libhomm3.so: mostly relative, a tenth against imports
+  spec.num_glob_dat = relocations / 10;
+  spec.num_abs = relocations / 20;
+  spec.num_jump_slot = BENCH_IMPORTS;
+  spec.num_relative = relocations - spec.num_glob_dat - spec.num_abs - spec.num_jump_slot;
+  spec.code_size = 4 * 1024 * 1024;
+  spec.bss_size = 512 * 1024;
+  spec.extra_size = 2 * 1024 * 1024;
+
+  for (int i = 0; i < 4; i++) {
+    spec.format = i < 3 ? i : BENCH_REL;
+    spec.scattered = i == 3;
+    if (bench_build(&img[i], &spec) < 0) {
+      fprintf(stderr, "could not write the synthetic module\n");
+      return 1;
+    }
+  }
+
+  printf("module: %d relocations, %d against %d imports, %d dynlib entries, %zu KiB\n", relocations,
+         spec.num_glob_dat + spec.num_jump_slot, BENCH_IMPORTS, BENCH_DYNLIB, img[BENCH_REL].file_size / 1024);
+
+  bench_resolve(&img[BENCH_REL], 10);
+  bench_load_case(&img[BENCH_REL], 10);
+  for (int i = 0; i < 4; i++)
+    bench_relocate_case(&img[i], formats[i], 10);
+  bench_workers_case(&img[BENCH_REL], 10);
+
+  for (int i = 0; i < 4; i++)
+    bench_destroy(&img[i]);
+  return 0;
+}
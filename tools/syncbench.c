@@ -0,0 +1,245 @@
+/* syncbench.c -- contention microbenchmark for the pooled pthread shims
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Host tool, build with: cc -O2 -pthread -o syncbench tools/syncbench.c
+ * Usage: syncbench [threads] [iterations]
+ *
+ * Runs loader/sync.c against a pthread stand-in for the lightweight mutex
+ * calls next to a copy of the old calloc and sentinel shim. The host lock
+ * is the same underneath, so the numbers compare the shim paths and the
+ * first-use initialization race, not the Vita's lwmutex itself.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SYNC_HOST
+
+#define SCE_KERNEL_MUTEX_ATTR_RECURSIVE 0x02
+#define SCE_KERNEL_ERROR_WAIT_TIMEOUT 0x80028005
+
+typedef struct {
+  pthread_mutex_t m;
+} SceKernelLwMutexWork;
+
+typedef struct {
+  pthread_cond_t c;
+  SceKernelLwMutexWork *mutex;
+} SceKernelLwCondWork;
+
+// mutexes created, the losers of an initialization race included
+static volatile int bench_inits = 0;
+
+static void debugPrintf(const char *fmt, ...) {
+  va_list list;
+  va_start(list, fmt);
+  vfprintf(stderr, fmt, list);
+  va_end(list);
+}
+
+static int sceKernelDelayThread(unsigned int us) {
+  return usleep(us);
+}
+
+static int sceKernelCreateLwMutex(SceKernelLwMutexWork *work, const char *name, unsigned int attr, int count, void *opt) {
+  pthread_mutexattr_t mattr;
+  __sync_fetch_and_add(&bench_inits, 1);
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_settype(&mattr, (attr & SCE_KERNEL_MUTEX_ATTR_RECURSIVE) ? PTHREAD_MUTEX_RECURSIVE : PTHREAD_MUTEX_ERRORCHECK);
+  int ret = pthread_mutex_init(&work->m, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+  return ret ? -1 : 0;
+}
+
+static int sceKernelLockLwMutex(SceKernelLwMutexWork *work, int count, unsigned int *timeout) {
+  return pthread_mutex_lock(&work->m) ? -1 : 0;
+}
+
+static int sceKernelUnlockLwMutex(SceKernelLwMutexWork *work, int count) {
+  return pthread_mutex_unlock(&work->m) ? -1 : 0;
+}
+
+static int sceKernelDeleteLwMutex(SceKernelLwMutexWork *work) {
+  return pthread_mutex_destroy(&work->m) ? -1 : 0;
+}
+
+static int sceKernelCreateLwCond(SceKernelLwCondWork *work, const char *name, unsigned int attr, SceKernelLwMutexWork *mutex, void *opt) {
+  work->mutex = mutex;
+  return pthread_cond_init(&work->c, NULL) ? -1 : 0;
+}
+
+static int sceKernelWaitLwCond(SceKernelLwCondWork *work, unsigned int *timeout) {
+  return pthread_cond_wait(&work->c, &work->mutex->m) ? -1 : 0;
+}
+
+static int sceKernelSignalLwCond(SceKernelLwCondWork *work) {
+  return pthread_cond_signal(&work->c);
+}
+
+static int sceKernelSignalLwCondAll(SceKernelLwCondWork *work) {
+  return pthread_cond_broadcast(&work->c);
+}
+
+static int sceKernelDeleteLwCond(SceKernelLwCondWork *work) {
+  return pthread_cond_destroy(&work->c);
+}
+
+#include "../loader/sync.c"
+
+#define BENCH_MUTEXES 64
+
+// the shim sync.c replaced: allocates on first use and checks the
+// sentinels on every call
+static int old_init(pthread_mutex_t **uid, int type) {
+  pthread_mutex_t *m = calloc(1, sizeof(pthread_mutex_t));
+  if (!m)
+    return -1;
+  __sync_fetch_and_add(&bench_inits, 1);
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, type);
+  pthread_mutex_init(m, &attr);
+  pthread_mutexattr_destroy(&attr);
+  *uid = m;
+  return 0;
+}
+
+static int old_prepare(pthread_mutex_t **uid) {
+  if (!*uid)
+    return old_init(uid, PTHREAD_MUTEX_NORMAL);
+  else if ((uintptr_t)*uid == 0x4000)
+    return old_init(uid, PTHREAD_MUTEX_RECURSIVE);
+  else if ((uintptr_t)*uid == 0x8000)
+    return old_init(uid, PTHREAD_MUTEX_ERRORCHECK);
+  return 0;
+}
+
+static int old_lock(pthread_mutex_t **uid) {
+  if (old_prepare(uid) < 0)
+    return -1;
+  return pthread_mutex_lock(*uid);
+}
+
+static int old_unlock(pthread_mutex_t **uid) {
+  if (old_prepare(uid) < 0)
+    return -1;
+  return pthread_mutex_unlock(*uid);
+}
+
+static int new_lock(uintptr_t *word) {
+  sync_mutex *m = sync_mutex_get(word);
+  return m ? sceKernelLockLwMutex(&m->work, 1, NULL) : -1;
+}
+
+static int new_unlock(uintptr_t *word) {
+  sync_mutex *m = sync_mutex_get(word);
+  return m ? sceKernelUnlockLwMutex(&m->work, 1) : -1;
+}
+
+typedef struct {
+  int use_pool;
+  int num_mutexes; // threads spread over this many mutexes
+  int iterations;
+  uintptr_t words[BENCH_MUTEXES];
+  volatile uint32_t counters[BENCH_MUTEXES];
+  pthread_barrier_t start;
+} bench_state;
+
+typedef struct {
+  bench_state *state;
+  int index;
+} bench_thread;
+
+static void *bench_run(void *arg) {
+  bench_thread *t = arg;
+  bench_state *s = t->state;
+
+  pthread_barrier_wait(&s->start);
+  for (int i = 0; i < s->iterations; i++) {
+    int j = (t->index + i) % s->num_mutexes;
+    if (s->use_pool) {
+      new_lock(&s->words[j]);
+      s->counters[j]++;
+      new_unlock(&s->words[j]);
+    } else {
+      old_lock((pthread_mutex_t **)&s->words[j]);
+      s->counters[j]++;
+      old_unlock((pthread_mutex_t **)&s->words[j]);
+    }
+  }
+
+  return NULL;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const char *name, int use_pool, int num_threads, int num_mutexes, int iterations) {
+  bench_state *s = calloc(1, sizeof(bench_state));
+  bench_thread *threads = calloc(num_threads, sizeof(bench_thread));
+  pthread_t *thids = calloc(num_threads, sizeof(pthread_t));
+
+  s->use_pool = use_pool;
+  s->num_mutexes = num_mutexes;
+  s->iterations = iterations;
+  pthread_barrier_init(&s->start, NULL, num_threads);
+
+  // every mutex starts as a static initializer, the first locks race to
+  // create it
+  bench_inits = 0;
+  double start = now_ns();
+  for (int i = 0; i < num_threads; i++) {
+    threads[i].state = s;
+    threads[i].index = i;
+    pthread_create(&thids[i], NULL, bench_run, &threads[i]);
+  }
+  for (int i = 0; i < num_threads; i++)
+    pthread_join(thids[i], NULL);
+  double elapsed = now_ns() - start;
+
+  uint64_t total = 0;
+  for (int i = 0; i < num_mutexes; i++)
+    total += s->counters[i];
+  uint64_t expected = (uint64_t)num_threads * iterations;
+
+  // the old shim leaks every extra init and may hand threads different
+  // mutexes for the same word, the pool deletes the losers
+  printf("%-6s %-12s %3d threads %3d mutexes %8.1f ns/op %4d inits  %s\n", use_pool ? "pool" : "old", name,
+         num_threads, num_mutexes, elapsed / expected, bench_inits, total == expected ? "ok" : "LOST UPDATES");
+
+  for (int i = 0; i < num_mutexes; i++) {
+    if (use_pool)
+      sync_mutex_destroy(&s->words[i]);
+    else if (s->words[i] > 0x8000)
+      free((void *)s->words[i]);
+  }
+  pthread_barrier_destroy(&s->start);
+  free(thids);
+  free(threads);
+  free(s);
+}
+
+int main(int argc, char *argv[]) {
+  int num_threads = argc > 1 ? atoi(argv[1]) : 4;
+  int iterations = argc > 2 ? atoi(argv[2]) : 1000000;
+
+  for (int use_pool = 0; use_pool < 2; use_pool++) {
+    bench("contended", use_pool, num_threads, 1, iterations);
+    bench("spread", use_pool, num_threads, BENCH_MUTEXES, iterations);
+    bench("first use", use_pool, num_threads * 4, BENCH_MUTEXES, BENCH_MUTEXES);
+  }
+
+  return 0;
+}